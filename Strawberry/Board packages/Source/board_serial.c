@@ -12,7 +12,8 @@
 #include "gpio.h"
 #include "interrupt.h"
 #include "dma.h"
-#include "timer.h"
+#include "software_timer.h"
+#include "dma_memory.h"
 
 
 //--------------------------------------------------------------------------------------------------//
@@ -103,10 +104,8 @@ void board_print_buffer(char* buffer, uint32_t size)
 	dma.transfer_type = DMA_TRANSFER_TYPE_PERIPHERAL_TRANSFER;
 	dma.trigger = DMA_TRIGGER_HARDWARE;
 	
-	uint32_t* cache_addr = (uint32_t *)((uint32_t)buffer & ~((uint32_t)32));
-	
-	// Cache can only be cleaned at 32-bytes alignment
-	SCB_CleanDCache_by_Addr(cache_addr, size + 32);
+	// The buffer might be located in the cache
+	dma_memory_clean(buffer, size);
 	
 	dma_setup_transaction(XDMAC, &dma);
 }
@@ -406,14 +405,25 @@ typedef struct
 
 
 
-static volatile serial_buffer buffer_a;
-static volatile serial_buffer buffer_b;
+// The buffers are in the non-cacheable DMA memory, so a flush needs no cache maintenance
+static volatile serial_buffer buffer_a DMA_MEMORY;
+static volatile serial_buffer buffer_b DMA_MEMORY;
 
 
 static volatile serial_buffer* current_buffer;
 static volatile serial_buffer* dma_buffer;
 
 
+// Flushes the current buffer 10 ms after the last print
+static struct software_timer flush_timer;
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void board_serial_flush_timer_callback(void* param);
+
+
 //--------------------------------------------------------------------------------------------------//
 
 
@@ -472,15 +482,9 @@ void board_serial_dma_flush_buffer(char* source_buffer, uint32_t size)
 	dma_channel_set_callback(BOARD_SERIAL_DMA_CHANNEL, board_serial_dma_callback);
 
 
-	// The serial buffer that is flushed might be located in the cache. Therefore
-	// we have to clean the cache lines that corresponds to the serial buffer. That
-	// means that the cache data is written back to memory.
-	uint32_t* cache_addr = (uint32_t *)((uint32_t)source_buffer & ~((uint32_t)32));
-
-	// Cache can only be cleaned at 32-bytes alignment
-	SCB_CleanDCache_by_Addr(cache_addr, size + 32);
-	
-	SCB_CleanDCache();
+	// The serial buffers are in the DMA memory. Other buffers might be located in the cache, and
+	// only their own cache lines are written back to memory.
+	dma_memory_clean(source_buffer, size);
 
 	dma_buffer->dma_active = 1;
 
@@ -496,19 +500,12 @@ void board_serial_dma_flush_buffer(char* source_buffer, uint32_t size)
 // which allows printing to screen with no processor overhead.
 //
 // The serial buffer will be flushed when enough bytes are ready to be transmitted,
-// or a timer overflow has occurred.
+// or the kernel flush timer has expired.
 
 void board_serial_dma_config(void)
 {
-	// Configure the timer interface (timer 0 channel 0) to overflow after 10 ms
-	clock_peripheral_clock_enable(ID_TC0_CHANNEL0);
-	
-	timer_write_protection_disable(TC0);
-	timer_capture_mode_config(TC0, TIMER_CHANNEL_0, TIMER_NONE, TIMER_NONE, TIMER_CAPTURE_MODE, 1, 0, 0, TIMER_INCREMENT_RISING_EDGE, TIMER_CLOCK_MCK_DIV_128);
-	timer_set_compare_c(TC0, TIMER_CHANNEL_0, 58595);
-	timer_interrupt_enable(TC0, TIMER_CHANNEL_0, TIMER_INTERRUPT_C_COMPARE);
-	
-	interrupt_enable_peripheral_interrupt(TC0_IRQn, IRQ_LEVEL_6);
+	// Configure a one-shot kernel timer to expire 10 ms after the last print
+	software_timer_init(&flush_timer, board_serial_flush_timer_callback, NULL, 10, SOFTWARE_TIMER_ONE_SHOT);
 	
 	dma_buffer = &buffer_b;
 	current_buffer = &buffer_a;
@@ -526,8 +523,7 @@ void board_serial_dma_config(void)
 
 void board_serial_timer_start(void)
 {
-	timer_clock_enable(TC0, TIMER_CHANNEL_0);
-	timer_software_trigger(TC0, TIMER_CHANNEL_0);
+	software_timer_reset(&flush_timer);
 }
 
 
@@ -536,7 +532,7 @@ void board_serial_timer_start(void)
 
 void board_serial_timer_stop(void)
 {
-	timer_clock_disable(TC0, TIMER_CHANNEL_0);
+	software_timer_stop(&flush_timer);
 }
 
 
@@ -637,13 +633,10 @@ void board_serial_dma_print_size(char* data, uint32_t size)
 //--------------------------------------------------------------------------------------------------//
 
 
-void TC0_Handler()
+// This runs in the kernel timer thread when no print has occurred for 10 ms
+
+static void board_serial_flush_timer_callback(void* param)
 {
-	timer_read_interrupt_status(TC0, TIMER_CHANNEL_0);
-	
-	// We have to disable the timer here
-	board_serial_timer_stop();
-	
 	// The buffer is filled up
 	board_serial_dma_switch_buffers();
 	
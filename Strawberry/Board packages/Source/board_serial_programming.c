@@ -13,6 +13,8 @@
 #include "config.h"
 #include "dma.h"
 #include "timer.h"
+#include "dma_memory.h"
+#include "scheduler.h"
 
 
 //--------------------------------------------------------------------------------------------------//
@@ -229,8 +231,9 @@ typedef struct
 
 
 
-static volatile serial_programming_buffer prog_buffer_a;
-static volatile serial_programming_buffer prog_buffer_b;
+// The buffers are in the non-cacheable DMA memory, so a flush needs no cache maintenance
+static volatile serial_programming_buffer prog_buffer_a DMA_MEMORY;
+static volatile serial_programming_buffer prog_buffer_b DMA_MEMORY;
 
 
 static volatile serial_programming_buffer* prog_current_buffer;
@@ -290,15 +293,9 @@ void board_serial_programming_dma_flush_buffer(char* source_buffer, uint32_t siz
 	dma_channel_set_callback(BOARD_SERIAL_PROGRAMMING_DMA_CHANNEL, board_serial_programming_dma_callback);
 
 
-	// The serial buffer that is flushed might be located in the cache. Therefore
-	// we have to clean the cache lines that corresponds to the serial buffer. That
-	// means that the cache data is written back to memory.
-	uint32_t* cache_addr = (uint32_t *)((uint32_t)source_buffer & ~((uint32_t)32));
-
-	// Cache can only be cleaned at 32-bytes alignment
-	SCB_CleanDCache_by_Addr(cache_addr, size + 32);
-	
-	SCB_CleanDCache();
+	// The serial buffers are in the DMA memory. Other buffers might be located in the cache, and
+	// only their own cache lines are written back to memory.
+	dma_memory_clean(source_buffer, size);
 
 	prog_dma_buffer->dma_active = 1;
 
@@ -419,6 +416,8 @@ void board_serial_programming_dma_print(char* data)
 
 void TC1_Handler()
 {
+	scheduler_interrupt_enter();
+	
 	timer_read_interrupt_status(TC0, TIMER_CHANNEL_1);
 	
 	// We have to disable the timer here
@@ -429,6 +428,8 @@ void TC1_Handler()
 	
 	// Start flushing the DMA buffer
 	board_serial_programming_dma_flush_buffer((char *)(prog_dma_buffer->data), prog_dma_buffer->position);
+	
+	scheduler_interrupt_leave();
 }
 
 
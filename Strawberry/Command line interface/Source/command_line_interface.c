@@ -15,6 +15,8 @@
 #include "interrupt.h"
 #include "dynamic_loader.h"
 #include "thread.h"
+#include "message_queue.h"
+#include "trace.h"
 
 
 //--------------------------------------------------------------------------------------------------//
@@ -52,6 +54,8 @@ void file_system_command_line_handler(void);
 
 void file_system_command_line_thread(void* args);
 
+static void file_system_command_line_receive(char data);
+
 
 //--------------------------------------------------------------------------------------------------//
 
@@ -70,9 +74,16 @@ void file_system_command_line_thread(void* args);
 static char command_line_argument[MAX_ARGUEMTNS][LENGTH_ARGUMENT];
 static char file_system_path[FILE_SYSTEM_MAX_PATH_LENGTH];
 static char file_system_tmp_path[FILE_SYSTEM_MAX_PATH_LENGTH];
-static char command_line_buffer[FILE_SYSTEM_COMMAND_BUFFER_SIZE];
 static uint16_t command_line_buffer_index = 0;
-static volatile uint8_t file_system_command_ready = 0;
+
+
+// The serial interrupt writes each command directly into a slot in the command queue, and
+// commits it when the command is complete
+#define FILE_SYSTEM_COMMAND_QUEUE_SIZE	4
+
+static uint32_t command_line_queue_buffer[MESSAGE_QUEUE_BUFFER_SIZE(FILE_SYSTEM_COMMAND_BUFFER_SIZE, FILE_SYSTEM_COMMAND_QUEUE_SIZE) / 4];
+static struct message_queue command_line_queue;
+static char* command_line_buffer = NULL;
 
 
 directory_t directory;
@@ -89,6 +100,8 @@ void file_system_command_line_config(void)
 {
 	strcpy(file_system_path, "/");
 	
+	message_queue_init(&command_line_queue, command_line_queue_buffer, FILE_SYSTEM_COMMAND_BUFFER_SIZE, FILE_SYSTEM_COMMAND_QUEUE_SIZE, MESSAGE_QUEUE_SPSC);
+	
 	file_thread = thread_new("file", file_system_command_line_thread, NULL, THREAD_PRIORITY_NORMAL, 500);
 }
 
@@ -133,14 +146,19 @@ void file_system_command_line_thread(void* args)
 				board_serial_print("Card disconnected\n");
 				break;
 			}
-			if (file_system_command_ready)
+			
+			// Wait for a command. The timeout lets us check the card status as well
+			char* command = (char *)message_queue_receive_slot(&command_line_queue, 100);
+			
+			if (command != NULL)
 			{
+				file_system_command_line_input_decode(command);
+				message_queue_release(&command_line_queue, command);
+				
 				file_system_command_line_handler();
 				file_system_command_line_print_directory();
 				
 			}
-			syscall_sleep(100);
-			
 		}
 	}
 }
@@ -370,7 +388,7 @@ file_result_t file_system_command_line_cat(char* arg)
 		return res;
 	}
 
-	char* file_system_buffer = (char *)dynamic_memory_new(DRAM_BANK_1, 1024);
+	char* file_system_buffer = (char *)dynamic_memory_new_extended(DRAM_BANK_1, 1024, DYNAMIC_MEMORY_CACHE_LINE_SIZE, DYNAMIC_MEMORY_FLAG_NO_ZERO);
 
 	do
 	{
@@ -431,7 +449,7 @@ file_result_t file_system_command_line_hex(char* arg)
 		return res;
 	}
 	
-	char* file_system_buffer = (char *)dynamic_memory_new(DRAM_BANK_1, 1024);
+	char* file_system_buffer = (char *)dynamic_memory_new_extended(DRAM_BANK_1, 1024, DYNAMIC_MEMORY_CACHE_LINE_SIZE, DYNAMIC_MEMORY_FLAG_NO_ZERO);
 
 	do
 	{
@@ -529,7 +547,7 @@ file_result_t file_system_command_line_run(char* arg)
 
 	// Before we get the data we have to allocate space for it
 	uint8_t* application = (uint8_t *)dynamic_memory_new(SRAM, 2000);
-	char* file_system_buffer = (char *)dynamic_memory_new(DRAM_BANK_1, 1024);
+	char* file_system_buffer = (char *)dynamic_memory_new_extended(DRAM_BANK_1, 1024, DYNAMIC_MEMORY_CACHE_LINE_SIZE, DYNAMIC_MEMORY_FLAG_NO_ZERO);
 	uint8_t* application_iterator = application;
 	do
 	{
@@ -622,8 +640,6 @@ void file_system_command_line_input_decode(char* data)
 		command_line_argument[argument_index][char_index] = '\0';
 		char_index = 0;
 	}
-	
-	file_system_command_ready = 1;
 }
 
 
@@ -662,7 +678,13 @@ void file_system_command_line_handler(void)
 	{
 		result = file_system_command_line_hex(command_line_argument[1]);
 	}
-	file_system_command_ready = 0;
+	#if KERNEL_TRACE_ENABLE
+	else if (!strncmp(command_line_argument[0], "trace", 5))
+	{
+		// Binary dump for Tools/trace_to_json.py
+		trace_dump();
+	}
+	#endif
 	
 	if (result != FR_OK)
 	{
@@ -676,8 +698,40 @@ void file_system_command_line_handler(void)
 
 void USART1_Handler()
 {
+	scheduler_interrupt_enter();
+	
 	// The RXRDY flag is cleared upon read of RHR
-	char data = (char)usart_read(USART1);
+	file_system_command_line_receive((char)usart_read(USART1));
+	
+	scheduler_interrupt_leave();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Adds a received byte to the command being typed, and sends the command to the command line
+// thread at the end of the line
+
+static void file_system_command_line_receive(char data)
+{
+	// The command line is not running
+	if (file_thread == NULL)
+	{
+		return;
+	}
+	
+	// Start a new command in the next free slot. The input is dropped if the queue is full.
+	if (command_line_buffer == NULL)
+	{
+		command_line_buffer = (char *)message_queue_reserve(&command_line_queue, 0);
+		command_line_buffer_index = 0;
+		
+		if (command_line_buffer == NULL)
+		{
+			return;
+		}
+	}
 
 	// Local echo to the serial interface
 	//board_serial_write(data);
@@ -689,16 +743,19 @@ void USART1_Handler()
 
 	if (data != '\n')
 	{
-		command_line_buffer[command_line_buffer_index++] = data;
+		if (command_line_buffer_index < FILE_SYSTEM_COMMAND_BUFFER_SIZE - 1)
+		{
+			command_line_buffer[command_line_buffer_index++] = data;
+		}
 	}
 	else
 	{
 		command_line_buffer[command_line_buffer_index] = '\0';
 		command_line_buffer_index = 0;
 
-		// Set a flag here
-		file_system_command_ready = 1;
-		file_system_command_line_input_decode(command_line_buffer);
+		// Send the command to the file system thread
+		message_queue_commit(&command_line_queue, command_line_buffer);
+		command_line_buffer = NULL;
 	}
 }
 
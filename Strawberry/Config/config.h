@@ -58,6 +58,12 @@
 // Max name length for a memory section
 #define DYNAMIC_MEMORY_SECTION_NAME_SIZE	32
 
+// The allocator splits every power of two range of block sizes in 2^N free lists
+#define DYNAMIC_MEMORY_SECOND_LEVEL_LOG2	4
+
+// Every memory section must be smaller than 2^N bytes
+#define DYNAMIC_MEMORY_FIRST_LEVEL_MAX		20
+
 
 //--------------------------------------------------------------------------------------------------//
 
@@ -111,6 +117,10 @@
 // The print handler must have the format print_function(char*, ...)
 #define CHECK_PRINT_HANDLER					board_serial_programming_print
 
+// Controls whether the kernel lists are searched for the node on every insert and remove. The
+// search is linear in the list length, so it is kept apart from the other checks.
+#define CHECK_ENABLE_LIST_SEARCH			0
+
 
 //--------------------------------------------------------------------------------------------------//
 
@@ -129,12 +139,77 @@
 // Specifies the stack size allocated for the idle thread
 #define KERNEL_IDLE_THREAD_STACK_SIZE		100
 
+// Thread stacks are filled with this pattern. The idle thread checks at most
+// KERNEL_STACK_SCAN_WORDS stack words each time it runs to find the peak stack usage
+#define KERNEL_STACK_PAINT_PATTERN			0xA5A5A5A5
+#define KERNEL_STACK_SCAN_WORDS				32
+
+// Number of thread structures in each slab of the thread cache, and the stack pools used by
+// thread_new. The first slab is preallocated. Each pool holds KERNEL_STACK_POOL_COUNTS stacks of
+// KERNEL_STACK_POOL_SIZES words. The sizes must be increasing. Threads not fitting in the pools are allocated from dynamic memory.
+#define KERNEL_THREAD_SLAB_SIZE				16
+#define KERNEL_STACK_POOL_SIZES				{ 128, 256, 512, 1024 }
+#define KERNEL_STACK_POOL_COUNTS			{ 8, 8, 4, 2 }
+
 // Frequency of the kernel interrupt
 #define KERNEL_TICK_FREQUENCY				1000
 
+// Interrupt level of the SysTick and the other interrupts calling the kernel. Critical sections
+// mask this level and below, so interrupts above it are never delayed by the kernel, but they
+// must not call the kernel either.
+#define KERNEL_INTERRUPT_LEVEL				IRQ_LEVEL_1
+
+// When 1 the critical sections record the longest time the kernel interrupts have been masked,
+// and where that critical section was entered
+#define CRITICAL_SECTION_MEASURE			0
+
+// When 1 the spinlocks and reader-writer locks count acquisitions and contention, and record the
+// longest time they were held
+#define SPINLOCK_MEASURE					0
+
 // Statistics will be calculated every 1000 context switched
 #define KERNEL_STATISTICS_FREQUENCY			1000
 
+// Each slot in the kernel delay wheel covers 2^KERNEL_DELAY_WHEEL_SLOT_SHIFT microseconds
+#define KERNEL_DELAY_WHEEL_SLOT_SHIFT		10
+
+// When enabled the SysTick is reprogrammed to the next delay expiry whenever the idle thread
+// runs, instead of interrupting every time slice
+#define KERNEL_TICKLESS_IDLE				1
+
+// Priority and stack size of the thread running the software timer callbacks
+#define KERNEL_TIMER_THREAD_PRIORITY		THREAD_PRIORITY_REAL_TIME
+#define KERNEL_TIMER_THREAD_STACK_SIZE		200
+
+// The kernel clock counts the peripheral clock divided by 8 on a chained timer pair. One clock
+// tick is KERNEL_CLOCK_NS_MULTIPLIER / KERNEL_CLOCK_NS_DIVIDER nanoseconds. The clock interrupt
+// wakes the threads sleeping with thread_sleep_until.
+#define KERNEL_CLOCK_NS_MULTIPLIER			160
+#define KERNEL_CLOCK_NS_DIVIDER				3
+#define KERNEL_CLOCK_IRQ_LEVEL				KERNEL_INTERRUPT_LEVEL
+
+// The reaper thread frees the memory of threads that have exited
+#define KERNEL_REAPER_THREAD_PRIORITY		THREAD_PRIORITY_BULK
+#define KERNEL_REAPER_THREAD_STACK_SIZE		200
+
+// Priority and stack size of the system work queue thread running deferred interrupt work
+#define KERNEL_WORK_QUEUE_PRIORITY			THREAD_PRIORITY_REAL_TIME
+#define KERNEL_WORK_QUEUE_STACK_SIZE		200
+
+// Periodic real time threads are scheduled by earliest deadline first when this is 1, and by
+// deadline monotonic priority when it is 0
+#define KERNEL_REAL_TIME_EDF				1
+
+// The admission control keeps the utilization of the periodic real time threads below this
+// percentage. The shortest time slice given to a real time thread is in microseconds.
+#define KERNEL_REAL_TIME_MAX_UTILIZATION	90
+#define KERNEL_REAL_TIME_MIN_SLICE			20
+
+// Records scheduler events in a trace ring that can be dumped over the DMA serial interface.
+// The number of records must be a power of two.
+#define KERNEL_TRACE_ENABLE					0
+#define KERNEL_TRACE_RECORDS				1024
+
 
 #define KERNEL_FAULT_ENABLE_PRINT_HANDLER	1
 
@@ -145,6 +220,11 @@
 #define DMA_INTERRUPT_PRIORITY				IRQ_LEVEL_3
 
 
+// Priority and stack size of the USB host work queue handling the USB interrupts
+#define USB_HOST_WORK_QUEUE_PRIORITY		THREAD_PRIORITY_INTERACTIVE
+#define USB_HOST_WORK_QUEUE_STACK_SIZE		300
+
+
 //--------------------------------------------------------------------------------------------------//
 
 
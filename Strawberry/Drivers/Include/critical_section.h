@@ -13,6 +13,30 @@
 
 
 #include "sam.h"
+#include "config.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Critical sections
+//
+// CRITICAL_SECTION_ENTER raises BASEPRI to the kernel interrupt level. This masks the kernel
+// interrupts and every interrupt below them, while interrupts above the kernel level keep running.
+// Those interrupts must therefore never call the kernel or use data protected by a critical
+// section. Critical sections may be nested, since each one restores the BASEPRI value it found.
+//
+// CRITICAL_SECTION_ENTER_ALL masks every interrupt with PRIMASK. It is only needed for data
+// shared with the interrupts above the kernel level.
+
+struct critical_section_stats
+{
+	// The longest time the kernel interrupts have been masked in CPU cycles, and the address of
+	// the code entering that critical section. Count is the number of outermost critical sections.
+	uint32_t	max_cycles;
+	uint32_t	max_call_site;
+	uint32_t	count;
+};
 
 
 //--------------------------------------------------------------------------------------------------//
@@ -22,6 +46,18 @@ void core_enter_critical_section(uint32_t volatile *atomic);
 
 void core_leave_critical_section(uint32_t volatile *atomic);
 
+void core_enter_critical_section_all(uint32_t volatile *atomic);
+
+void core_leave_critical_section_all(uint32_t volatile *atomic);
+
+#if CRITICAL_SECTION_MEASURE
+
+void critical_section_get_stats(struct critical_section_stats* stats);
+
+void critical_section_reset_stats(void);
+
+#endif
+
 
 //--------------------------------------------------------------------------------------------------//
 
@@ -39,6 +75,19 @@ void core_leave_critical_section(uint32_t volatile *atomic);
 
 
 
+#define CRITICAL_SECTION_ENTER_ALL()			\
+{								\
+	volatile uint32_t __atomic;				\
+	core_enter_critical_section_all(&__atomic);
+
+
+
+#define CRITICAL_SECTION_LEAVE_ALL()			\
+	core_leave_critical_section_all(&__atomic);		\
+}
+
+
+
 
 //--------------------------------------------------------------------------------------------------//
 
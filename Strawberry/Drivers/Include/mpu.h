@@ -0,0 +1,37 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#ifndef MPU_H
+#define MPU_H
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include "sam.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// MPU regions used by the system. Everything outside the regions keeps the default memory map.
+
+#define MPU_REGION_DMA_MEMORY		0
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void mpu_config(void);
+
+void mpu_region_non_cacheable_config(uint8_t region, uint32_t address, uint32_t size);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#endif
\ No newline at end of file
@@ -30,6 +30,8 @@ void systick_enable(void);
 
 void systick_set_reload_value(uint32_t value);
 
+uint32_t systick_get_reload_value(void);
+
 void systick_set_counter_value(uint32_t value);
 
 uint32_t systick_get_counter_value(void);
@@ -97,6 +97,26 @@ typedef enum
 } timer_waveform_mode_e;
 
 
+
+typedef enum
+{
+	TIMER_WAVEFORM_UP,
+	TIMER_WAVEFORM_UPDOWN,
+	TIMER_WAVEFORM_UP_RC,
+	TIMER_WAVEFORM_UPDOWN_RC
+} timer_waveform_select_e;
+
+
+
+typedef enum
+{
+	TIMER_OUTPUT_NONE,
+	TIMER_OUTPUT_SET,
+	TIMER_OUTPUT_CLEAR,
+	TIMER_OUTPUT_TOGGLE
+} timer_output_effect_e;
+
+
 //--------------------------------------------------------------------------------------------------//
 
 
@@ -159,6 +179,17 @@ void timer_capture_mode_config(	Tc* hardware,
 								timer_clock_invert_e clock_invert,
 								timer_clock_source_e clock_source);
 
+void timer_waveform_mode_config(Tc* hardware,
+								timer_channel_e channel,
+								timer_waveform_select_e waveform_select,
+								timer_output_effect_e a_compare_effect,
+								timer_output_effect_e c_compare_effect,
+								uint8_t stop_on_c_compare,
+								timer_clock_invert_e clock_invert,
+								timer_clock_source_e clock_source);
+
+void timer_chain_config(Tc* hardware, timer_channel_e channel);
+
 
 //--------------------------------------------------------------------------------------------------//
 
@@ -23,12 +23,12 @@ void cache_clean(void)
 
 void cache_clean_addresses(uint32_t* addr, uint32_t size)
 {
-	// Cache clean by address only works on 32-bit aligned data
-	// We therefore have to align the start address and the size
-	uint32_t* new_address = (uint32_t *)((uint32_t)addr & ~32);
-	uint32_t new_size = (size + 32) & ~32;
+	// Cache clean by address works on whole 32-byte cache lines
+	// We therefore have to widen the range to cache lines
+	uint32_t start = (uint32_t)addr & ~31;
+	uint32_t end = ((uint32_t)addr + size + 31) & ~31;
 	
-	SCB_CleanDCache_by_Addr(new_address, new_size);
+	SCB_CleanDCache_by_Addr((uint32_t *)start, end - start);
 }
 
 
@@ -46,12 +46,12 @@ void cache_invalidate(void)
 
 void cache_invalidate_addresses(uint32_t* addr, uint32_t size)
 {
-	// Cache clean by address only works on 32-bit aligned data
-	// We therefore have to align the start address and the size
-	uint32_t* new_address = (uint32_t *)((uint32_t)addr & ~32);
-	uint32_t new_size = (size + 32) & ~32;
+	// Cache invalidate by address works on whole 32-byte cache lines
+	// We therefore have to widen the range to cache lines
+	uint32_t start = (uint32_t)addr & ~31;
+	uint32_t end = ((uint32_t)addr + size + 31) & ~31;
 	
-	SCB_InvalidateDCache_by_Addr(new_address, new_size);
+	SCB_InvalidateDCache_by_Addr((uint32_t *)start, end - start);
 }
 
 
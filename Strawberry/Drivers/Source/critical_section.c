@@ -6,6 +6,7 @@
 // the software.
 
 #include "critical_section.h"
+#include "interrupt.h"
 #include "cmsis_gcc.h"
 #include "core_cm7.h"
 
@@ -13,10 +14,55 @@
 //--------------------------------------------------------------------------------------------------//
 
 
+// BASEPRI value masking the kernel interrupt level and below. Only the upper priority bits are
+// implemented.
+#define CRITICAL_SECTION_BASEPRI		(KERNEL_INTERRUPT_LEVEL << (8 - __NVIC_PRIO_BITS))
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#if CRITICAL_SECTION_MEASURE
+
+// Only the outermost critical section is timed. No kernel interrupt can run inside it, so the
+// entry values need no further protection.
+
+static struct critical_section_stats critical_section_stats;
+
+static uint32_t critical_section_entry_cycles;
+static uint32_t critical_section_entry_site;
+
+#endif
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Cortex-M7 r0p1 erratum 837070: an interrupt being masked by a BASEPRI write may still be taken
+// right after the write. All interrupts are therefore masked around the write, like in the FreeRTOS
+// port for this core. PRIMASK is restored rather than cleared, so that a critical section nested
+// inside CRITICAL_SECTION_ENTER_ALL keeps every interrupt masked.
+
 void core_enter_critical_section(uint32_t volatile *atomic)
 {
-	*atomic = __get_PRIMASK();
+	uint32_t primask = __get_PRIMASK();
+	
+	*atomic = __get_BASEPRI();
+	
 	__disable_irq();
+	__set_BASEPRI_MAX(CRITICAL_SECTION_BASEPRI);
+	__DSB();
+	__ISB();
+	__set_PRIMASK(primask);
+	
+#if CRITICAL_SECTION_MEASURE
+	if (*atomic == 0)
+	{
+		critical_section_entry_cycles = DWT->CYCCNT;
+		critical_section_entry_site = (uint32_t)__builtin_return_address(0);
+	}
+#endif
+	
 	__DMB();
 }
 
@@ -25,10 +71,81 @@ void core_enter_critical_section(uint32_t volatile *atomic)
 
 
 void core_leave_critical_section(uint32_t volatile *atomic)
+{
+	__DMB();
+	
+#if CRITICAL_SECTION_MEASURE
+	if (*atomic == 0)
+	{
+		uint32_t cycles = DWT->CYCCNT - critical_section_entry_cycles;
+		
+		critical_section_stats.count++;
+		
+		if (cycles > critical_section_stats.max_cycles)
+		{
+			critical_section_stats.max_cycles = cycles;
+			critical_section_stats.max_call_site = critical_section_entry_site;
+		}
+	}
+#endif
+	
+	__set_BASEPRI(*atomic);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void core_enter_critical_section_all(uint32_t volatile *atomic)
+{
+	*atomic = __get_PRIMASK();
+	__disable_irq();
+	__DMB();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void core_leave_critical_section_all(uint32_t volatile *atomic)
 {
 	__DMB();
 	__set_PRIMASK(*atomic);
 }
 
 
-//--------------------------------------------------------------------------------------------------//
\ No newline at end of file
+//--------------------------------------------------------------------------------------------------//
+
+
+#if CRITICAL_SECTION_MEASURE
+
+
+void critical_section_get_stats(struct critical_section_stats* stats)
+{
+	CRITICAL_SECTION_ENTER_ALL();
+	
+	*stats = critical_section_stats;
+	
+	CRITICAL_SECTION_LEAVE_ALL();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void critical_section_reset_stats(void)
+{
+	CRITICAL_SECTION_ENTER_ALL();
+	
+	critical_section_stats.max_cycles = 0;
+	critical_section_stats.max_call_site = 0;
+	critical_section_stats.count = 0;
+	
+	CRITICAL_SECTION_LEAVE_ALL();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#endif
\ No newline at end of file
@@ -12,6 +12,20 @@
 #include "config.h"
 #include "check.h"
 #include "board_serial.h"
+#include "work_queue.h"
+#include "scheduler.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include <stddef.h>
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void dma_error_work_handler(void* argument);
 
 
 //--------------------------------------------------------------------------------------------------//
@@ -20,6 +34,13 @@
 static dma_callback dma_handlers[10];
 
 
+// DMA errors are reported from the system work queue. The interrupt saves the channel status
+// until the error has been printed.
+static volatile uint32_t dma_error_status[DMA_NUMBER_OF_CHANNELS];
+
+static struct work dma_error_work = WORK_INITIALIZER(dma_error_work, dma_error_work_handler, NULL);
+
+
 //--------------------------------------------------------------------------------------------------//
 
 
@@ -77,9 +98,7 @@ void dma_channel_mode_config(	Xdmac* hardware,
 						(burst_size << XDMAC_CC_MBSIZE_Pos) |
 						(transfer_type << XDMAC_CC_TYPE_Pos);
 	
-	CRITICAL_SECTION_ENTER()
 	hardware->XdmacChid[channel_number].XDMAC_CC = tmp_reg;
-	CRITICAL_SECTION_LEAVE()
 }
 
 
@@ -129,9 +148,7 @@ void dma_config(void)
 
 void dma_global_interrupt_enable(Xdmac* hardware, uint8_t channel_number)
 {
-	CRITICAL_SECTION_ENTER()
 	hardware->XDMAC_GIE = (1 << channel_number);
-	CRITICAL_SECTION_LEAVE()
 }
 
 
@@ -140,9 +157,7 @@ void dma_global_interrupt_enable(Xdmac* hardware, uint8_t channel_number)
 
 void dma_global_interrupt_disable(Xdmac* hardware, uint8_t channel_number)
 {
-	CRITICAL_SECTION_ENTER()
 	hardware->XDMAC_GID = (1 << channel_number);
-	CRITICAL_SECTION_LEAVE()
 }
 
 
@@ -217,9 +232,7 @@ void dma_global_resume_destination_request(Xdmac* hardware, uint8_t channel_numb
 
 void dma_global_suspend_rw_request(Xdmac* hardware, uint8_t channel_number)
 {
-	CRITICAL_SECTION_ENTER()
 	hardware->XDMAC_GRWS = (1 << channel_number);
-	CRITICAL_SECTION_LEAVE()
 }
 
 
@@ -228,9 +241,7 @@ void dma_global_suspend_rw_request(Xdmac* hardware, uint8_t channel_number)
 
 void dma_global_resume_rw_request(Xdmac* hardware, uint8_t channel_number)
 {
-	CRITICAL_SECTION_ENTER()
 	hardware->XDMAC_GRWR = (1 << channel_number);
-	CRITICAL_SECTION_LEAVE()
 }
 
 
@@ -239,9 +250,7 @@ void dma_global_resume_rw_request(Xdmac* hardware, uint8_t channel_number)
 
 void dma_channel_interrupt_enable(Xdmac* hardware, uint8_t channel_number, uint32_t interrupt_mask)
 {
-	CRITICAL_SECTION_ENTER()
 	hardware->XdmacChid[channel_number].XDMAC_CIE = interrupt_mask;
-	CRITICAL_SECTION_LEAVE()
 }
 
 
@@ -250,9 +259,7 @@ void dma_channel_interrupt_enable(Xdmac* hardware, uint8_t channel_number, uint3
 
 void dma_channel_interrupt_disable(Xdmac* hardware, uint8_t channel_number, uint32_t interrupt_mask)
 {
-	CRITICAL_SECTION_ENTER()
 	hardware->XdmacChid[channel_number].XDMAC_CID = interrupt_mask;
-	CRITICAL_SECTION_LEAVE()
 }
 
 
@@ -283,9 +290,7 @@ uint32_t dma_read_channel_interrupt_mask_register(Xdmac* hardware, uint8_t chann
 
 void dma_channel_enable(Xdmac* hardware, uint8_t channel_number)
 {
-	CRITICAL_SECTION_ENTER()
 	hardware->XDMAC_GE = (1 << channel_number);
-	CRITICAL_SECTION_LEAVE()
 }
 
 
@@ -294,9 +299,7 @@ void dma_channel_enable(Xdmac* hardware, uint8_t channel_number)
 
 void dma_channel_disable(Xdmac* hardware, uint8_t channel_number)
 {
-	CRITICAL_SECTION_ENTER()
 	hardware->XDMAC_GD = (1 << channel_number);
-	CRITICAL_SECTION_LEAVE()
 }
 
 
@@ -323,9 +326,7 @@ uint8_t dma_read_channel_status(Xdmac* hardware, uint8_t channel_number)
 
 void dma_channel_set_destination_address(Xdmac* hardware, uint8_t channel_number, const void* const destination_address)
 {
-	CRITICAL_SECTION_ENTER()
 	hardware->XdmacChid[channel_number].XDMAC_CDA = (uint32_t)destination_address;
-	CRITICAL_SECTION_LEAVE()
 }
 
 
@@ -334,9 +335,7 @@ void dma_channel_set_destination_address(Xdmac* hardware, uint8_t channel_number
 
 void dma_channel_set_source_address(Xdmac* hardware, uint8_t channel_number, const void* const source_address)
 {
-	CRITICAL_SECTION_ENTER()
 	hardware->XdmacChid[channel_number].XDMAC_CSA = (uint32_t)source_address;
-	CRITICAL_SECTION_LEAVE()
 }
 
 
@@ -345,9 +344,7 @@ void dma_channel_set_source_address(Xdmac* hardware, uint8_t channel_number, con
 
 void dma_channel_set_microblock_length(Xdmac* hardware, uint8_t channel_number, uint32_t length)
 {
-	CRITICAL_SECTION_ENTER()
 	hardware->XdmacChid[channel_number].XDMAC_CUBC = (XDMAC_CUBC_UBLEN_Msk & length);
-	CRITICAL_SECTION_LEAVE()
 }
 
 
@@ -356,9 +353,7 @@ void dma_channel_set_microblock_length(Xdmac* hardware, uint8_t channel_number,
 
 void dma_channel_set_block_length(Xdmac* hardware, uint8_t channel_number, uint32_t length)
 {
-	CRITICAL_SECTION_ENTER()
 	hardware->XdmacChid[channel_number].XDMAC_CBC = (XDMAC_CBC_BLEN_Msk & length);
-	CRITICAL_SECTION_LEAVE()
 }
 
 
@@ -367,9 +362,7 @@ void dma_channel_set_block_length(Xdmac* hardware, uint8_t channel_number, uint3
 
 void dma_channel_software_trigger_request(Xdmac* hardware, uint8_t channel_number)
 {
-	CRITICAL_SECTION_ENTER()
 	hardware->XDMAC_GSWR = (1 << channel_number);
-	CRITICAL_SECTION_LEAVE()
 }
 
 
@@ -378,9 +371,7 @@ void dma_channel_software_trigger_request(Xdmac* hardware, uint8_t channel_numbe
 
 void dma_channel_software_flush(Xdmac* hardware, uint8_t channel_number)
 {
-	CRITICAL_SECTION_ENTER()
 	hardware->XDMAC_GSWF = (1 << channel_number);
-	CRITICAL_SECTION_LEAVE()
 }
 
 
@@ -408,9 +399,7 @@ void dma_channel_set_microblock_stride_memory_pattern(Xdmac* hardware, uint8_t c
 	new_stride = ~new_stride;
 	new_stride++;
 	
-	CRITICAL_SECTION_ENTER()
 	hardware->XdmacChid[channel_number].XDMAC_CSUS = new_stride;
-	CRITICAL_SECTION_LEAVE()
 }
 
 
@@ -519,9 +508,7 @@ void dma_channel_configure(Xdmac* hardware, dma_microblock_transaction_descripto
 
 	check(dma_descriptor->channel >= 0);
 	
-	CRITICAL_SECTION_ENTER()
 	hardware->XdmacChid[dma_descriptor->channel].XDMAC_CC = dma_config_register;
-	CRITICAL_SECTION_LEAVE()
 }
 
 
@@ -541,6 +528,8 @@ void dma_channel_set_callback(uint8_t dma_channel, dma_callback callback)
 
 void XDMAC_Handler()
 {
+	scheduler_interrupt_enter();
+	
 	int8_t source_channel = -1;
 	uint32_t global_status = dma_read_global_interrupt_status_register(XDMAC);
 	
@@ -556,6 +545,7 @@ void XDMAC_Handler()
 	
 	if (source_channel < 0)
 	{
+		scheduler_interrupt_leave();
 		return;
 	}
 	
@@ -564,8 +554,9 @@ void XDMAC_Handler()
 	if (channel_status & (XDMAC_CIS_ROIS_Msk | XDMAC_CIS_WBEIS_Msk | XDMAC_CIS_RBEIS_Msk))
 	{
 		// An error has occurred
-		board_serial_print("DMA Error on channel %d\n", source_channel);
-		board_serial_print_register("Status code: ", channel_status);
+		dma_error_status[source_channel] |= channel_status;
+		
+		work_submit(&dma_error_work);
 	}
 	else if (channel_status & XDMAC_CIS_BIS_Msk)
 	{
@@ -573,6 +564,33 @@ void XDMAC_Handler()
 		// We call the appropriate handler
 		dma_handlers[source_channel](source_channel);
 	}
+	
+	scheduler_interrupt_leave();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void dma_error_work_handler(void* argument)
+{
+	for (uint8_t i = 0; i < DMA_NUMBER_OF_CHANNELS; i++)
+	{
+		uint32_t channel_status;
+		
+		CRITICAL_SECTION_ENTER();
+		
+		channel_status = dma_error_status[i];
+		dma_error_status[i] = 0;
+		
+		CRITICAL_SECTION_LEAVE();
+		
+		if (channel_status)
+		{
+			board_serial_print("DMA Error on channel %d\n", i);
+			board_serial_print_register("Status code: ", channel_status);
+		}
+	}
 }
 
 
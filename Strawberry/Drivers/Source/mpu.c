@@ -0,0 +1,72 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#include "mpu.h"
+#include "check.h"
+#include "core_cm7.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Variables declared extern in the linker script
+// These mark the beginning and end of the non-cacheable DMA memory
+extern uint32_t _sdma_memory;
+extern uint32_t _edma_memory;
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Maps the DMA memory as non-cacheable and enables the MPU. The default memory map is kept for
+// everything else. This must be called before the data cache is enabled.
+
+void mpu_config(void)
+{
+	__DMB();
+	
+	MPU->CTRL = 0;
+	
+	mpu_region_non_cacheable_config(MPU_REGION_DMA_MEMORY, (uint32_t)&_sdma_memory, (uint32_t)&_edma_memory - (uint32_t)&_sdma_memory);
+	
+	MPU->CTRL = MPU_CTRL_PRIVDEFENA_Msk | MPU_CTRL_ENABLE_Msk;
+	
+	__DSB();
+	__ISB();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Configures a region as normal, shareable, non-cacheable memory with full access and no
+// execution. The size must be a power of two of at least 32 bytes, and the address must be
+// aligned to the size.
+
+void mpu_region_non_cacheable_config(uint8_t region, uint32_t address, uint32_t size)
+{
+	check((size >= 32) && ((size & (size - 1)) == 0));
+	check((address & (size - 1)) == 0);
+	
+	// The size field holds log2(size) - 1
+	uint32_t size_field = 30 - __CLZ(size);
+	
+	MPU->RNR = region;
+	MPU->RBAR = address & MPU_RBAR_ADDR_Msk;
+	
+	MPU->RASR = (1 << MPU_RASR_XN_Pos) |
+				(0b011 << MPU_RASR_AP_Pos) |
+				(0b001 << MPU_RASR_TEX_Pos) |
+				(1 << MPU_RASR_S_Pos) |
+				(0 << MPU_RASR_C_Pos) |
+				(0 << MPU_RASR_B_Pos) |
+				(size_field << MPU_RASR_SIZE_Pos) |
+				MPU_RASR_ENABLE_Msk;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
\ No newline at end of file
@@ -84,6 +84,15 @@ void systick_set_reload_value(uint32_t value)
 //--------------------------------------------------------------------------------------------------//
 
 
+uint32_t systick_get_reload_value(void)
+{
+	return SysTick->LOAD;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
 void systick_set_counter_value(uint32_t value)
 {
 	CRITICAL_SECTION_ENTER()
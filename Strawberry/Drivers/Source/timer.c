@@ -216,4 +216,57 @@ void timer_capture_mode_config(	Tc* hardware,
 }
 
 
+//--------------------------------------------------------------------------------------------------//
+
+
+// This configuration is for the waveform mode. The compare effects set the TIOA output when the
+// counter matches register A and register C.
+
+void timer_waveform_mode_config(Tc* hardware,
+								timer_channel_e channel,
+								timer_waveform_select_e waveform_select,
+								timer_output_effect_e a_compare_effect,
+								timer_output_effect_e c_compare_effect,
+								uint8_t stop_on_c_compare,
+								timer_clock_invert_e clock_invert,
+								timer_clock_source_e clock_source)
+{
+	uint32_t tmp =	(c_compare_effect << TC_CMR_WAVEFORM_ACPC_Pos) |
+					(a_compare_effect << TC_CMR_WAVEFORM_ACPA_Pos) |
+					(1 << TC_CMR_WAVE_Pos) |
+					(waveform_select << TC_CMR_WAVEFORM_WAVSEL_Pos) |
+					(stop_on_c_compare << TC_CMR_WAVEFORM_CPCSTOP_Pos) |
+					(clock_invert << TC_CMR_CLKI_Pos) |
+					(clock_source << TC_CMR_TCCLKS_Pos);
+	
+	CRITICAL_SECTION_ENTER()
+	hardware->TcChannel[channel].TC_CMR = tmp;
+	CRITICAL_SECTION_LEAVE()
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Clocks the channel from the TIOA output of the channel below, so that the channels form one
+// wider counter. Channel 1 must then use the clock source TIMER_CLOCK_X1, and channel 2 the clock
+// source TIMER_CLOCK_X2.
+
+void timer_chain_config(Tc* hardware, timer_channel_e channel)
+{
+	CRITICAL_SECTION_ENTER()
+	if (channel == TIMER_CHANNEL_1)
+	{
+		// XC1 is connected to TIOA0
+		hardware->TC_BMR = (hardware->TC_BMR & ~TC_BMR_TC1XC1S_Msk) | (2 << TC_BMR_TC1XC1S_Pos);
+	}
+	else if (channel == TIMER_CHANNEL_2)
+	{
+		// XC2 is connected to TIOA1
+		hardware->TC_BMR = (hardware->TC_BMR & ~TC_BMR_TC2XC2S_Msk) | (3 << TC_BMR_TC2XC2S_Pos);
+	}
+	CRITICAL_SECTION_LEAVE()
+}
+
+
 //--------------------------------------------------------------------------------------------------//
\ No newline at end of file
@@ -30,6 +30,7 @@
 
 // Make the current thread pointer visible by declaring it extern
 .extern scheduler
+.extern scheduler_context_switch_accounting
 
 
 //--------------------------------------------------------------------------------------------------//
@@ -69,6 +70,12 @@ PendSV_Handler:
 	// since this might have changed
 	str					r0,					[r1]
 
+	// Charge the cycles since the last context switch to the current thread.
+	// r3 and lr are saved, which also keeps the stack 8 byte aligned
+	push				{r3, lr}
+	bl					scheduler_context_switch_accounting
+	pop					{r3, lr}
+
 	// Load the next thread into r1 and the next stack into r0
 	ldr					r2,					=scheduler
 	add					r2,					r2, #4
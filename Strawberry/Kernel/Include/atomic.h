@@ -18,13 +18,121 @@
 //--------------------------------------------------------------------------------------------------//
 
 
-void atomic_increment(uint32_t* memory);
+// Atomic operations
+//
+// The 32-bit operations use the LDREX and STREX instructions, and may be used from any thread or
+// interrupt. Every operation is a full memory barrier. The Cortex-M7 has no 64-bit exclusive
+// access, so the 64-bit operations mask all interrupts for a few instructions instead.
+//
+// On the host the same functions are built on the GCC atomic builtins, so code using them can be
+// tested in host builds like the simulator in Tools/Simulator.
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Lock free stack. The nodes are embedded in the objects pushed on the stack. A popped node may be
+// read by another pop that is about to fail, so the memory must stay valid, like pooled objects.
+
+struct atomic_stack_node
+{
+	struct atomic_stack_node*			next;
+};
+
+
+struct atomic_stack
+{
+	struct atomic_stack_node* volatile	top;
+};
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Lock free queue with many producers and one consumer. The nodes are embedded in the objects in
+// the queue. Producers may push from any thread or interrupt. A pop can return NULL while a push
+// is in progress, even if other nodes have been pushed after it.
+
+struct atomic_queue_node
+{
+	struct atomic_queue_node* volatile	next;
+};
+
+
+struct atomic_queue
+{
+	struct atomic_queue_node* volatile	tail;
+	struct atomic_queue_node*			head;
+	struct atomic_queue_node			stub;
+};
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void atomic_increment(volatile uint32_t* memory);
+
+void atomic_decrement(volatile uint32_t* memory);
+
+void atomic_write(volatile uint32_t* memory, uint32_t value);
+
+uint32_t atomic_read(volatile uint32_t* memory);
+
+uint32_t atomic_exchange(volatile uint32_t* memory, uint32_t value);
+
+uint8_t atomic_compare_exchange(volatile uint32_t* memory, uint32_t* expected, uint32_t desired);
+
+uint32_t atomic_fetch_add(volatile uint32_t* memory, uint32_t value);
+
+uint32_t atomic_fetch_sub(volatile uint32_t* memory, uint32_t value);
+
+uint32_t atomic_fetch_and(volatile uint32_t* memory, uint32_t value);
+
+uint32_t atomic_fetch_or(volatile uint32_t* memory, uint32_t value);
+
+uint32_t atomic_fetch_xor(volatile uint32_t* memory, uint32_t value);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void* atomic_exchange_pointer(void* volatile* memory, void* value);
+
+uint8_t atomic_compare_exchange_pointer(void* volatile* memory, void** expected, void* desired);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+uint64_t atomic_read_64(volatile uint64_t* memory);
+
+void atomic_write_64(volatile uint64_t* memory, uint64_t value);
+
+uint64_t atomic_exchange_64(volatile uint64_t* memory, uint64_t value);
+
+uint8_t atomic_compare_exchange_64(volatile uint64_t* memory, uint64_t* expected, uint64_t desired);
+
+uint64_t atomic_fetch_add_64(volatile uint64_t* memory, uint64_t value);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void atomic_stack_init(struct atomic_stack* stack);
+
+void atomic_stack_push(struct atomic_stack* stack, struct atomic_stack_node* node);
+
+struct atomic_stack_node* atomic_stack_pop(struct atomic_stack* stack);
+
+
+//--------------------------------------------------------------------------------------------------//
+
 
-void atomic_decrement(uint32_t* memory);
+void atomic_queue_init(struct atomic_queue* queue);
 
-void atomic_write(uint32_t* memory, uint32_t value);
+void atomic_queue_push(struct atomic_queue* queue, struct atomic_queue_node* node);
 
-uint32_t atomic_read(uint32_t* memory);
+struct atomic_queue_node* atomic_queue_pop(struct atomic_queue* queue);
 
 
 //--------------------------------------------------------------------------------------------------//
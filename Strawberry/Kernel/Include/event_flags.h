@@ -0,0 +1,67 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#ifndef EVENT_FLAGS_H
+#define EVENT_FLAGS_H
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include "sam.h"
+#include "list.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Wait options
+//
+// By default a wait completes when any of the flags in the mask is set. With the wait all option
+// every flag in the mask must be set. With the clear option the flags in the mask are cleared
+// when the wait completes.
+
+#define EVENT_FLAGS_WAIT_ANY		0x00
+#define EVENT_FLAGS_WAIT_ALL		0x01
+#define EVENT_FLAGS_CLEAR			0x02
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Group of 32 event flags. Threads can wait for a combination of flags, while both threads and
+// interrupts can set them. Interrupts must use the from_isr functions and must never wait.
+
+struct event_flags
+{
+	uint32_t	flags;
+	
+	// Threads waiting for flags, sorted by priority
+	list_s		wait_list;
+};
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void event_flags_init(struct event_flags* event_flags);
+
+uint32_t event_flags_wait(struct event_flags* event_flags, uint32_t mask, uint8_t options, uint32_t timeout);
+
+void event_flags_set(struct event_flags* event_flags, uint32_t mask);
+
+void event_flags_set_from_isr(struct event_flags* event_flags, uint32_t mask);
+
+void event_flags_clear(struct event_flags* event_flags, uint32_t mask);
+
+uint32_t event_flags_get(struct event_flags* event_flags);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#endif
\ No newline at end of file
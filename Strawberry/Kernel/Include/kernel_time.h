@@ -0,0 +1,46 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#ifndef KERNEL_TIME_H
+#define KERNEL_TIME_H
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include "sam.h"
+#include "config.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Conversion between kernel clock ticks and nanoseconds. Nanoseconds are rounded up to whole
+// ticks, so that a sleep never ends early.
+
+#define KERNEL_TIME_TICKS_TO_NS(ticks)	((ticks) * KERNEL_CLOCK_NS_MULTIPLIER / KERNEL_CLOCK_NS_DIVIDER)
+#define KERNEL_TIME_NS_TO_TICKS(ns)		(((ns) * KERNEL_CLOCK_NS_DIVIDER + KERNEL_CLOCK_NS_MULTIPLIER - 1) / KERNEL_CLOCK_NS_MULTIPLIER)
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void kernel_time_config(void);
+
+uint64_t kernel_time_ticks(void);
+
+uint64_t kernel_time_ns(void);
+
+void thread_sleep_us(uint32_t microseconds);
+
+void thread_sleep_until(uint64_t time_ns);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#endif
\ No newline at end of file
@@ -0,0 +1,97 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#ifndef MESSAGE_QUEUE_H
+#define MESSAGE_QUEUE_H
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include "sam.h"
+#include "list.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Queue modes
+//
+// A single producer queue must only be written from one thread or interrupt. A multiple producer
+// queue may be written from any number of threads and interrupts. Both modes allow one consumer.
+
+#define MESSAGE_QUEUE_SPSC				0
+#define MESSAGE_QUEUE_MPSC				1
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Every slot holds a sequence number followed by the message, padded to a multiple of four bytes.
+// This macro gives the buffer size for a statically allocated queue.
+
+#define MESSAGE_QUEUE_SLOT_STRIDE(slot_size)				(4 + (((slot_size) + 3) & ~3))
+#define MESSAGE_QUEUE_BUFFER_SIZE(slot_size, slot_count)	(MESSAGE_QUEUE_SLOT_STRIDE(slot_size) * (slot_count))
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The message queue is a ring of fixed size slots. Each slot has a sequence number telling whether
+// it is free for the producer at a given position, or holds a message for the consumer at a given
+// position. The head and tail count every slot ever reserved and released. A producer reserves a
+// slot by advancing the head, with LDREX / STREX in the multiple producer case. It writes the
+// message in place and commits it by updating the sequence number. Slots may be committed out of
+// order, and the consumer simply sees the queue as empty until the slot at the tail is committed.
+//
+// Threads block in the wait lists when the queue is full or empty. A timeout of zero never blocks,
+// so interrupts can send messages with a timeout of zero.
+
+struct message_queue
+{
+	uint8_t*			buffer;
+	uint32_t			slot_size;
+	uint32_t			slot_stride;
+	uint32_t			slot_count;
+	uint8_t				mode;
+	
+	volatile uint32_t	head;
+	volatile uint32_t	tail;
+	
+	list_s				send_wait_list;
+	list_s				receive_wait_list;
+};
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void message_queue_init(struct message_queue* queue, void* buffer, uint32_t slot_size, uint32_t slot_count, uint8_t mode);
+
+struct message_queue* message_queue_new(uint32_t slot_size, uint32_t slot_count, uint8_t mode);
+
+void message_queue_delete(struct message_queue* queue);
+
+void* message_queue_reserve(struct message_queue* queue, uint32_t timeout);
+
+void message_queue_commit(struct message_queue* queue, void* message);
+
+uint8_t message_queue_send(struct message_queue* queue, const void* message, uint32_t timeout);
+
+void* message_queue_receive_slot(struct message_queue* queue, uint32_t timeout);
+
+void message_queue_release(struct message_queue* queue, void* message);
+
+uint8_t message_queue_receive(struct message_queue* queue, void* message, uint32_t timeout);
+
+uint32_t message_queue_get_count(struct message_queue* queue);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#endif
\ No newline at end of file
@@ -13,22 +13,42 @@
 
 
 #include "sam.h"
+#include "list.h"
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
+// A thread that fails to lock the mutex is blocked in the wait list instead of spinning. When the
+// mutex is unlocked it is handed directly to the highest priority waiter. While threads wait for
+// the mutex the owner inherits the priority of the highest priority waiter.
+//
+// A statically allocated mutex which is zero initialized is ready to use. A mutex must only be
+// used from threads.
+
 struct mutex
 {
-	uint32_t lock;
+	struct thread_structure*	owner;
+	
+	// Threads waiting for the mutex, sorted by priority
+	list_s						wait_list;
+	
+	// The mutex exist in the list of mutexes held by the owner
+	list_node_s					owner_node;
 };
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
+void mutex_init(struct mutex* mutex);
+
 void mutex_lock(struct mutex* mutex);
 
+uint8_t mutex_lock_timeout(struct mutex* mutex, uint32_t timeout);
+
+uint8_t mutex_try_lock(struct mutex* mutex);
+
 void mutex_unlock(struct mutex* mutex);
 
 
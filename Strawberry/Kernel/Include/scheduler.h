@@ -34,6 +34,10 @@ typedef void (*thread_function)(void *);
 // a real time thread may block the entire system. Real time threads might be video and
 // music streaming. 
 //
+// Periodic real time threads made with thread_new_periodic are scheduled above all the
+// priority levels, by earliest deadline first or by deadline monotonic priority. They are
+// only admitted if the periodic thread set stays schedulable.
+//
 // Interactive threads are scheduled with a lower priority than real time tasks. 
 // Nevertheless the will be fast serviced in order to maintain an interactive 
 // level. Interactive thread might wait on user input.
@@ -53,15 +57,43 @@ enum thread_priority
 };
 
 
+// Number of thread priority levels. The scheduler keeps one running queue for each level
+#define THREAD_PRIORITY_LEVELS		4
+
+
+
+// A thread that calls a blocking kernel function is set to block pending, and the scheduler
+// moves it to the blocked state when it is switched out. A thread can be woken in both states.
+// A thread that has exited is a zombie until its memory is freed by the reaper thread.
 
 enum thread_state
 {
 	THREAD_STATE_SUSPENDED,
 	THREAD_STATE_EXIT_PENDING,
+	THREAD_STATE_ZOMBIE,
+	THREAD_STATE_DELAYED,
+	THREAD_STATE_BLOCK_PENDING,
+	THREAD_STATE_BLOCKED,
 	THREAD_STATE_RUNNING
 };
 
 
+// Result of a blocking kernel call
+enum thread_wait_status
+{
+	THREAD_WAIT_SUCCESS,
+	THREAD_WAIT_TIMEOUT
+};
+
+
+// Timeout value for blocking kernel calls that should never time out
+#define THREAD_WAIT_FOREVER			0xffffffff
+
+
+// Number of slots in the delay wheel. Non-empty slots are tracked in a 32-bit bitmap
+#define DELAY_WHEEL_SLOTS			32
+
+
 
 
 
@@ -77,17 +109,47 @@ typedef enum scheduler_status
 
 struct thread_time
 {
-	// Total runtime in microseconds
-	uint64_t					runtime;
+	// Total runtime in CPU cycles
+	// The DWT cycle counter is read on every context switch, and the cycles since the last
+	// switch are added to the thread that is switched out. Cycles spent in interrupt handlers
+	// during that time are charged to the interrupt statistics instead.
+	uint64_t					cycles;
+	
+	// Window runtime
+	// Window start holds the total runtime at the start of the current statistics window, and
+	// window usage holds the CPU share in 1/1000 from the last completed window. These are only
+	// calculated when the runtime statistics are read, so the kernel does no work for them.
+	uint64_t					window_start;
+	uint32_t					window_usage;
+	
+};
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Parameters and state of a periodic real time thread. All times are in microseconds, and the
+// period is zero for other threads. Each period the thread runs one job, which is released at the
+// start of the period and must finish before the relative deadline. A job is given a budget of CPU
+// time. A job using more than its budget is an overrun, and the rest of the job is postponed to the
+// next period.
+
+struct thread_real_time
+{
+	uint32_t					period;
+	uint32_t					budget;
+	uint32_t					deadline;
+	
+	// Budget divided by deadline, in parts per million
+	uint32_t					utilization;
 	
-	// Window runtime in microseconds
-	// Typically calculated over a 1 second interval and used for runtime statistics.
-	// This value will be reset every second if used and uint32_t is therefore sufficient.
-	// Window time holds the microsecond runtime from the last seconds, while the new window
-	// time holds the microsecond runtime from the current second. 
-	uint32_t					window_time;
-	uint32_t					new_window_time;
+	// Release time and absolute deadline of the current job, and the CPU time it has used
+	uint64_t					release;
+	uint64_t					absolute_deadline;
+	uint32_t					budget_used;
 	
+	uint32_t					deadline_misses;
+	uint32_t					overruns;
 };
 
 
@@ -116,6 +178,24 @@ struct thread_structure
 	
 	struct List_s*				current_list;
 	struct List_s*				next_list;
+	
+	
+	// A blocked thread exist in the wait list of the kernel object it waits for. The wait list
+	// is sorted by priority. If the wait has a timeout the list node is in the delay wheel as
+	// well. Wait status holds the result of the last blocking call.
+	list_node_s					wait_node;
+	struct List_s*				wait_list;
+	enum thread_wait_status		wait_status;
+	
+	
+	// Holds the event flags the thread waits for, and after the wait the flags that woke it
+	uint32_t					wait_flags;
+	uint8_t						wait_options;
+	
+	
+	// Mutexes held by the thread, and the mutex the thread is blocked on
+	list_s						owned_mutexes;
+	struct mutex*				blocked_mutex;
 
 
 	// Pointer to the stack base so that we can delete the memory
@@ -123,14 +203,40 @@ struct thread_structure
 	uint32_t					stack_size;
 	
 	
-	// Priority of the thread
+	// The stack is painted with KERNEL_STACK_PAINT_PATTERN when the thread is made. The
+	// watermark points to the lowest stack word found to be overwritten, and gives the peak
+	// stack usage of the thread.
+	uint32_t*					stack_watermark;
+	
+	
+	// Priority of the thread. The priority may be raised above the base priority while
+	// the thread holds a mutex that a higher priority thread waits for.
 	enum thread_priority		priority;
+	enum thread_priority		base_priority;
+	
+	
+	struct thread_real_time		real_time;
 	
 	
 	// Time to wake is used for the thread delay function
 	uint64_t					tick_to_wake;
 	
 	
+	// Kernel clock tick at which a thread in thread_sleep_until is woken
+	uint64_t					clock_to_wake;
+	
+	
+	// Exit code given to thread_exit. A joinable thread is kept as a zombie after it exits, until
+	// the thread waiting in the join list has read the exit code. The cleanup function is called
+	// by the reaper thread right before the memory of the thread is freed.
+	int32_t						exit_code;
+	uint8_t						joinable;
+	list_s						join_list;
+	
+	thread_function				cleanup;
+	void*						cleanup_parameter;
+	
+	
 	// State of the thread
 	enum thread_state			state;
 	
@@ -149,6 +255,23 @@ struct thread_structure
 
 
 
+// The delay queue is a hashed timing wheel. A delayed thread is placed in the slot given by its
+// tick to wake, so inserting a thread takes constant time regardless of how many threads are
+// sleeping. Bit (31 - slot) in the bitmap is set when the slot holds a thread. The position is the
+// slot number (tick >> KERNEL_DELAY_WHEEL_SLOT_SHIFT) last processed by the kernel. Delays longer
+// than one revolution of the wheel simply stay in their slot until their tick to wake is reached.
+
+struct delay_wheel
+{
+	list_s						slots[DELAY_WHEEL_SLOTS];
+	uint32_t					bitmap;
+	uint64_t					position;
+};
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
 struct scheduler_info
 {
 	struct thread_structure* current_thread;
@@ -174,8 +297,14 @@ struct scheduler_info
 
 
 	// Some lists that the kernel will use for the threads
-	list_s running_queue;
-	list_s delay_queue;
+	//
+	// The running queue is split into one list per priority level. Bit (31 - priority) in the
+	// running bitmap is set whenever that level holds a runnable thread, so the scheduler finds
+	// the highest priority level with a single CLZ instruction. Threads on the same level are
+	// scheduled round robin.
+	list_s running_queue[THREAD_PRIORITY_LEVELS];
+	uint32_t running_bitmap;
+	struct delay_wheel delay_queue;
 	list_s serial_queue;
 	list_s suspended_list;
 
@@ -184,21 +313,67 @@ struct scheduler_info
 	list_s threads;
 
 
-	// Global tick to wake variable. This variable gets updated every time a thread is added or removed from the delay
-	// list. It holds the tick to wake value of the first thread to be put in the running queue again. This reduces the
-	// overhead. The kernel will not check the list before at least one thread delay has expired.
+	// Global tick to wake variable. This variable gets updated every time a thread is added to or expired from the delay
+	// wheel. It holds the earliest tick at which a delayed thread can be put in the running queue again. This reduces the
+	// overhead. The kernel will not check the wheel before at least one thread delay may have expired.
 	uint64_t tick_to_wake;
-	uint64_t tick_to_runtime;
+	
+	
+	// Holds the tick at which the first software timer expires. The timer service keeps this
+	// updated, and the scheduler wakes the timer thread once it is reached.
+	uint64_t tick_to_timer;
 
 
 	// This variables controls the runtime modifications for a reschedule. After a reschedule the SysTick
 	// timer is reset, allowing the next thread a full time slice. If the reschedule pending variable is
-	// set the kernel will add the reschedule runtime instead of 1000 us.
+	// set the kernel will add the reschedule runtime instead of 1000 us. The cycles which do not
+	// add up to a whole microsecond are carried to the next reschedule.
 	uint8_t reschedule_pending;
 	uint64_t reschedule_runtime;
+	uint32_t reschedule_cycles;
 
 
 	uint32_t systick_divider;
+	
+	
+	// Length of the current SysTick period in microseconds. This is one time slice under normal
+	// operation. In tickless idle the period is stretched to the next delay expiry, and the
+	// maximum period is limited by the 24-bit SysTick counter.
+	uint32_t tick_period;
+	uint32_t tick_period_max;
+	
+	
+	// Cycle accounting
+	//
+	// Switch cycles holds the DWT cycle counter value at the last context switch. Interrupt cycles
+	// holds the cycles spent in interrupt handlers since then. Total cycles counts all cycles
+	// accounted since the kernel was launched, and window start holds this value at the start of
+	// the current statistics window.
+	uint32_t switch_cycles;
+	uint32_t interrupt_cycles;
+	uint32_t interrupt_entry_cycles;
+	uint32_t interrupt_nesting;
+	uint64_t total_cycles;
+	uint64_t window_start;
+	
+	struct thread_time interrupt_stats;
+	
+	
+	// The idle thread scans one thread stack at a time for the stack watermark. The scan
+	// position is the next stack word to check.
+	struct thread_structure* stack_scan_thread;
+	uint32_t* stack_scan_position;
+	
+	
+	// Runnable periodic real time threads, sorted by absolute deadline with earliest deadline
+	// first, or by relative deadline with deadline monotonic scheduling. The admission control
+	// keeps the total utilization of the periodic threads in parts per million.
+	list_s real_time_queue;
+	uint32_t real_time_utilization;
+	uint32_t real_time_count;
+	
+	// Kernel tick at which the current thread was scheduled. Used to charge real time budgets.
+	uint64_t slice_start;
 };
 
 
@@ -211,8 +386,12 @@ void thread_config(void);
 
 void reschedule(void);
 
+uint64_t scheduler_get_tick(void);
+
 void thread_delay(uint32_t ticks);
 
+void thread_wait_period(void);
+
 
 //--------------------------------------------------------------------------------------------------//
 
@@ -225,10 +404,26 @@ void resume_scheduler(void);
 
 void suspend_scheduler(void);
 
-void scheduler_set_dynamic_loader_handler(void (*handler)(void));
-
 void scheduler_current_thread_to_queue(list_s* list);
 
+void scheduler_running_queue_insert(struct thread_structure* thread);
+
+void scheduler_block_current_thread(list_s* wait_list, uint32_t timeout);
+
+void scheduler_wake_thread(struct thread_structure* thread, enum thread_wait_status status);
+
+uint8_t scheduler_wake_thread_preempt(struct thread_structure* thread, enum thread_wait_status status);
+
+void scheduler_set_priority(struct thread_structure* thread, enum thread_priority priority);
+
+void scheduler_interrupt_enter(void);
+
+void scheduler_interrupt_leave(void);
+
+uint8_t scheduler_real_time_admit(struct thread_real_time* real_time);
+
+void scheduler_real_time_remove(struct thread_real_time* real_time);
+
 
 //--------------------------------------------------------------------------------------------------//
 
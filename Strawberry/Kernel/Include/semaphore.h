@@ -0,0 +1,52 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#ifndef SEMAPHORE_H
+#define SEMAPHORE_H
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include "sam.h"
+#include "list.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Counting semaphore. A thread taking the semaphore when the count is zero is blocked in the wait
+// list. A give wakes the highest priority waiter directly instead of incrementing the count.
+// Interrupts must use the from_isr functions and must never take the semaphore.
+
+struct semaphore
+{
+	uint32_t	count;
+	
+	// Threads waiting for the semaphore, sorted by priority
+	list_s		wait_list;
+};
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void semaphore_init(struct semaphore* semaphore, uint32_t count);
+
+uint8_t semaphore_take(struct semaphore* semaphore, uint32_t timeout);
+
+void semaphore_give(struct semaphore* semaphore);
+
+void semaphore_give_from_isr(struct semaphore* semaphore);
+
+uint32_t semaphore_get_count(struct semaphore* semaphore);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#endif
\ No newline at end of file
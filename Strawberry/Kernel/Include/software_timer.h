@@ -0,0 +1,88 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#ifndef SOFTWARE_TIMER_H
+#define SOFTWARE_TIMER_H
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include "sam.h"
+#include "list.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Function pointer to a software timer callback
+typedef void (*software_timer_callback)(void *);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// A one-shot timer expires once and must be started again. A periodic timer is
+// restarted automatically every time it expires.
+
+enum software_timer_mode
+{
+	SOFTWARE_TIMER_ONE_SHOT,
+	SOFTWARE_TIMER_PERIODIC
+};
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+struct software_timer
+{
+	// An active timer exist in the active list of the timer service. The list node value
+	// holds the kernel tick at which the timer expires.
+	list_node_s					list_node;
+
+
+	// Function to call from the timer thread when the timer expires
+	software_timer_callback		callback;
+	void*						parameter;
+
+
+	// Period in microseconds
+	uint32_t					period;
+
+
+	enum software_timer_mode	mode;
+	uint8_t						active;
+};
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void software_timer_config(void);
+
+void software_timer_init(struct software_timer* timer, software_timer_callback callback, void* parameter, uint32_t period, enum software_timer_mode mode);
+
+struct software_timer* software_timer_new(software_timer_callback callback, void* parameter, uint32_t period, enum software_timer_mode mode);
+
+void software_timer_delete(struct software_timer* timer);
+
+void software_timer_start(struct software_timer* timer);
+
+void software_timer_stop(struct software_timer* timer);
+
+void software_timer_reset(struct software_timer* timer);
+
+void software_timer_set_period(struct software_timer* timer, uint32_t period);
+
+void software_timer_tick_handler(void);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#endif
\ No newline at end of file
@@ -13,6 +13,40 @@
 
 
 #include "sam.h"
+#include "config.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Spinlocks
+//
+// A spinlock is a ticket lock. Acquiring takes the next ticket and spins until the serving
+// counter reaches it, so the lock is granted in the order it was asked for. The locks are only
+// taken with the kernel interrupts masked, like CRITICAL_SECTION_ENTER. On a single core with a
+// strict priority scheduler a thread spinning on a lock held by a preempted thread would spin
+// forever, and a preempted waiter would hold up every ticket behind it. With the interrupts masked
+// the holder can never be preempted by another user of the lock. Only threads and interrupts at or
+// below the kernel level may take a lock, and a lock must be held for a short, bounded time.
+//
+// A reader-writer lock lets any number of readers hold the lock at the same time, while a writer
+// holds it alone. A waiting writer stops new readers from entering, so writers are not starved.
+//
+// When SPINLOCK_MEASURE is set, each lock counts the acquisitions, how many of them had to wait,
+// and the longest time the lock was held in CPU cycles. Locks given a name in the init function
+// are listed in the runtime statistics. Only writers are timed for the reader-writer lock.
+
+struct spinlock_stats
+{
+	const char*				name;
+	
+	uint32_t				acquisitions;
+	uint32_t				contended;
+	uint32_t				max_hold_cycles;
+	uint32_t				hold_start;
+	
+	struct spinlock_stats*	next;
+};
 
 
 //--------------------------------------------------------------------------------------------------//
@@ -20,18 +54,61 @@
 
 struct spinlock
 {
-	volatile uint32_t lock;
+	volatile uint32_t		next_ticket;
+	volatile uint32_t		serving;
+	
+#if SPINLOCK_MEASURE
+	struct spinlock_stats	stats;
+#endif
+};
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+struct rwlock
+{
+	// Number of readers in the low bits, and the writer flags in the top bits
+	volatile uint32_t		state;
 	
-	void* owner;
+#if SPINLOCK_MEASURE
+	struct spinlock_stats	stats;
+#endif
 };
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
-void spinlock_aquire(struct spinlock* spin);
+void spinlock_init(struct spinlock* spin, const char* name);
+
+uint32_t spinlock_aquire_irqsave(struct spinlock* spin);
+
+void spinlock_release_irqrestore(struct spinlock* spin, uint32_t state);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void rwlock_init(struct rwlock* lock, const char* name);
+
+uint32_t rwlock_read_aquire_irqsave(struct rwlock* lock);
+
+void rwlock_read_release_irqrestore(struct rwlock* lock, uint32_t state);
+
+uint32_t rwlock_write_aquire_irqsave(struct rwlock* lock);
+
+void rwlock_write_release_irqrestore(struct rwlock* lock, uint32_t state);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#if SPINLOCK_MEASURE
+
+struct spinlock_stats* spinlock_get_stats_list(void);
 
-void spinlock_release(struct spinlock* spin);
+#endif
 
 
 //--------------------------------------------------------------------------------------------------//
@@ -13,32 +13,86 @@
 
 
 #include "sam.h"
+#include "scheduler.h"
+#include "dynamic_memory.h"
+#include "file_system_fat.h"
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
+struct mutex;
+struct semaphore;
+struct message_queue;
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The service stubs must not be inlined. The kernel service runs as a normal function call, and
+// may change every register the calling convention lets a function change.
 #define SYSCALL_NOINLINE __attribute__((noinline))
 
 
+// Returned by a service call with invalid arguments
+#define SYSCALL_ERROR		0xffffffff
+
+
 //--------------------------------------------------------------------------------------------------//
 
 
 // Service numbers
-// Service 1 to 10 is reserved for the kernel
-// Service 11-255 is free to use
+//
+// The service number is the SVC immediate, and indexes the service table in syscall.c. Delay,
+// print and GPIO status keep their old numbers, so that programs built earlier still run.
+// Service 0 runs a batch of service requests in one SVC call.
 
 typedef enum
 {
-	SYSCALL_DELAY = 1,
-	SYSCALL_PRINT = 10,
-	SYSCALL_GPIO_STATUS = 11
+	SYSCALL_BATCH			= 0,
+	SYSCALL_DELAY			= 1,
+	SYSCALL_THREAD_NEW		= 2,
+	SYSCALL_THREAD_EXIT		= 3,
+	SYSCALL_THREAD_JOIN		= 4,
+	SYSCALL_MUTEX_INIT		= 5,
+	SYSCALL_MUTEX_LOCK		= 6,
+	SYSCALL_MUTEX_UNLOCK	= 7,
+	SYSCALL_SEMAPHORE_INIT	= 8,
+	SYSCALL_SEMAPHORE_TAKE	= 9,
+	SYSCALL_PRINT			= 10,
+	SYSCALL_GPIO_STATUS		= 11,
+	SYSCALL_SEMAPHORE_GIVE	= 12,
+	SYSCALL_QUEUE_NEW		= 13,
+	SYSCALL_QUEUE_DELETE	= 14,
+	SYSCALL_QUEUE_SEND		= 15,
+	SYSCALL_QUEUE_RECEIVE	= 16,
+	SYSCALL_FILE_OPEN		= 17,
+	SYSCALL_FILE_CLOSE		= 18,
+	SYSCALL_FILE_READ		= 19,
+	SYSCALL_FILE_WRITE		= 20,
+	SYSCALL_MEMORY_NEW		= 21,
+	SYSCALL_MEMORY_FREE		= 22,
+	SYSCALL_COUNT
 } kernel_services;
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
+// One request in a batch. The arguments are passed to the service like the arguments of a
+// single service call, and the result holds the return value afterwards.
+
+struct syscall_request
+{
+	uint32_t	service;
+	uint32_t	arguments[4];
+	uint32_t	result;
+};
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
 // Prototypes for the services that the kernel provide
 void SYSCALL_NOINLINE syscall_print(char* data);
 
@@ -46,6 +100,46 @@ void SYSCALL_NOINLINE syscall_sleep(uint32_t ticks);
 
 void SYSCALL_NOINLINE syscall_gpio_status(Pio* port, uint32_t* reg);
 
+struct thread_structure* SYSCALL_NOINLINE syscall_thread_new(char* name, thread_function thread_func, void* parameter, uint32_t stack_size);
+
+void SYSCALL_NOINLINE syscall_thread_exit(int32_t exit_code);
+
+int32_t SYSCALL_NOINLINE syscall_thread_join(struct thread_structure* thread);
+
+void SYSCALL_NOINLINE syscall_mutex_init(struct mutex* mutex);
+
+uint8_t SYSCALL_NOINLINE syscall_mutex_lock(struct mutex* mutex, uint32_t timeout);
+
+void SYSCALL_NOINLINE syscall_mutex_unlock(struct mutex* mutex);
+
+void SYSCALL_NOINLINE syscall_semaphore_init(struct semaphore* semaphore, uint32_t count);
+
+uint8_t SYSCALL_NOINLINE syscall_semaphore_take(struct semaphore* semaphore, uint32_t timeout);
+
+void SYSCALL_NOINLINE syscall_semaphore_give(struct semaphore* semaphore);
+
+struct message_queue* SYSCALL_NOINLINE syscall_queue_new(uint32_t slot_size, uint32_t slot_count, uint8_t mode);
+
+void SYSCALL_NOINLINE syscall_queue_delete(struct message_queue* queue);
+
+uint8_t SYSCALL_NOINLINE syscall_queue_send(struct message_queue* queue, const void* message, uint32_t timeout);
+
+uint8_t SYSCALL_NOINLINE syscall_queue_receive(struct message_queue* queue, void* message, uint32_t timeout);
+
+FRESULT SYSCALL_NOINLINE syscall_file_open(FIL* file, const char* path, uint8_t mode);
+
+FRESULT SYSCALL_NOINLINE syscall_file_close(FIL* file);
+
+FRESULT SYSCALL_NOINLINE syscall_file_read(FIL* file, void* buffer, uint32_t size, uint32_t* bytes_read);
+
+FRESULT SYSCALL_NOINLINE syscall_file_write(FIL* file, const void* buffer, uint32_t size, uint32_t* bytes_written);
+
+void* SYSCALL_NOINLINE syscall_memory_new(Dynamic_memory_section memory_section, uint32_t size);
+
+void SYSCALL_NOINLINE syscall_memory_free(void* memory);
+
+uint32_t SYSCALL_NOINLINE syscall_batch(struct syscall_request* requests, uint32_t count);
+
 
 //--------------------------------------------------------------------------------------------------//
 
@@ -23,6 +23,18 @@ void thread_config(void);
 
 struct thread_structure* thread_new(char* thread_name, thread_function thread_func, void* thread_parameter, enum thread_priority priority, uint32_t stack_size);
 
+struct thread_structure* thread_new_periodic(char* thread_name, thread_function thread_func, void* thread_parameter, uint32_t stack_size, uint32_t period, uint32_t budget, uint32_t deadline);
+
+struct thread_structure* thread_new_joinable(char* thread_name, thread_function thread_func, void* thread_parameter, enum thread_priority priority, uint32_t stack_size);
+
+struct thread_structure* thread_new_with_cleanup(char* thread_name, thread_function thread_func, void* thread_parameter, enum thread_priority priority, uint32_t stack_size, thread_function cleanup, void* cleanup_parameter);
+
+void thread_exit(int32_t exit_code);
+
+int32_t thread_join(struct thread_structure* thread);
+
+void thread_reaper_insert(struct thread_structure* thread);
+
 
 //--------------------------------------------------------------------------------------------------//
 
@@ -0,0 +1,55 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include "sam.h"
+#include "scheduler.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Thread memory is taken from preallocated pools, so that making and deleting a thread does not go
+// through the dynamic memory. The thread structures come from a slab cache, and the stacks come
+// from a few pools with one stack size each. A thread gets the smallest pooled stack that is large
+// enough. If a pool is empty, or the stack is larger than the largest pool, the memory is taken
+// from the dynamic memory instead.
+
+struct thread_stack_pool
+{
+	uint32_t*	start;
+	uint32_t*	end;
+	
+	// Stack size in words
+	uint32_t	stack_size;
+	
+	// The free stacks are linked through their first word
+	uint32_t*	free_list;
+	uint32_t	free_count;
+};
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void thread_pool_config(void);
+
+struct thread_structure* thread_pool_new(uint32_t stack_size);
+
+void thread_pool_free(struct thread_structure* thread);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#endif
\ No newline at end of file
@@ -0,0 +1,101 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include "sam.h"
+#include "config.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Scheduler trace events
+//
+// Tick is recorded on every SysTick interrupt. Schedule is recorded when the scheduler has
+// decided what to do with the current thread and which thread to run next. Switch is recorded
+// by the PendSV handler right before the context switch. Delay and thread new are recorded from
+// the corresponding kernel calls.
+
+enum trace_event
+{
+	TRACE_EVENT_TICK,
+	TRACE_EVENT_SCHEDULE,
+	TRACE_EVENT_SWITCH,
+	TRACE_EVENT_DELAY,
+	TRACE_EVENT_THREAD_NEW
+};
+
+
+// The reason a thread was switched out. Slice end and reschedule are recorded with the tick
+// event, while the others are recorded with the schedule event.
+
+enum trace_reason
+{
+	TRACE_REASON_NONE,
+	TRACE_REASON_SLICE_END,
+	TRACE_REASON_RESCHEDULE,
+	TRACE_REASON_DELAY,
+	TRACE_REASON_BLOCK,
+	TRACE_REASON_EXIT
+};
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// One trace record is four words. The cycles are taken from the DWT cycle counter, and the
+// thread is the address of the thread structure.
+
+struct trace_record
+{
+	uint32_t	cycles;
+	uint8_t		event;
+	uint8_t		reason;
+	uint16_t	reserved;
+	uint32_t	thread;
+	uint32_t	argument;
+};
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The trace calls compile to nothing unless KERNEL_TRACE_ENABLE is set in config.h
+
+#if KERNEL_TRACE_ENABLE
+
+#define TRACE(event, reason, thread, argument)	trace_record((event), (reason), (uint32_t)(thread), (uint32_t)(argument))
+
+#else
+
+#define TRACE(event, reason, thread, argument)	((void)(reason), (void)(thread), (void)(argument))
+
+#endif
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#if KERNEL_TRACE_ENABLE
+
+void trace_record(uint8_t event, uint8_t reason, uint32_t thread, uint32_t argument);
+
+void trace_dump(void);
+
+#endif
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#endif
\ No newline at end of file
@@ -0,0 +1,82 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include "sam.h"
+#include "list.h"
+#include "scheduler.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Function pointer to a work function
+typedef void (*work_function)(void *);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// A work item is a function to run later from a work queue thread. The work item is usually
+// statically allocated by the driver owning it. Submitting a work item that is already pending
+// has no effect, so an interrupt firing many times before the work runs only causes one call.
+
+struct work
+{
+	list_node_s			list_node;
+	
+	work_function		function;
+	void*				argument;
+	
+	volatile uint8_t	pending;
+};
+
+
+// Initializer for a statically allocated work item
+#define WORK_INITIALIZER(name, work_function, work_argument)	{ .list_node.object = &(name), .function = (work_function), .argument = (work_argument) }
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// A work queue has its own worker thread, and the priority of that thread is the priority of the
+// work in the queue. The work items run one at a time in the order they were submitted. A work
+// function may block, but this delays the rest of the work in the same queue.
+
+struct work_queue
+{
+	list_s						work_list;
+	list_s						wait_list;
+	
+	struct thread_structure*	thread;
+};
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void work_queue_config(void);
+
+struct work_queue* work_queue_new(char* name, enum thread_priority priority, uint32_t stack_size);
+
+void work_init(struct work* work, work_function function, void* argument);
+
+uint8_t work_queue_submit(struct work_queue* queue, struct work* work);
+
+uint8_t work_submit(struct work* work);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#endif
\ No newline at end of file
@@ -6,71 +6,517 @@
 // the software.
 
 #include "atomic.h"
+#include "critical_section.h"
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
-void atomic_increment(uint32_t* memory)
+#include <stddef.h>
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#if defined(__arm__)
+
+
+// Generates a fetch operation. The new value is computed from the old value between the LDREX and
+// the STREX, and the store is retried until no other access has hit the memory in between.
+
+#define ATOMIC_FETCH_OPERATION(name, operation)										\
+uint32_t name(volatile uint32_t* memory, uint32_t value)							\
+{																					\
+	uint32_t old;																	\
+																					\
+	__DMB();																		\
+																					\
+	do																				\
+	{																				\
+		old = __LDREXW(memory);														\
+																					\
+	} while (__STREXW(old operation value, memory));								\
+																					\
+	__DMB();																		\
+																					\
+	return old;																		\
+}
+
+
+ATOMIC_FETCH_OPERATION(atomic_fetch_add, +)
+ATOMIC_FETCH_OPERATION(atomic_fetch_sub, -)
+ATOMIC_FETCH_OPERATION(atomic_fetch_and, &)
+ATOMIC_FETCH_OPERATION(atomic_fetch_or, |)
+ATOMIC_FETCH_OPERATION(atomic_fetch_xor, ^)
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// An aligned word access is atomic by itself, so the read and the write only need the barriers.
+// They must not use the exclusive instructions, since a STREX without a LDREX may fail forever
+// and a LDREX without a STREX leaves the monitor open.
+
+uint32_t atomic_read(volatile uint32_t* memory)
+{
+	__DMB();
+	
+	uint32_t value = *memory;
+	
+	__DMB();
+	
+	return value;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void atomic_write(volatile uint32_t* memory, uint32_t value)
+{
+	__DMB();
+	
+	*memory = value;
+	
+	__DMB();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+uint32_t atomic_exchange(volatile uint32_t* memory, uint32_t value)
 {
-	do 
+	uint32_t old;
+	
+	__DMB();
+	
+	do
 	{
-		uint32_t value = __LDREXW(memory);
-		
-		if (__STREXW(++value, memory) == 0)
-		{
-			__DMB();
-			return;
-		}
+		old = __LDREXW(memory);
 		
-	} while (1);
+	} while (__STREXW(value, memory));
+	
+	__DMB();
+	
+	return old;
 }
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
-void atomic_decrement(uint32_t* memory)
+// Stores the desired value if the memory holds the expected value, and returns 1. Otherwise the
+// expected value is set to the current value, and 0 is returned.
+
+uint8_t atomic_compare_exchange(volatile uint32_t* memory, uint32_t* expected, uint32_t desired)
 {
+	uint32_t old;
+	
+	__DMB();
+	
 	do
 	{
-		uint32_t value = __LDREXW(memory);
+		old = __LDREXW(memory);
 		
-		if (__STREXW(--value, memory) == 0)
+		if (old != *expected)
 		{
-			__DMB();
-			return;
+			__CLREX();
+			*expected = old;
+			
+			return 0;
 		}
 		
-	} while (1);
+	} while (__STREXW(desired, memory));
+	
+	__DMB();
+	
+	return 1;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void* atomic_exchange_pointer(void* volatile* memory, void* value)
+{
+	return (void *)atomic_exchange((volatile uint32_t *)memory, (uint32_t)value);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+uint8_t atomic_compare_exchange_pointer(void* volatile* memory, void** expected, void* desired)
+{
+	return atomic_compare_exchange((volatile uint32_t *)memory, (uint32_t *)expected, (uint32_t)desired);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+uint64_t atomic_read_64(volatile uint64_t* memory)
+{
+	uint64_t value;
+	
+	CRITICAL_SECTION_ENTER_ALL();
+	
+	value = *memory;
+	
+	CRITICAL_SECTION_LEAVE_ALL();
+	
+	return value;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void atomic_write_64(volatile uint64_t* memory, uint64_t value)
+{
+	CRITICAL_SECTION_ENTER_ALL();
+	
+	*memory = value;
+	
+	CRITICAL_SECTION_LEAVE_ALL();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+uint64_t atomic_exchange_64(volatile uint64_t* memory, uint64_t value)
+{
+	uint64_t old;
+	
+	CRITICAL_SECTION_ENTER_ALL();
+	
+	old = *memory;
+	*memory = value;
+	
+	CRITICAL_SECTION_LEAVE_ALL();
+	
+	return old;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+uint8_t atomic_compare_exchange_64(volatile uint64_t* memory, uint64_t* expected, uint64_t desired)
+{
+	uint8_t success = 0;
+	
+	CRITICAL_SECTION_ENTER_ALL();
+	
+	if (*memory == *expected)
+	{
+		*memory = desired;
+		success = 1;
+	}
+	else
+	{
+		*expected = *memory;
+	}
+	
+	CRITICAL_SECTION_LEAVE_ALL();
+	
+	return success;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+uint64_t atomic_fetch_add_64(volatile uint64_t* memory, uint64_t value)
+{
+	uint64_t old;
+	
+	CRITICAL_SECTION_ENTER_ALL();
+	
+	old = *memory;
+	*memory = old + value;
+	
+	CRITICAL_SECTION_LEAVE_ALL();
+	
+	return old;
 }
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
-void atomic_write(uint32_t* memory, uint32_t value)
+// The top is read with LDREX and replaced with STREX, with the next pointer read in between. Any
+// interrupt clears the exclusive monitor, so a pop that is interrupted by another push or pop
+// always fails and tries again. Unlike a compare and swap, this can not be fooled by a node that
+// is popped and pushed back while the next pointer is read.
+
+struct atomic_stack_node* atomic_stack_pop(struct atomic_stack* stack)
 {
+	struct atomic_stack_node* top;
+	
+	__DMB();
+	
 	do
-	{		
-		if (__STREXW(value, memory) == 0)
+	{
+		top = (struct atomic_stack_node *)__LDREXW((volatile uint32_t *)&stack->top);
+		
+		if (top == NULL)
 		{
-			__DMB();
+			__CLREX();
 			
-			// Success
-			return;
+			return NULL;
 		}
 		
-	} while (1);
+	} while (__STREXW((uint32_t)top->next, (volatile uint32_t *)&stack->top));
+	
+	__DMB();
+	
+	return top;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#else
+
+
+// Host implementation on the GCC atomic builtins
+
+uint32_t atomic_fetch_add(volatile uint32_t* memory, uint32_t value)
+{
+	return __atomic_fetch_add(memory, value, __ATOMIC_SEQ_CST);
+}
+
+
+uint32_t atomic_fetch_sub(volatile uint32_t* memory, uint32_t value)
+{
+	return __atomic_fetch_sub(memory, value, __ATOMIC_SEQ_CST);
+}
+
+
+uint32_t atomic_fetch_and(volatile uint32_t* memory, uint32_t value)
+{
+	return __atomic_fetch_and(memory, value, __ATOMIC_SEQ_CST);
+}
+
+
+uint32_t atomic_fetch_or(volatile uint32_t* memory, uint32_t value)
+{
+	return __atomic_fetch_or(memory, value, __ATOMIC_SEQ_CST);
+}
+
+
+uint32_t atomic_fetch_xor(volatile uint32_t* memory, uint32_t value)
+{
+	return __atomic_fetch_xor(memory, value, __ATOMIC_SEQ_CST);
+}
+
+
+uint32_t atomic_read(volatile uint32_t* memory)
+{
+	return __atomic_load_n(memory, __ATOMIC_SEQ_CST);
+}
+
+
+void atomic_write(volatile uint32_t* memory, uint32_t value)
+{
+	__atomic_store_n(memory, value, __ATOMIC_SEQ_CST);
+}
+
+
+uint32_t atomic_exchange(volatile uint32_t* memory, uint32_t value)
+{
+	return __atomic_exchange_n(memory, value, __ATOMIC_SEQ_CST);
+}
+
+
+uint8_t atomic_compare_exchange(volatile uint32_t* memory, uint32_t* expected, uint32_t desired)
+{
+	return __atomic_compare_exchange_n(memory, expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+
+void* atomic_exchange_pointer(void* volatile* memory, void* value)
+{
+	return __atomic_exchange_n(memory, value, __ATOMIC_SEQ_CST);
+}
+
+
+uint8_t atomic_compare_exchange_pointer(void* volatile* memory, void** expected, void* desired)
+{
+	return __atomic_compare_exchange_n(memory, expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+
+uint64_t atomic_read_64(volatile uint64_t* memory)
+{
+	return __atomic_load_n(memory, __ATOMIC_SEQ_CST);
+}
+
+
+void atomic_write_64(volatile uint64_t* memory, uint64_t value)
+{
+	__atomic_store_n(memory, value, __ATOMIC_SEQ_CST);
+}
+
+
+uint64_t atomic_exchange_64(volatile uint64_t* memory, uint64_t value)
+{
+	return __atomic_exchange_n(memory, value, __ATOMIC_SEQ_CST);
+}
+
+
+uint8_t atomic_compare_exchange_64(volatile uint64_t* memory, uint64_t* expected, uint64_t desired)
+{
+	return __atomic_compare_exchange_n(memory, expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+
+uint64_t atomic_fetch_add_64(volatile uint64_t* memory, uint64_t value)
+{
+	return __atomic_fetch_add(memory, value, __ATOMIC_SEQ_CST);
+}
+
+
+// The host has no exclusive monitor, so the pop is a compare and swap. Tests must not pop and push
+// back the same node while another pop is running.
+
+struct atomic_stack_node* atomic_stack_pop(struct atomic_stack* stack)
+{
+	void* top = __atomic_load_n(&stack->top, __ATOMIC_SEQ_CST);
+	
+	while ((top != NULL) && (atomic_compare_exchange_pointer((void* volatile *)&stack->top, &top, ((struct atomic_stack_node *)top)->next) == 0));
+	
+	return (struct atomic_stack_node *)top;
+}
+
+
+#endif
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void atomic_increment(volatile uint32_t* memory)
+{
+	atomic_fetch_add(memory, 1);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void atomic_decrement(volatile uint32_t* memory)
+{
+	atomic_fetch_sub(memory, 1);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void atomic_stack_init(struct atomic_stack* stack)
+{
+	stack->top = NULL;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void atomic_stack_push(struct atomic_stack* stack, struct atomic_stack_node* node)
+{
+	void* top = stack->top;
+	
+	do
+	{
+		node->next = (struct atomic_stack_node *)top;
+		
+	} while (atomic_compare_exchange_pointer((void* volatile *)&stack->top, &top, node) == 0);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The queue always holds at least one node, which starts out as the stub node. Producers swap
+// themselves in as the new tail, and then link the previous tail to them. The consumer follows the
+// next pointers from the head. The stub is pushed again when the last node is popped.
+
+void atomic_queue_init(struct atomic_queue* queue)
+{
+	queue->stub.next = NULL;
+	queue->tail = &queue->stub;
+	queue->head = &queue->stub;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void atomic_queue_push(struct atomic_queue* queue, struct atomic_queue_node* node)
+{
+	node->next = NULL;
+	
+	struct atomic_queue_node* previous = (struct atomic_queue_node *)atomic_exchange_pointer((void* volatile *)&queue->tail, node);
+	
+	// Until this store the consumer can not see the node, or any node pushed after it
+	previous->next = node;
 }
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
-uint32_t atomic_read(uint32_t* memory)
+// Must only be called by one consumer at a time
+
+struct atomic_queue_node* atomic_queue_pop(struct atomic_queue* queue)
 {
-	return __LDREXW(memory);
+	struct atomic_queue_node* head = queue->head;
+	struct atomic_queue_node* next = head->next;
+	
+	// Skip the stub node
+	if (head == &queue->stub)
+	{
+		if (next == NULL)
+		{
+			return NULL;
+		}
+		
+		queue->head = next;
+		head = next;
+		next = next->next;
+	}
+	
+	if (next != NULL)
+	{
+		queue->head = next;
+		
+		return head;
+	}
+	
+	// The head is the last node. If it is not the tail, a push is in progress.
+	if (head != queue->tail)
+	{
+		return NULL;
+	}
+	
+	// Push the stub behind the last node, so that the last node can be removed
+	atomic_queue_push(queue, &queue->stub);
+	
+	next = head->next;
+	
+	if (next != NULL)
+	{
+		queue->head = next;
+		
+		return head;
+	}
+	
+	return NULL;
 }
 
 
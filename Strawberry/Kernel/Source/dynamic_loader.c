@@ -12,6 +12,8 @@
 #include "dynamic_memory.h"
 #include "usart.h"
 #include "thread.h"
+#include "work_queue.h"
+#include "cache.h"
 
 
 //--------------------------------------------------------------------------------------------------//
@@ -23,6 +25,16 @@
 //--------------------------------------------------------------------------------------------------//
 
 
+static void fast_programming_work_handler(void* argument);
+
+static void fast_programming_receive(char data);
+
+static void dynamic_loader_cleanup(void* program);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
 typedef enum
 {
 	FAST_PROGRAMMING_IDLE,
@@ -45,12 +57,26 @@ uint32_t program_size_total;
 uint8_t* program_buffer;
 
 
+// Bytes received by the interrupt and not yet decoded. The size must be a power of two.
+#define FAST_PROGRAMMING_BUFFER_SIZE	512
+
+static uint8_t fast_programming_buffer[FAST_PROGRAMMING_BUFFER_SIZE];
+static volatile uint32_t fast_programming_buffer_head;
+static volatile uint32_t fast_programming_buffer_tail;
+static volatile uint8_t fast_programming_overflow;
+
+static struct work fast_programming_work = WORK_INITIALIZER(fast_programming_work, fast_programming_work_handler, NULL);
+
+
 //--------------------------------------------------------------------------------------------------//
 
 
-void delete_handler(void)
+// Called by the reaper thread when a loaded program has exited. The buffer holding the code of
+// the program is freed together with the thread.
+
+static void dynamic_loader_cleanup(void* program)
 {
-	dynamic_memory_free(program_buffer);
+	dynamic_memory_free(program);
 }
 
 
@@ -59,6 +85,8 @@ void delete_handler(void)
 
 void dynamic_loader_run(uint32_t* data, uint32_t size)
 {
+	uint32_t* program = data;
+	
 	// Start with relocating the .GOT and .GOT PLT table addresses
 	dynamic_loader_relocate(data);
 	
@@ -80,9 +108,8 @@ void dynamic_loader_run(uint32_t* data, uint32_t size)
 	// Check if the name if valid and start the thread
 	if (dynamic_loader_check_name(name, name_length))
 	{
-		scheduler_set_dynamic_loader_handler(delete_handler);
-		struct thread_structure* tmp = thread_new(name, (thread_function)program_entry, NULL, THREAD_PRIORITY_NORMAL, stack_size);
-		tmp->ID = 6969;
+		// The program memory is freed by the cleanup when the program exits
+		thread_new_with_cleanup(name, (thread_function)program_entry, NULL, THREAD_PRIORITY_NORMAL, stack_size, dynamic_loader_cleanup, program);
 	}
 
 }
@@ -155,12 +182,71 @@ void dynamic_loader_relocate(uint32_t* data)
 // This USART handler is used for the fast programming interface.
 // This interface will dynamically download a user program and run it immediately.
 // Deleting of the program is not handled. This can be done by a hardware reset.
+//
+// The interrupt only stores the received byte. The bytes are decoded by a work item in the
+// system work queue, since the download allocates memory and starts a new thread.
 
 void USART0_Handler()
 {
+	scheduler_interrupt_enter();
+	
 	// The RXRDY flag is cleared upon read of RHR
 	char data = (char)usart_read(USART0);
 	
+	uint32_t head = fast_programming_buffer_head;
+	
+	if ((head - fast_programming_buffer_tail) < FAST_PROGRAMMING_BUFFER_SIZE)
+	{
+		fast_programming_buffer[head & (FAST_PROGRAMMING_BUFFER_SIZE - 1)] = data;
+		fast_programming_buffer_head = head + 1;
+	}
+	else
+	{
+		fast_programming_overflow = 1;
+	}
+	
+	work_submit(&fast_programming_work);
+	
+	scheduler_interrupt_leave();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void fast_programming_work_handler(void* argument)
+{
+	if (fast_programming_overflow)
+	{
+		// Bytes have been lost. Abort the download and wait for a new start byte.
+		board_serial_print("Programming failed\n");
+		
+		if (fast_programming_state != FAST_PROGRAMMING_IDLE)
+		{
+			dynamic_memory_free(program_buffer);
+		}
+		
+		fast_programming_state = FAST_PROGRAMMING_IDLE;
+		fast_programming_buffer_tail = fast_programming_buffer_head;
+		fast_programming_overflow = 0;
+	}
+	
+	while (fast_programming_buffer_tail != fast_programming_buffer_head)
+	{
+		uint32_t tail = fast_programming_buffer_tail;
+		
+		fast_programming_receive(fast_programming_buffer[tail & (FAST_PROGRAMMING_BUFFER_SIZE - 1)]);
+		
+		fast_programming_buffer_tail = tail + 1;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void fast_programming_receive(char data)
+{
 	if (fast_programming_state == FAST_PROGRAMMING_IDLE)
 	{
 		if (data == 'P')
@@ -190,7 +276,8 @@ void USART0_Handler()
 		
 		if (program_size_index >= 4)
 		{
-			program_buffer = (uint8_t *)dynamic_memory_new(DRAM_BANK_0, program_size_total + 255);
+			// Every byte is written by the programmer, so the buffer is not cleared
+			program_buffer = (uint8_t *)dynamic_memory_new_extended(DRAM_BANK_0, program_size_total + 255, 8, DYNAMIC_MEMORY_FLAG_NO_ZERO);
 			
 			fast_programming_state = FAST_PROGRAMMING_DATA;
 		}
@@ -211,7 +298,10 @@ void USART0_Handler()
 		{
 			board_serial_print("Programming success\n");
 			
-			SCB_CleanDCache();
+			// Write the program back to memory, and drop any stale instructions from an earlier
+			// program at the same address
+			cache_clean_addresses((uint32_t *)program_buffer, program_size);
+			SCB_InvalidateICache();
 			
 			dynamic_loader_run((uint32_t *)program_buffer, program_size);
 		}
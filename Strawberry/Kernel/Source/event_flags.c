@@ -0,0 +1,213 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#include "event_flags.h"
+#include "scheduler.h"
+#include "critical_section.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include <stddef.h>
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+extern struct scheduler_info scheduler;
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static inline uint32_t event_flags_match(uint32_t flags, uint32_t mask, uint8_t options);
+
+static uint8_t event_flags_post(struct event_flags* event_flags, uint32_t mask);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void event_flags_init(struct event_flags* event_flags)
+{
+	event_flags->flags = 0;
+	
+	event_flags->wait_list.first = NULL;
+	event_flags->wait_list.last = NULL;
+	event_flags->wait_list.size = 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Waits for the flags in the mask, for at most timeout milliseconds. A timeout of zero returns
+// immediately. Returns the flags that completed the wait, or 0 on timeout.
+
+uint32_t event_flags_wait(struct event_flags* event_flags, uint32_t mask, uint8_t options, uint32_t timeout)
+{
+	struct thread_structure* thread = scheduler.current_thread;
+	
+	uint32_t flags = 0;
+	uint8_t blocked = 0;
+	
+	CRITICAL_SECTION_ENTER();
+	
+	flags = event_flags_match(event_flags->flags, mask, options);
+	
+	if (flags != 0)
+	{
+		if (options & EVENT_FLAGS_CLEAR)
+		{
+			event_flags->flags &= ~mask;
+		}
+	}
+	else if (timeout != 0)
+	{
+		thread->wait_flags = mask;
+		thread->wait_options = options;
+		
+		scheduler_block_current_thread(&event_flags->wait_list, timeout);
+		blocked = 1;
+	}
+	
+	CRITICAL_SECTION_LEAVE();
+	
+	if (blocked == 0)
+	{
+		return flags;
+	}
+	
+	reschedule();
+	
+	// The thread that set the flags has stored the flags that woke us
+	if (thread->wait_status == THREAD_WAIT_SUCCESS)
+	{
+		return thread->wait_flags;
+	}
+	
+	return 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void event_flags_set(struct event_flags* event_flags, uint32_t mask)
+{
+	if (event_flags_post(event_flags, mask))
+	{
+		reschedule();
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Every waiter whose wait is completed is moved straight to the running queue, and a reschedule is
+// requested if one of them should preempt the interrupted thread. The SysTick handler runs at the
+// kernel interrupt level, so it runs the scheduler as soon as no interrupt at or above that level
+// is active, possibly nested on top of this one. The context switch is done by PendSV after every
+// interrupt has returned.
+
+void event_flags_set_from_isr(struct event_flags* event_flags, uint32_t mask)
+{
+	event_flags_set(event_flags, mask);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void event_flags_clear(struct event_flags* event_flags, uint32_t mask)
+{
+	CRITICAL_SECTION_ENTER();
+	
+	event_flags->flags &= ~mask;
+	
+	CRITICAL_SECTION_LEAVE();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+uint32_t event_flags_get(struct event_flags* event_flags)
+{
+	return event_flags->flags;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Returns the flags that complete a wait, or 0 if the wait is not completed
+
+static inline uint32_t event_flags_match(uint32_t flags, uint32_t mask, uint8_t options)
+{
+	uint32_t match = flags & mask;
+	
+	if ((options & EVENT_FLAGS_WAIT_ALL) && (match != mask))
+	{
+		return 0;
+	}
+	
+	return match;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Sets the flags and wakes every waiter whose wait is completed. All waiters see the same flags.
+// The flags consumed by waiters with the clear option are cleared when all waiters have been
+// checked. Returns 1 if a woken thread should preempt the current thread.
+
+static uint8_t event_flags_post(struct event_flags* event_flags, uint32_t mask)
+{
+	uint8_t preempt = 0;
+	
+	CRITICAL_SECTION_ENTER();
+	
+	event_flags->flags |= mask;
+	
+	uint32_t clear = 0;
+	list_node_s* list_iterator = event_flags->wait_list.first;
+	
+	while (list_iterator != NULL)
+	{
+		struct thread_structure* waiter = (struct thread_structure *)(list_iterator->object);
+		list_iterator = list_iterator->next;
+		
+		uint32_t flags = event_flags_match(event_flags->flags, waiter->wait_flags, waiter->wait_options);
+		
+		if (flags != 0)
+		{
+			if (waiter->wait_options & EVENT_FLAGS_CLEAR)
+			{
+				clear |= waiter->wait_flags;
+			}
+			
+			waiter->wait_flags = flags;
+			if (scheduler_wake_thread_preempt(waiter, THREAD_WAIT_SUCCESS))
+			{
+				preempt = 1;
+			}
+		}
+	}
+	
+	event_flags->flags &= ~clear;
+	
+	CRITICAL_SECTION_LEAVE();
+	
+	return preempt;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
\ No newline at end of file
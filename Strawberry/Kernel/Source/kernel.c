@@ -24,6 +24,7 @@
 #include "dma.h"
 #include "thread.h"
 #include "gpio.h"
+#include "mpu.h"
 
 
 
@@ -67,6 +68,10 @@ void kernel_startup(void)
 	clock_master_clock_config(CLOCK_MASTER_CLOCK_SOURCE_PLLA_CLOCK, CLOCK_MASTER_CLOCK_PRESCALER_1, CLOCK_MASTER_CLOCK_DIVISION_DIV_2);
 
 
+	// Map the DMA memory as non-cacheable before the D-cache is enabled
+	mpu_config();
+	
+	
 	// Enable I-cache and D-cache
 	SCB_EnableICache();
 	SCB_EnableDCache();
@@ -0,0 +1,375 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#include "kernel_time.h"
+#include "scheduler.h"
+#include "timer.h"
+#include "clock.h"
+#include "interrupt.h"
+#include "critical_section.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include <stddef.h>
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+extern struct scheduler_info scheduler;
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The kernel clock uses the three channels of TC1
+//
+// Channel 0 counts the peripheral clock divided by 8. The TIOA0 output is set when the counter
+// passes 0x8000 and cleared when it wraps, and channel 1 counts the rising edges. The two channels
+// form a 32-bit counter, which wraps after about 229 seconds. Channel 1 interrupts twice every
+// revolution, and extends the counter to 64 bits in software.
+//
+// Channel 2 is a one shot timer for the thread sleeps. It is armed for the earliest wake up, but
+// never more than 0xffff ticks ahead.
+
+#define KERNEL_TIME_TIMER			TC1
+#define KERNEL_TIME_LOW				TIMER_CHANNEL_0
+#define KERNEL_TIME_HIGH			TIMER_CHANNEL_1
+#define KERNEL_TIME_SLEEP			TIMER_CHANNEL_2
+
+
+// The 64-bit time is the base plus the counter ticks since the last update. A reader checks that
+// the sequence number did not change while it read the base, so the read needs no lock.
+
+struct kernel_time
+{
+	uint64_t					base;
+	uint32_t					last;
+	volatile uint32_t			sequence;
+	
+	// Threads in thread_sleep_until. The list is not sorted, since the wait node may be moved
+	// when the priority of a sleeping thread changes.
+	list_s						sleep_list;
+};
+
+
+static struct kernel_time kernel_clock;
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static inline uint32_t kernel_time_read_counter(void);
+
+static void kernel_time_update(void);
+
+static uint8_t kernel_time_wake(uint64_t now);
+
+static void kernel_time_arm(uint64_t now);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void kernel_time_config(void)
+{
+	clock_peripheral_clock_enable(ID_TC1_CHANNEL0);
+	clock_peripheral_clock_enable(ID_TC1_CHANNEL1);
+	clock_peripheral_clock_enable(ID_TC1_CHANNEL2);
+	
+	timer_write_protection_disable(KERNEL_TIME_TIMER);
+	
+	// Low counter with the carry on TIOA0
+	timer_waveform_mode_config(KERNEL_TIME_TIMER, KERNEL_TIME_LOW, TIMER_WAVEFORM_UP, TIMER_OUTPUT_SET, TIMER_OUTPUT_CLEAR, 0, TIMER_INCREMENT_RISING_EDGE, TIMER_CLOCK_MCK_DIV_8);
+	timer_set_compare_a(KERNEL_TIME_TIMER, KERNEL_TIME_LOW, 0x8000);
+	timer_set_compare_c(KERNEL_TIME_TIMER, KERNEL_TIME_LOW, 0x0000);
+	
+	// High counter interrupting twice every revolution
+	timer_chain_config(KERNEL_TIME_TIMER, KERNEL_TIME_HIGH);
+	timer_waveform_mode_config(KERNEL_TIME_TIMER, KERNEL_TIME_HIGH, TIMER_WAVEFORM_UP, TIMER_OUTPUT_NONE, TIMER_OUTPUT_NONE, 0, TIMER_INCREMENT_RISING_EDGE, TIMER_CLOCK_X1);
+	timer_set_compare_a(KERNEL_TIME_TIMER, KERNEL_TIME_HIGH, 0x0000);
+	timer_set_compare_c(KERNEL_TIME_TIMER, KERNEL_TIME_HIGH, 0x8000);
+	timer_interrupt_enable(KERNEL_TIME_TIMER, KERNEL_TIME_HIGH, TIMER_INTERRUPT_A_COMPARE | TIMER_INTERRUPT_C_COMPARE);
+	
+	// One shot sleep timer stopping on the C compare
+	timer_waveform_mode_config(KERNEL_TIME_TIMER, KERNEL_TIME_SLEEP, TIMER_WAVEFORM_UP, TIMER_OUTPUT_NONE, TIMER_OUTPUT_NONE, 1, TIMER_INCREMENT_RISING_EDGE, TIMER_CLOCK_MCK_DIV_8);
+	timer_interrupt_enable(KERNEL_TIME_TIMER, KERNEL_TIME_SLEEP, TIMER_INTERRUPT_C_COMPARE);
+	
+	interrupt_enable_peripheral_interrupt(TC4_IRQn, KERNEL_CLOCK_IRQ_LEVEL);
+	interrupt_enable_peripheral_interrupt(TC5_IRQn, KERNEL_CLOCK_IRQ_LEVEL);
+	
+	// Start the high counter first, so that it sees the first carry
+	timer_clock_enable(KERNEL_TIME_TIMER, KERNEL_TIME_HIGH);
+	timer_software_trigger(KERNEL_TIME_TIMER, KERNEL_TIME_HIGH);
+	timer_clock_enable(KERNEL_TIME_TIMER, KERNEL_TIME_LOW);
+	timer_software_trigger(KERNEL_TIME_TIMER, KERNEL_TIME_LOW);
+	
+	kernel_clock.last = kernel_time_read_counter();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Returns the kernel clock in ticks. This only reads memory and timer registers, so it may be
+// called from any thread or interrupt without a critical section.
+
+uint64_t kernel_time_ticks(void)
+{
+	uint32_t sequence;
+	uint64_t base;
+	uint32_t last;
+	uint32_t counter;
+	
+	do
+	{
+		sequence = kernel_clock.sequence;
+		__DMB();
+		
+		base = kernel_clock.base;
+		last = kernel_clock.last;
+		counter = kernel_time_read_counter();
+		
+		__DMB();
+	} while (sequence != kernel_clock.sequence);
+	
+	return base + (uint32_t)(counter - last);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Returns the monotonic time since the kernel clock was started in nanoseconds
+
+uint64_t kernel_time_ns(void)
+{
+	return KERNEL_TIME_TICKS_TO_NS(kernel_time_ticks());
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void thread_sleep_us(uint32_t microseconds)
+{
+	thread_sleep_until(kernel_time_ns() + (uint64_t)microseconds * 1000);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Blocks the current thread until the kernel clock reaches the given time in nanoseconds. The
+// sleep timer interrupt wakes the thread, so the resolution does not depend on the time slice.
+// Periodic loops should sleep until the previous wake time plus the period, so that they do not
+// drift.
+
+void thread_sleep_until(uint64_t time_ns)
+{
+	uint64_t wake = KERNEL_TIME_NS_TO_TICKS(time_ns);
+	uint8_t blocked = 0;
+	
+	CRITICAL_SECTION_ENTER();
+	
+	uint64_t now = kernel_time_ticks();
+	
+	if (wake > now)
+	{
+		scheduler.current_thread->clock_to_wake = wake;
+		
+		scheduler_block_current_thread(&kernel_clock.sleep_list, THREAD_WAIT_FOREVER);
+		blocked = 1;
+		
+		kernel_time_arm(now);
+	}
+	
+	CRITICAL_SECTION_LEAVE();
+	
+	if (blocked)
+	{
+		reschedule();
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Reads the 32-bit hardware counter. The high counter is read before and after the low counter,
+// and the read is repeated if it changed in between. The high counter is incremented a couple of
+// peripheral clock cycles after the low counter reaches 0x8000, so this value is read again as
+// well. The result is offset by 0x8000 ticks, which does not matter for the differences used.
+
+static inline uint32_t kernel_time_read_counter(void)
+{
+	uint32_t high;
+	uint32_t low;
+	
+	do
+	{
+		high = KERNEL_TIME_TIMER->TcChannel[KERNEL_TIME_HIGH].TC_CV;
+		low = KERNEL_TIME_TIMER->TcChannel[KERNEL_TIME_LOW].TC_CV;
+		
+	} while ((low == 0x8000) || (high != KERNEL_TIME_TIMER->TcChannel[KERNEL_TIME_HIGH].TC_CV));
+	
+	return (high << 16) + ((low - 0x8000) & 0xffff);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Moves the base forward to the current counter value. Must be called inside a critical section.
+
+static void kernel_time_update(void)
+{
+	uint32_t counter = kernel_time_read_counter();
+	
+	kernel_clock.sequence++;
+	__DMB();
+	
+	kernel_clock.base += (uint32_t)(counter - kernel_clock.last);
+	kernel_clock.last = counter;
+	
+	__DMB();
+	kernel_clock.sequence++;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Wakes the sleeping threads that are due, and arms the sleep timer for the earliest of the
+// remaining ones. Must be called inside a critical section. Returns 1 if a woken thread should
+// preempt the current thread.
+
+static uint8_t kernel_time_wake(uint64_t now)
+{
+	uint8_t preempt = 0;
+	list_node_s* node = kernel_clock.sleep_list.first;
+	
+	while (node != NULL)
+	{
+		struct thread_structure* thread = (struct thread_structure *)(node->object);
+		
+		node = node->next;
+		
+		if (thread->clock_to_wake <= now)
+		{
+			if (scheduler_wake_thread_preempt(thread, THREAD_WAIT_SUCCESS))
+			{
+				preempt = 1;
+			}
+		}
+	}
+	
+	kernel_time_arm(now);
+	
+	return preempt;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Arms the sleep timer for the earliest wake up in the sleep list. Must be called inside a
+// critical section.
+
+static void kernel_time_arm(uint64_t now)
+{
+	uint64_t wake = 0xffffffffffffffff;
+	list_node_s* node;
+	
+	list_iterate(node, &kernel_clock.sleep_list)
+	{
+		struct thread_structure* thread = (struct thread_structure *)(node->object);
+		
+		if (thread->clock_to_wake < wake)
+		{
+			wake = thread->clock_to_wake;
+		}
+	}
+	
+	if (wake == 0xffffffffffffffff)
+	{
+		timer_clock_disable(KERNEL_TIME_TIMER, KERNEL_TIME_SLEEP);
+		return;
+	}
+	
+	// A wake up that is due, or very close, is delayed a few ticks so that the compare is not
+	// passed before the timer starts
+	uint64_t ticks = (wake > now) ? (wake - now) : 0;
+	
+	if (ticks < 4)
+	{
+		ticks = 4;
+	}
+	else if (ticks > 0xffff)
+	{
+		ticks = 0xffff;
+	}
+	
+	timer_set_compare_c(KERNEL_TIME_TIMER, KERNEL_TIME_SLEEP, (uint32_t)ticks);
+	timer_clock_enable(KERNEL_TIME_TIMER, KERNEL_TIME_SLEEP);
+	timer_software_trigger(KERNEL_TIME_TIMER, KERNEL_TIME_SLEEP);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The high counter interrupt keeps the 64-bit base up to date
+
+void TC4_Handler(void)
+{
+	scheduler_interrupt_enter();
+	
+	timer_read_interrupt_status(KERNEL_TIME_TIMER, KERNEL_TIME_HIGH);
+	
+	CRITICAL_SECTION_ENTER();
+	
+	kernel_time_update();
+	
+	CRITICAL_SECTION_LEAVE();
+	
+	scheduler_interrupt_leave();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The sleep timer interrupt wakes the threads that are due. If one of them has a higher priority
+// than the interrupted thread, a reschedule is requested.
+
+void TC5_Handler(void)
+{
+	uint8_t preempt;
+	
+	scheduler_interrupt_enter();
+	
+	timer_read_interrupt_status(KERNEL_TIME_TIMER, KERNEL_TIME_SLEEP);
+	
+	CRITICAL_SECTION_ENTER();
+	
+	preempt = kernel_time_wake(kernel_time_ticks());
+	
+	CRITICAL_SECTION_LEAVE();
+	
+	if (preempt)
+	{
+		reschedule();
+	}
+	
+	scheduler_interrupt_leave();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
\ No newline at end of file
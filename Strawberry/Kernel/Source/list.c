@@ -20,8 +20,10 @@
 
 // Since we a using a linked list we must assure that every element is unique. Otherwise the
 // functionality will be messed up. This simple function searched a list for a match. This
-// function should be called before inserting a new element.
+// function should be called before inserting a new element. The search is linear in the length
+// of the list, so it is only done when CHECK_ENABLE_LIST_SEARCH is set.
 
+#if CHECK_ENABLE_LIST_SEARCH
 static uint8_t kernel_list_search(list_node_s* list_item, list_s* list)
 {
 	if (list->first == NULL)
@@ -44,6 +46,7 @@ static uint8_t kernel_list_search(list_node_s* list_item, list_s* list)
 	
 	return 0;
 }
+#endif
 
 
 //--------------------------------------------------------------------------------------------------//
@@ -65,7 +68,9 @@ void list_insert_first(list_node_s* list_item, list_s* list)
 	else
 	{
 		// Search the list to make sure it do not exist
+		#if CHECK_ENABLE_LIST_SEARCH
 		check(kernel_list_search(list_item, list) == 0);
+		#endif
 		
 		// Update the list item pointers
 		list_item->next = list->first;
@@ -103,7 +108,9 @@ void list_insert_last(list_node_s* list_item, list_s* list)
 	else
 	{
 		// Search the list to make sure it do not exist
+		#if CHECK_ENABLE_LIST_SEARCH
 		check(kernel_list_search(list_item, list) == 0);
+		#endif
 		
 		// Update the list item pointers
 		list_item->next = NULL;
@@ -143,12 +150,15 @@ void list_insert_delay(list_node_s* list_item, list_s* list)
 	else
 	{
 		// Search the list to make sure it do not exist
+		#if CHECK_ENABLE_LIST_SEARCH
 		check(kernel_list_search(list_item, list) == 0);
+		#endif
 		
 		// Check the tick value
-		uint32_t tmp_value = list_item->value;
+		uint64_t tmp_value = list_item->value;
 		
-		if (tmp_value <= list->first->value)
+		// Items with the same value are kept in the order they were inserted
+		if (tmp_value < list->first->value)
 		{
 			// Insert at the beginning
 			list_insert_first(list_item, list);
@@ -298,7 +308,10 @@ uint8_t list_remove_item(list_node_s* list_item, list_s* list)
 	}
 	else
 	{
+		#if CHECK_ENABLE_LIST_SEARCH
 		check(kernel_list_search(list_item, list) == 1);
+		#endif
+		
 		list_item->next->prev = list_item->prev;
 		list_item->prev->next = list_item->next;
 		
@@ -0,0 +1,449 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#include "message_queue.h"
+#include "scheduler.h"
+#include "dynamic_memory.h"
+#include "critical_section.h"
+#include "check.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include <stddef.h>
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+extern struct scheduler_info scheduler;
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static inline volatile uint32_t* message_queue_get_sequence(struct message_queue* queue, uint32_t position);
+
+static void* message_queue_try_reserve(struct message_queue* queue);
+
+static void* message_queue_try_receive(struct message_queue* queue);
+
+static uint8_t message_queue_wait(struct message_queue* queue, list_s* wait_list, uint64_t deadline, uint32_t timeout);
+
+static void message_queue_wake(list_s* wait_list);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Initializes a queue on a user supplied buffer of MESSAGE_QUEUE_BUFFER_SIZE bytes. The buffer must
+// be word aligned and the slot count must be a power of two.
+
+void message_queue_init(struct message_queue* queue, void* buffer, uint32_t slot_size, uint32_t slot_count, uint8_t mode)
+{
+	check((slot_count != 0) && ((slot_count & (slot_count - 1)) == 0));
+	check(((uint32_t)buffer & 0b11) == 0);
+	
+	queue->buffer = (uint8_t *)buffer;
+	queue->slot_size = slot_size;
+	queue->slot_stride = MESSAGE_QUEUE_SLOT_STRIDE(slot_size);
+	queue->slot_count = slot_count;
+	queue->mode = mode;
+	
+	queue->head = 0;
+	queue->tail = 0;
+	
+	// Every slot is free for the producer at its own position
+	for (uint32_t i = 0; i < slot_count; i++)
+	{
+		*message_queue_get_sequence(queue, i) = i;
+	}
+	
+	queue->send_wait_list.first = NULL;
+	queue->send_wait_list.last = NULL;
+	queue->send_wait_list.size = 0;
+	
+	queue->receive_wait_list.first = NULL;
+	queue->receive_wait_list.last = NULL;
+	queue->receive_wait_list.size = 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Allocates a queue together with its buffer. This must not be called from interrupt context.
+
+struct message_queue* message_queue_new(uint32_t slot_size, uint32_t slot_count, uint8_t mode)
+{
+	struct message_queue* queue = (struct message_queue *)dynamic_memory_new(DRAM_BANK_0, sizeof(struct message_queue) + MESSAGE_QUEUE_BUFFER_SIZE(slot_size, slot_count));
+	
+	if (queue == NULL)
+	{
+		check(0);
+		return NULL;
+	}
+	
+	message_queue_init(queue, (uint8_t *)queue + sizeof(struct message_queue), slot_size, slot_count, mode);
+	
+	return queue;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void message_queue_delete(struct message_queue* queue)
+{
+	// No thread can be waiting on a queue that is deleted
+	check((queue->send_wait_list.size == 0) && (queue->receive_wait_list.size == 0));
+	
+	dynamic_memory_free(queue);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Reserves a slot for a message, or blocks the thread for at most timeout milliseconds while the
+// queue is full. The message is written directly into the returned slot, and is sent by committing
+// the slot. Returns NULL on timeout.
+
+void* message_queue_reserve(struct message_queue* queue, uint32_t timeout)
+{
+	uint64_t deadline = scheduler.tick + (uint64_t)timeout * 1000;
+	
+	while (1)
+	{
+		void* message = message_queue_try_reserve(queue);
+		
+		if (message != NULL)
+		{
+			return message;
+		}
+		
+		if (message_queue_wait(queue, &queue->send_wait_list, deadline, timeout) == 0)
+		{
+			return NULL;
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Makes a reserved slot visible to the consumer, and wakes the consumer if it is waiting
+
+void message_queue_commit(struct message_queue* queue, void* message)
+{
+	volatile uint32_t* sequence = (volatile uint32_t *)message - 1;
+	
+	// The message must be written before the consumer can see the slot
+	__DMB();
+	
+	*sequence = *sequence + 1;
+	
+	// The wait list size is not volatile, and must not be read before the slot is visible. A
+	// consumer blocking in between would otherwise never be woken.
+	__DMB();
+	
+	if (queue->receive_wait_list.size != 0)
+	{
+		message_queue_wake(&queue->receive_wait_list);
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+uint8_t message_queue_send(struct message_queue* queue, const void* message, uint32_t timeout)
+{
+	uint8_t* slot = (uint8_t *)message_queue_reserve(queue, timeout);
+	
+	if (slot == NULL)
+	{
+		return 0;
+	}
+	
+	const uint8_t* source = (const uint8_t *)message;
+	
+	for (uint32_t i = 0; i < queue->slot_size; i++)
+	{
+		slot[i] = source[i];
+	}
+	
+	message_queue_commit(queue, slot);
+	
+	return 1;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Returns the oldest message in place, or blocks the thread for at most timeout milliseconds while
+// the queue is empty. The slot must be released when the message has been read. Returns NULL on
+// timeout.
+
+void* message_queue_receive_slot(struct message_queue* queue, uint32_t timeout)
+{
+	uint64_t deadline = scheduler.tick + (uint64_t)timeout * 1000;
+	
+	while (1)
+	{
+		void* message = message_queue_try_receive(queue);
+		
+		if (message != NULL)
+		{
+			return message;
+		}
+		
+		if (message_queue_wait(queue, &queue->receive_wait_list, deadline, timeout) == 0)
+		{
+			return NULL;
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Frees the slot returned by the last receive, and wakes a producer if one is waiting
+
+void message_queue_release(struct message_queue* queue, void* message)
+{
+	volatile uint32_t* sequence = (volatile uint32_t *)message - 1;
+	
+	check(sequence == message_queue_get_sequence(queue, queue->tail));
+	
+	// The message must be read before a producer can reuse the slot
+	__DMB();
+	
+	// The slot is free for the producer one revolution later
+	*sequence = queue->tail + queue->slot_count;
+	queue->tail = queue->tail + 1;
+	
+	// Same ordering as in message_queue_commit, so that a producer blocking in between is woken
+	__DMB();
+	
+	if (queue->send_wait_list.size != 0)
+	{
+		message_queue_wake(&queue->send_wait_list);
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+uint8_t message_queue_receive(struct message_queue* queue, void* message, uint32_t timeout)
+{
+	uint8_t* slot = (uint8_t *)message_queue_receive_slot(queue, timeout);
+	
+	if (slot == NULL)
+	{
+		return 0;
+	}
+	
+	uint8_t* destination = (uint8_t *)message;
+	
+	for (uint32_t i = 0; i < queue->slot_size; i++)
+	{
+		destination[i] = slot[i];
+	}
+	
+	message_queue_release(queue, slot);
+	
+	return 1;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Returns the number of reserved slots that are not yet released
+
+uint32_t message_queue_get_count(struct message_queue* queue)
+{
+	return queue->head - queue->tail;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static inline volatile uint32_t* message_queue_get_sequence(struct message_queue* queue, uint32_t position)
+{
+	return (volatile uint32_t *)(queue->buffer + (position & (queue->slot_count - 1)) * queue->slot_stride);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Tries to reserve the slot at the head. The slot is free when its sequence number equals the
+// position. A lower sequence number means that the consumer has not released it yet, so the queue
+// is full. In the multiple producer case a higher sequence number means that another producer has
+// taken the slot in between, and the reservation is retried.
+
+static void* message_queue_try_reserve(struct message_queue* queue)
+{
+	if (queue->mode == MESSAGE_QUEUE_SPSC)
+	{
+		uint32_t position = queue->head;
+		volatile uint32_t* sequence = message_queue_get_sequence(queue, position);
+		
+		if (*sequence != position)
+		{
+			return NULL;
+		}
+		
+		queue->head = position + 1;
+		
+		return (void *)(sequence + 1);
+	}
+	
+	while (1)
+	{
+		uint32_t position = __LDREXW((uint32_t *)&queue->head);
+		volatile uint32_t* sequence = message_queue_get_sequence(queue, position);
+		
+		int32_t difference = (int32_t)(*sequence - position);
+		
+		if (difference < 0)
+		{
+			__CLREX();
+			return NULL;
+		}
+		
+		if (difference == 0)
+		{
+			if (__STREXW(position + 1, (uint32_t *)&queue->head) == 0)
+			{
+				__DMB();
+				return (void *)(sequence + 1);
+			}
+		}
+		else
+		{
+			__CLREX();
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The slot at the tail holds a message when its sequence number is one above the position
+
+static void* message_queue_try_receive(struct message_queue* queue)
+{
+	uint32_t position = queue->tail;
+	volatile uint32_t* sequence = message_queue_get_sequence(queue, position);
+	
+	if (*sequence != position + 1)
+	{
+		return NULL;
+	}
+	
+	// Do not read the message before the sequence number
+	__DMB();
+	
+	return (void *)(sequence + 1);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Blocks the thread in a wait list until it is woken or the deadline is reached. The queue is
+// checked again inside the critical section, so that a commit or release right before the thread
+// blocks is not missed. Returns 0 if the wait has timed out, and 1 if the caller should try again.
+
+static uint8_t message_queue_wait(struct message_queue* queue, list_s* wait_list, uint64_t deadline, uint32_t timeout)
+{
+	uint8_t blocked = 0;
+	uint8_t retry = 1;
+	
+	CRITICAL_SECTION_ENTER();
+	
+	uint8_t ready;
+	
+	if (wait_list == &queue->send_wait_list)
+	{
+		ready = (*message_queue_get_sequence(queue, queue->head) == queue->head);
+	}
+	else
+	{
+		ready = (*message_queue_get_sequence(queue, queue->tail) == queue->tail + 1);
+	}
+	
+	if (ready == 0)
+	{
+		if (timeout == THREAD_WAIT_FOREVER)
+		{
+			scheduler_block_current_thread(wait_list, THREAD_WAIT_FOREVER);
+			blocked = 1;
+		}
+		else if (deadline > scheduler.tick)
+		{
+			// Round the remaining time up to the next millisecond
+			scheduler_block_current_thread(wait_list, (uint32_t)((deadline - scheduler.tick + 999) / 1000));
+			blocked = 1;
+		}
+		else
+		{
+			retry = 0;
+		}
+	}
+	
+	CRITICAL_SECTION_LEAVE();
+	
+	if (blocked)
+	{
+		reschedule();
+		
+		retry = (scheduler.current_thread->wait_status == THREAD_WAIT_SUCCESS);
+	}
+	
+	return retry;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Wakes the first thread in a wait list. This is called from both threads and interrupts.
+
+static void message_queue_wake(list_s* wait_list)
+{
+	uint8_t preempt = 0;
+	
+	CRITICAL_SECTION_ENTER();
+	
+	if (wait_list->size != 0)
+	{
+		struct thread_structure* thread = (struct thread_structure *)(wait_list->first->object);
+		
+		preempt = scheduler_wake_thread_preempt(thread, THREAD_WAIT_SUCCESS);
+	}
+	
+	CRITICAL_SECTION_LEAVE();
+	
+	if (preempt)
+	{
+		reschedule();
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
\ No newline at end of file
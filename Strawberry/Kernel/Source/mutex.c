@@ -7,7 +7,45 @@
 
 #include "mutex.h"
 #include "scheduler.h"
-#include "atomic.h"
+#include "critical_section.h"
+#include "check.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include <stddef.h>
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+extern struct scheduler_info scheduler;
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static inline void mutex_acquire(struct mutex* mutex, struct thread_structure* thread);
+
+static void mutex_inherit_priority(struct mutex* mutex, enum thread_priority priority);
+
+static enum thread_priority mutex_get_inherited_priority(struct thread_structure* thread);
+
+static void mutex_restore_priority(struct thread_structure* owner);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void mutex_init(struct mutex* mutex)
+{
+	mutex->owner = NULL;
+	
+	mutex->wait_list.first = NULL;
+	mutex->wait_list.last = NULL;
+	mutex->wait_list.size = 0;
+}
 
 
 //--------------------------------------------------------------------------------------------------//
@@ -15,37 +53,224 @@
 
 void mutex_lock(struct mutex* mutex)
 {
-	uint32_t status = 0;
+	mutex_lock_timeout(mutex, THREAD_WAIT_FOREVER);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+uint8_t mutex_try_lock(struct mutex* mutex)
+{
+	return mutex_lock_timeout(mutex, 0);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Locks the mutex, or blocks the thread for at most timeout milliseconds. Returns 1 if the mutex
+// was locked and 0 on timeout.
+
+uint8_t mutex_lock_timeout(struct mutex* mutex, uint32_t timeout)
+{
+	struct thread_structure* thread = scheduler.current_thread;
 	
-	do {
-		while (__LDREXW(&(mutex->lock)) != 0)
-		{
-			reschedule();
-		}
+	uint8_t locked = 0;
+	uint8_t blocked = 0;
+	
+	CRITICAL_SECTION_ENTER();
+	
+	if (mutex->owner == NULL)
+	{
+		mutex_acquire(mutex, thread);
+		locked = 1;
+	}
+	else if (timeout != 0)
+	{
+		// The mutex is not recursive
+		check(mutex->owner != thread);
 		
-		status = __STREXW(1, &(mutex->lock));
+		thread->blocked_mutex = mutex;
+		scheduler_block_current_thread(&mutex->wait_list, timeout);
 		
-	} while (status != 0);
+		mutex_inherit_priority(mutex, thread->priority);
+		blocked = 1;
+	}
+	
+	CRITICAL_SECTION_LEAVE();
+	
+	if (blocked == 0)
+	{
+		return locked;
+	}
+	
+	reschedule();
+	
+	// On success the mutex has already been handed over by the previous owner
+	if (thread->wait_status == THREAD_WAIT_SUCCESS)
+	{
+		return 1;
+	}
 	
-	// Do not start any other memory access until DMB has finished
-	__DMB();
+	// The wait timed out, and the scheduler has removed the thread from the wait list. The owners
+	// might not have to run at our priority anymore.
+	CRITICAL_SECTION_ENTER();
 	
-	return;
+	mutex_restore_priority(mutex->owner);
+	
+	CRITICAL_SECTION_LEAVE();
+	
+	return 0;
 }
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
+// Unlocks the mutex. If any thread is waiting, the mutex is handed directly to the highest priority
+// waiter, so that no other thread can take it in between. The thread unlocking the mutex drops the
+// priority it inherited through this mutex, and yields if the new owner has a higher priority.
+
 void mutex_unlock(struct mutex* mutex)
 {
-	__DMB();
+	struct thread_structure* thread = scheduler.current_thread;
+	
+	uint8_t preempt = 0;
+	
+	CRITICAL_SECTION_ENTER();
+	
+	check(mutex->owner == thread);
+	
+	list_remove_item(&(mutex->owner_node), &thread->owned_mutexes);
+	
+	if (mutex->wait_list.size != 0)
+	{
+		struct thread_structure* waiter = (struct thread_structure *)(mutex->wait_list.first->object);
+		
+		scheduler_wake_thread(waiter, THREAD_WAIT_SUCCESS);
+		
+		waiter->blocked_mutex = NULL;
+		mutex_acquire(mutex, waiter);
+		
+		// The new owner inherits the priority of the remaining waiters
+		scheduler_set_priority(waiter, mutex_get_inherited_priority(waiter));
+	}
+	else
+	{
+		mutex->owner = NULL;
+	}
+	
+	scheduler_set_priority(thread, mutex_get_inherited_priority(thread));
+	
+	if ((mutex->owner != NULL) && (mutex->owner->priority < thread->priority))
+	{
+		preempt = 1;
+	}
+	
+	CRITICAL_SECTION_LEAVE();
+	
+	if (preempt)
+	{
+		reschedule();
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static inline void mutex_acquire(struct mutex* mutex, struct thread_structure* thread)
+{
+	mutex->owner = thread;
+	mutex->owner_node.object = mutex;
+	
+	list_insert_first(&(mutex->owner_node), &thread->owned_mutexes);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
 
+// Raises the priority of the mutex owner to the priority of a new waiter. If the owner is itself
+// blocked on another mutex, the priority is passed on along the chain of owners.
 
-	mutex->lock = 0;
+static void mutex_inherit_priority(struct mutex* mutex, enum thread_priority priority)
+{
+	struct thread_structure* owner = mutex->owner;
 	
+	while ((owner != NULL) && (priority < owner->priority))
+	{
+		scheduler_set_priority(owner, priority);
+		
+		if (owner->blocked_mutex == NULL)
+		{
+			break;
+		}
+		
+		owner = owner->blocked_mutex->owner;
+	}
+}
+
 
-	return;
+//--------------------------------------------------------------------------------------------------//
+
+
+// Lowers the priority of a mutex owner to what it still inherits, after a waiter has left. If the
+// owner is itself blocked on another mutex, the change is passed on along the chain of owners the
+// same way as in mutex_inherit_priority.
+
+static void mutex_restore_priority(struct thread_structure* owner)
+{
+	while (owner != NULL)
+	{
+		enum thread_priority priority = mutex_get_inherited_priority(owner);
+		
+		if (priority == owner->priority)
+		{
+			break;
+		}
+		
+		scheduler_set_priority(owner, priority);
+		
+		if (owner->blocked_mutex == NULL)
+		{
+			break;
+		}
+		
+		owner = owner->blocked_mutex->owner;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Returns the priority a thread should run at. This is the highest of its base priority and the
+// priority of the first waiter of every mutex it holds.
+
+static enum thread_priority mutex_get_inherited_priority(struct thread_structure* thread)
+{
+	enum thread_priority priority = thread->base_priority;
+	
+	list_node_s* list_node;
+	
+	list_iterate(list_node, &thread->owned_mutexes)
+	{
+		struct mutex* mutex = (struct mutex *)(list_node->object);
+		
+		if (mutex->wait_list.size != 0)
+		{
+			struct thread_structure* waiter = (struct thread_structure *)(mutex->wait_list.first->object);
+			
+			if (waiter->priority < priority)
+			{
+				priority = waiter->priority;
+			}
+		}
+	}
+	
+	return priority;
 }
 
 
@@ -9,6 +9,7 @@
 #include "systick.h"
 #include "interrupt.h"
 #include "dynamic_memory.h"
+#include "slab.h"
 #include "board_serial_programming.h"
 #include "check.h"
 #include "critical_section.h"
@@ -16,6 +17,9 @@
 #include "cache.h"
 #include "compiler.h"
 #include "gpio.h"
+#include "software_timer.h"
+#include "trace.h"
+#include "thread.h"
 
 
 //--------------------------------------------------------------------------------------------------//
@@ -34,14 +38,6 @@ struct scheduler_info scheduler;
 //--------------------------------------------------------------------------------------------------//
 
 
-// Temporarily callback for the fast programming interface. When the flashed program
-// gets terminated, this handler will delete the memory footprint of the actual code. 
-void (*fast_program_interface_delete)(void);
-
-
-//--------------------------------------------------------------------------------------------------//
-
-
 void round_robin_scheduler(void);
 
 void scheduler_start(void);
@@ -54,10 +50,34 @@ void suspend_scheduler(void);
 
 void resume_scheduler(void);
 
-void reset_runtime(void);
+void scheduler_context_switch_accounting(void);
+
+static inline void update_window_usage(struct thread_time* stats, uint64_t window_cycles);
+
+static void update_runtime_statistics(void);
 
 static inline void process_expired_delays(void);
 
+static inline void scheduler_delay_insert(struct thread_structure* thread);
+
+static inline void scheduler_delay_remove(struct thread_structure* thread);
+
+static inline void scheduler_running_queue_remove(struct thread_structure* thread);
+
+static inline void scheduler_running_queue_insert_last(struct thread_structure* thread);
+
+static inline struct thread_structure* scheduler_running_queue_remove_next(void);
+
+static void scheduler_set_tick_period(uint32_t period);
+
+static inline void scheduler_update_tick_period(void);
+
+static inline void scheduler_real_time_queue_insert(struct thread_structure* thread);
+
+static inline void scheduler_real_time_next_job(struct thread_structure* thread);
+
+static inline void scheduler_real_time_throttle(struct thread_structure* thread);
+
 
 //--------------------------------------------------------------------------------------------------//
 
@@ -69,6 +89,10 @@ static inline void process_expired_delays(void);
 
 void SysTick_Handler()
 {
+	scheduler_interrupt_enter();
+	
+	TRACE(TRACE_EVENT_TICK, scheduler.reschedule_pending ? TRACE_REASON_RESCHEDULE : TRACE_REASON_SLICE_END, scheduler.current_thread, scheduler.tick);
+	
 	// First we check if a reschedule has occurred since the last context switch.
 	// In that case the thread has not run for a full time slice. The rescheduler
 	// will calculate the runtime, which will be added here, if a reschedule has occurred. 
@@ -77,26 +101,21 @@ void SysTick_Handler()
 		scheduler.reschedule_pending = 0;
 		
 		scheduler.tick += scheduler.reschedule_runtime;
-		scheduler.current_thread->stats.new_window_time += scheduler.reschedule_runtime;
 	}
 	else
 	{
-		scheduler.tick += 1000;
-		scheduler.current_thread->stats.new_window_time += 1000;
-	}
-	
-	
-	if (scheduler.tick > scheduler.tick_to_runtime)
-	{
-		reset_runtime();
-		scheduler.tick_to_runtime = scheduler.tick + 1000000;
+		scheduler.tick += scheduler.tick_period;
 	}
 	
 	// Launch the scheduler
 	round_robin_scheduler();
 	
+	scheduler_update_tick_period();
+	
 	// Pend the PendSV exception that will execute the actual context switch
 	SCB->ICSR |= SCB_ICSR_PENDSVSET_Msk;
+	
+	scheduler_interrupt_leave();
 }
 
 
@@ -112,6 +131,9 @@ void kernel_launch(void)
 	
 	scheduler.systick_divider = 300000000 / KERNEL_TICK_FREQUENCY / 1000;
 	
+	scheduler.tick_period = 1000000 / KERNEL_TICK_FREQUENCY;
+	scheduler.tick_period_max = SysTick_LOAD_RELOAD_Msk / scheduler.systick_divider;
+	
 	// Start the scheduler
 	scheduler.status = SCHEDULER_STATUS_RUNNING;
 	
@@ -122,17 +144,21 @@ void kernel_launch(void)
 	
 	// Set the tick to wake variable to not trigger
 	scheduler.tick_to_wake = 0xffffffffffffffff;
-	scheduler.tick_to_runtime = scheduler.tick + 1000000;
+	
+	
+	// Start the DWT cycle counter used for the runtime statistics
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->LAR = 0xC5ACCE55;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	
+	scheduler.switch_cycles = DWT->CYCCNT;
 	
 	
 	// Set the current thread to point to the first thread to run
-	if (scheduler.running_queue.last != NULL)
-	{
-		scheduler.current_thread = scheduler.running_queue.last->object;
-		
-		list_remove_last(&scheduler.running_queue);
-	}
-	else
+	scheduler.current_thread = scheduler_running_queue_remove_next();
+	
+	if (scheduler.current_thread == NULL)
 	{
 		scheduler.current_thread = scheduler.idle_thread;
 	}
@@ -140,11 +166,12 @@ void kernel_launch(void)
 	// Set the priorities for the SysTick and PendSV exception
 	//
 	// Under normal operation the SysTick exception should have the highest priority
-	// and the PendSV should have the lowest. In debug mode this will make the system
-	// crash. This is because the SysTick exception handler will print things to the
-	// screen, and therefore not return within the new time slice. This means that
-	// the scheduler runs several times without a context-switch.
-	interrupt_enable_peripheral_interrupt(SysTick_IRQn, IRQ_LEVEL_0);
+	// of the interrupts using the kernel, and the PendSV should have the lowest. In debug
+	// mode this will make the system crash. This is because the SysTick exception handler
+	// will print things to the screen, and therefore not return within the new time slice.
+	// This means that the scheduler runs several times without a context-switch. Only
+	// interrupts that never call the kernel may be placed above the kernel level.
+	interrupt_enable_peripheral_interrupt(SysTick_IRQn, KERNEL_INTERRUPT_LEVEL);
 	interrupt_enable_peripheral_interrupt(PendSV_IRQn, IRQ_LEVEL_7);
 	
 	
@@ -157,9 +184,37 @@ void kernel_launch(void)
 //--------------------------------------------------------------------------------------------------//
 
 
+// Called from threads and from interrupts. The SysTick interrupt must not run between the read
+// and the reset of the counter, since the cycles in between would then be counted twice.
+
 void reschedule(void)
 {
-	scheduler.reschedule_runtime = 1000 - systick_get_counter_value() / scheduler.systick_divider;
+	CRITICAL_SECTION_ENTER();
+	
+	// Cycles since the SysTick period started. The counter is reset below, so the remainder which
+	// is not counted in the kernel tick would otherwise be lost, and the tick would drift.
+	uint32_t cycles = scheduler.tick_period * scheduler.systick_divider - systick_get_counter_value() + scheduler.reschedule_cycles;
+	
+	// An interrupt at the SysTick level may run after the counter has reached zero, while the
+	// SysTick handler is still pending. The counter has then reloaded, and the period which ended
+	// must be counted as well.
+	if ((SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) && (scheduler.reschedule_pending == 0))
+	{
+		cycles += scheduler.tick_period * scheduler.systick_divider;
+	}
+	
+	scheduler.reschedule_cycles = cycles % scheduler.systick_divider;
+	
+	// A reschedule which is still pending has restarted the period already
+	if (scheduler.reschedule_pending)
+	{
+		scheduler.reschedule_runtime += cycles / scheduler.systick_divider;
+	}
+	else
+	{
+		scheduler.reschedule_runtime = cycles / scheduler.systick_divider;
+	}
+	
 	scheduler.reschedule_pending = 1;
 	
 	// Not sure is this is a good idea, since it might fuck up the timing
@@ -168,6 +223,34 @@ void reschedule(void)
 	// Since the scheduling algorithm is called in the SysTick exception rather than
 	// in the PendSV exception we pend the SysTick handler instead of the PendSV handler. 
 	SCB->ICSR |= (1 << SCB_ICSR_PENDSTSET_Pos);
+	
+	CRITICAL_SECTION_LEAVE();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Returns the current time in microseconds. The kernel tick is only updated by the SysTick
+// handler, and may be many milliseconds old in tickless idle, so the time counted by SysTick since
+// then is added the same way as in reschedule(). This must be called inside a critical section.
+
+uint64_t scheduler_get_tick(void)
+{
+	uint32_t cycles = scheduler.tick_period * scheduler.systick_divider - systick_get_counter_value() + scheduler.reschedule_cycles;
+	
+	uint64_t tick = scheduler.tick + cycles / scheduler.systick_divider;
+	
+	if (scheduler.reschedule_pending)
+	{
+		tick += scheduler.reschedule_runtime;
+	}
+	else if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk)
+	{
+		tick += scheduler.tick_period;
+	}
+	
+	return tick;
 }
 
 
@@ -182,7 +265,7 @@ void thread_delay(uint32_t ticks)
 	
 	
 	// Calculate the right tick to wake
-	uint32_t tmp = scheduler.tick + ticks * 1000;
+	uint64_t tmp = scheduler.tick + (uint64_t)ticks * 1000;
 	
 	
 	// Write the value to the thread control block
@@ -190,8 +273,10 @@ void thread_delay(uint32_t ticks)
 	scheduler.current_thread->list_node.value = tmp;
 	
 	
-	// Update the next list to place the thread in
-	scheduler.current_thread->next_list = &scheduler.delay_queue;
+	// The scheduler will place the thread in the delay wheel
+	scheduler.current_thread->state = THREAD_STATE_DELAYED;
+	
+	TRACE(TRACE_EVENT_DELAY, TRACE_REASON_NONE, scheduler.current_thread, ticks);
 	
 	
 	// Let the scheduler start again
@@ -206,6 +291,40 @@ void thread_delay(uint32_t ticks)
 //--------------------------------------------------------------------------------------------------//
 
 
+// Ends the job of a periodic real time thread. The thread is delayed until the release of the next
+// job. A job finishing after its deadline counts as a deadline miss.
+
+void thread_wait_period(void)
+{
+	struct thread_structure* thread = scheduler.current_thread;
+	
+	check(thread->real_time.period != 0);
+	
+	suspend_scheduler();
+	
+	if (scheduler.tick > thread->real_time.absolute_deadline)
+	{
+		thread->real_time.deadline_misses++;
+	}
+	
+	scheduler_real_time_next_job(thread);
+	
+	thread->tick_to_wake = thread->real_time.release;
+	thread->list_node.value = thread->real_time.release;
+	
+	thread->state = THREAD_STATE_DELAYED;
+	
+	TRACE(TRACE_EVENT_DELAY, TRACE_REASON_NONE, thread, thread->real_time.period);
+	
+	resume_scheduler();
+	
+	reschedule();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
 // This is the kernels scheduler which decide what thread to run next
 // The next thread to run should be placed in the kernel_current_thread_pointer
 // variable
@@ -215,98 +334,163 @@ void round_robin_scheduler(void)
 	// Do not allow any context switch when the scheduler is suspended
 	if (likely(scheduler.status == SCHEDULER_STATUS_RUNNING))
 	{
+		// Charge the time since the thread was scheduled to the budget of a real time job. A
+		// delayed real time thread has already ended its job.
+		if ((scheduler.current_thread->real_time.period != 0) && (scheduler.current_thread->state != THREAD_STATE_DELAYED))
+		{
+			scheduler.current_thread->real_time.budget_used += (uint32_t)(scheduler.tick - scheduler.slice_start);
+		}
+		
 		int32_t free_stack = (int32_t)((uint32_t)scheduler.current_thread->stack_base + (uint32_t)scheduler.current_thread->stack_size - (uint32_t)scheduler.current_thread->stack_pointer);
 		uint32_t stack_size = scheduler.current_thread->stack_size;
 		uint32_t stack_usage = stack_size - free_stack;
+		uint8_t stack_overflow = 0;
 		
 		
-		if (stack_usage >= stack_size)
+		// The stack pointer is out of bounds, or the paint pattern at the bottom of the stack
+		// has been overwritten
+		if ((stack_usage >= stack_size) || (*scheduler.current_thread->stack_base != KERNEL_STACK_PAINT_PATTERN))
 		{
-			// This thread is not going to run anymore
+			// This thread is not going to run anymore. It must not be placed in any other list
+			// below, and a wait it has started is abandoned.
 			thread_stack_overflow_event(scheduler.current_thread->name);
+			
+			if (scheduler.current_thread->state == THREAD_STATE_BLOCK_PENDING)
+			{
+				list_remove_item(&(scheduler.current_thread->wait_node), scheduler.current_thread->wait_list);
+				scheduler.current_thread->wait_list = NULL;
+				scheduler.current_thread->blocked_mutex = NULL;
+			}
+			
 			list_insert_first(&scheduler.current_thread->list_node, &scheduler.suspended_list);
+			
+			scheduler.current_thread->current_list = &scheduler.suspended_list;
+			scheduler.current_thread->next_list = NULL;
+			scheduler.current_thread->state = THREAD_STATE_SUSPENDED;
+			
+			stack_overflow = 1;
 		}
 		
 		// This first part processes the thread that is done executing. This may involve
 		// placing the thread in another list i.e. suspend the thread, or deleting the
 		// thread if that is necessary. This part should also handler stack overflow and
 		// memory overflow. 
-		if (scheduler.current_thread != scheduler.idle_thread)
+		struct thread_structure* previous_thread = scheduler.current_thread;
+		uint8_t trace_reason = TRACE_REASON_NONE;
+		
+		if ((scheduler.current_thread != scheduler.idle_thread) && (stack_overflow == 0))
 		{
 			if (scheduler.current_thread->next_list != NULL)
 			{
-				// Check which list the thread is going to be placed in
-				if (scheduler.current_thread->next_list == &scheduler.delay_queue)
-				{
-					list_insert_delay(&scheduler.current_thread->list_node, &scheduler.delay_queue);
-					
-					// Update the kernel tick to wake
-					scheduler.tick_to_wake = ((struct thread_structure *)(scheduler.delay_queue.first->object))->tick_to_wake;
-				}
-				else
-				{
-					list_insert_first(&(scheduler.current_thread->list_node), scheduler.current_thread->next_list);
-				}
+				trace_reason = TRACE_REASON_BLOCK;
 				
+				list_insert_first(&(scheduler.current_thread->list_node), scheduler.current_thread->next_list);
+				
+				scheduler.current_thread->current_list = scheduler.current_thread->next_list;
 				scheduler.current_thread->next_list = NULL;
 			}
+			else if (scheduler.current_thread->state == THREAD_STATE_DELAYED)
+			{
+				trace_reason = TRACE_REASON_DELAY;
+				
+				scheduler_delay_insert(scheduler.current_thread);
+			}
+			else if (scheduler.current_thread->state == THREAD_STATE_BLOCK_PENDING)
+			{
+				trace_reason = TRACE_REASON_BLOCK;
+				
+				// The thread is already in the wait list. A wait with a timeout is placed in the
+				// delay wheel as well.
+				scheduler.current_thread->state = THREAD_STATE_BLOCKED;
+				scheduler.current_thread->current_list = NULL;
+				
+				if (scheduler.current_thread->tick_to_wake != 0xffffffffffffffff)
+				{
+					scheduler_delay_insert(scheduler.current_thread);
+				}
+			}
 			else
 			{
 				
 				if (unlikely(scheduler.current_thread->state == THREAD_STATE_EXIT_PENDING))
 				{
-					if (scheduler.current_thread->ID == 6969)
+					trace_reason = TRACE_REASON_EXIT;
+					
+					list_remove_item(&(scheduler.current_thread->thread_list), &scheduler.threads);
+					
+					if (scheduler.current_thread->real_time.period != 0)
 					{
-						// This thread belong to the fast programming interface. So we must
-						// delete the program memory buffer as well
-						if (fast_program_interface_delete != NULL)
-						{
-							fast_program_interface_delete();
-						}
+						scheduler_real_time_remove(&scheduler.current_thread->real_time);
 					}
 					
-					list_remove_item(&(scheduler.current_thread->thread_list), &scheduler.threads);
+					// Make sure the stack scanner does not look at the deleted thread
+					if (scheduler.stack_scan_thread == scheduler.current_thread)
+					{
+						scheduler.stack_scan_thread = NULL;
+					}
 					
-					// Then we have to delete the memory resources
-					//dynamic_memory_free(kernel_current_thread_pointer->stack_base);
-					dynamic_memory_free(scheduler.current_thread);
+					// The memory can not be freed here. The context switch still saves the thread
+					// context on its stack, and freeing takes too long for this interrupt. The
+					// thread is left as a zombie, and the reaper thread frees it later. A joinable
+					// thread is handed to the reaper by thread_join instead.
+					scheduler.current_thread->state = THREAD_STATE_ZOMBIE;
+					
+					if (scheduler.current_thread->joinable)
+					{
+						while (scheduler.current_thread->join_list.first != NULL)
+						{
+							scheduler_wake_thread((struct thread_structure *)(scheduler.current_thread->join_list.first->object), THREAD_WAIT_SUCCESS);
+						}
+					}
+					else
+					{
+						thread_reaper_insert(scheduler.current_thread);
+					}
+				}
+				else if (unlikely((scheduler.current_thread->real_time.period != 0) && (scheduler.current_thread->real_time.budget_used >= scheduler.current_thread->real_time.budget)))
+				{
+					// The real time job has used its budget
+					scheduler_real_time_throttle(scheduler.current_thread);
 				}
 				else
 				{
-					list_insert_first(&(scheduler.current_thread->list_node), &scheduler.running_queue);
+					scheduler_running_queue_insert(scheduler.current_thread);
 				}
 			}
 		}
 		
 		// Now we check if some delays has expired. Is so, all the expired threads has to be
 		// moved to the running queue. This function will place the threads last in the running
-		// queue, such that the are run first. 
+		// queue of their priority level, such that the are run first. 
 		if (scheduler.tick_to_wake <= scheduler.tick)
 		{
 			process_expired_delays();
 		}
 		
+		// Wake the timer thread if the first software timer has expired
+		if (scheduler.tick_to_timer <= scheduler.tick)
+		{
+			software_timer_tick_handler();
+		}
 		
-		// Real time qeue
-		// Interact
-		// Application
-		// Backgound
+		// Here we choose the next thread to run. This is the last element in the running queue
+		// with the highest priority. If no thread is runnable the idle thread will run.
+		scheduler.next_thread = scheduler_running_queue_remove_next();
 		
-		// Here we choose the next thread to run. This is normally the last element in the running queue
-		if (scheduler.running_queue.last == NULL)
+		if (scheduler.next_thread == NULL)
 		{
 			scheduler.next_thread = scheduler.idle_thread;
 			gpio_set_pin_value(PIOC, 8);
 		}
 		else
 		{
-			scheduler.next_thread = scheduler.running_queue.last->object;
-			
-			list_remove_last(&scheduler.running_queue);
 			gpio_clear_pin_value(PIOC, 8);
 		}
 		
 		scheduler.next_thread->context_switches++;
+		scheduler.slice_start = scheduler.tick;
+		
+		TRACE(TRACE_EVENT_SCHEDULE, trace_reason, previous_thread, scheduler.next_thread);
 	}
 	else
 	{
@@ -327,157 +511,796 @@ void scheduler_current_thread_to_queue(list_s* list)
 //--------------------------------------------------------------------------------------------------//
 
 
+// Places a thread first in the running queue of its own priority level. The thread will then be
+// the last thread on that level to run.
 
+void scheduler_running_queue_insert(struct thread_structure* thread)
+{
+	if (thread->real_time.period != 0)
+	{
+		scheduler_real_time_queue_insert(thread);
+		return;
+	}
+	
+	list_insert_first(&(thread->list_node), &scheduler.running_queue[thread->priority]);
+	
+	thread->current_list = &scheduler.running_queue[thread->priority];
+	scheduler.running_bitmap |= (0x80000000 >> thread->priority);
+}
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
-static inline void process_expired_delays(void)
+static inline void scheduler_running_queue_insert_last(struct thread_structure* thread)
 {
-	list_node_s* list_iterator = scheduler.delay_queue.first;
-	
-	check(((struct thread_structure *)(scheduler.delay_queue.first->object))->tick_to_wake <= scheduler.tick_to_wake);
-	
-	uint16_t  i;
-	
-	for (i = 0; i < scheduler.delay_queue.size; i++)
+	if (thread->real_time.period != 0)
 	{
-		if (((struct thread_structure *)(list_iterator->object))->tick_to_wake > scheduler.tick_to_wake)
-		{
-			break;
-		}
-		list_iterator = list_iterator->next;
+		scheduler_real_time_queue_insert(thread);
+		return;
 	}
 	
-	for (uint16_t k = 0; k < i; k++)
+	list_insert_last(&(thread->list_node), &scheduler.running_queue[thread->priority]);
+	
+	thread->current_list = &scheduler.running_queue[thread->priority];
+	scheduler.running_bitmap |= (0x80000000 >> thread->priority);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Removes and returns the next thread to run, or NULL if no thread is runnable. Periodic real time
+// threads run first. Otherwise the number of leading zeros in the running bitmap is the highest
+// priority level holding a thread, so this takes constant time regardless of the number of threads.
+
+static inline struct thread_structure* scheduler_running_queue_remove_next(void)
+{
+	if (scheduler.real_time_queue.size != 0)
 	{
-		list_node_s* tmp = scheduler.delay_queue.first;
+		struct thread_structure* thread = (struct thread_structure *)(scheduler.real_time_queue.first->object);
 		
-		list_remove_first(&scheduler.delay_queue);
-		list_insert_last(tmp, &scheduler.running_queue);
+		list_remove_first(&scheduler.real_time_queue);
+		
+		thread->current_list = NULL;
+		
+		return thread;
 	}
 	
-	if (list_iterator == NULL)
+	if (scheduler.running_bitmap == 0)
 	{
-		// No threads left in the queue
-		scheduler.tick_to_wake = 0xffffffffffffffff;
+		return NULL;
 	}
-	else
+	
+	uint32_t priority = __CLZ(scheduler.running_bitmap);
+	list_s* list = &scheduler.running_queue[priority];
+	
+	struct thread_structure* thread = (struct thread_structure *)(list->last->object);
+	
+	list_remove_last(list);
+	
+	if (list->size == 0)
 	{
-		scheduler.tick_to_wake = ((struct thread_structure *)(scheduler.delay_queue.first->object))->tick_to_wake;
+		scheduler.running_bitmap &= ~(0x80000000 >> priority);
 	}
+	
+	thread->current_list = NULL;
+	
+	return thread;
 }
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
-void reset_runtime(void)
+static inline void scheduler_running_queue_remove(struct thread_structure* thread)
 {
-	scheduler.idle_thread->stats.window_time = scheduler.idle_thread->stats.new_window_time;
-	scheduler.idle_thread->stats.new_window_time = 0;
+	list_s* list = &scheduler.running_queue[thread->priority];
 	
-	if (scheduler.current_thread != scheduler.idle_thread)
-	{
-		scheduler.current_thread->stats.window_time = scheduler.current_thread->stats.new_window_time;
-		scheduler.current_thread->stats.new_window_time = 0;
-	}
+	list_remove_item(&(thread->list_node), list);
 	
-	if (scheduler.threads.size > 0)
+	if (list->size == 0)
 	{
-		list_node_s* list_node;
-		
-		list_iterate(list_node, &scheduler.threads)
-		{
-			if ((struct thread_structure *)(list_node->object) != scheduler.current_thread)
-			{
-				((struct thread_structure *)(list_node->object))->stats.window_time = ((struct thread_structure *)(list_node->object))->stats.new_window_time;
-				((struct thread_structure *)(list_node->object))->stats.new_window_time = 0;
-			}
-		}
+		scheduler.running_bitmap &= ~(0x80000000 >> thread->priority);
 	}
+	
+	thread->current_list = NULL;
 }
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
-void suspend_scheduler(void)
+// Blocks the current thread on the wait list of a kernel object. The timeout is given in
+// milliseconds. This must be called inside a critical section, and the caller must call
+// reschedule() after leaving it. When the thread runs again the wait status holds the result.
+// The thread might be woken before it is switched out, in which case reschedule() simply
+// returns after the time slice.
+
+void scheduler_block_current_thread(list_s* wait_list, uint32_t timeout)
 {
-	(void)scheduler.status;
-	scheduler.status = SCHEDULER_STATUS_SUSPENDED;
+	struct thread_structure* thread = scheduler.current_thread;
+	
+	// The wait list is sorted by priority, and threads of the same priority are woken in order
+	thread->wait_node.value = thread->priority;
+	list_insert_delay(&(thread->wait_node), wait_list);
+	
+	thread->wait_list = wait_list;
+	thread->wait_status = THREAD_WAIT_TIMEOUT;
+	
+	if (timeout == THREAD_WAIT_FOREVER)
+	{
+		thread->tick_to_wake = 0xffffffffffffffff;
+	}
+	else
+	{
+		thread->tick_to_wake = scheduler.tick + (uint64_t)timeout * 1000;
+	}
+	
+	thread->list_node.value = thread->tick_to_wake;
+	
+	thread->state = THREAD_STATE_BLOCK_PENDING;
 }
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
-void resume_scheduler(void)
+// Removes a thread from the wait list it is blocked on and makes it runnable. This must be called
+// inside a critical section, either from a thread or an interrupt. It is up to the caller to
+// reschedule if the woken thread should preempt the current thread.
+
+void scheduler_wake_thread(struct thread_structure* thread, enum thread_wait_status status)
 {
-	(void)scheduler.status;
-	scheduler.status = SCHEDULER_STATUS_RUNNING;
+	list_remove_item(&(thread->wait_node), thread->wait_list);
+	
+	thread->wait_list = NULL;
+	thread->wait_status = status;
+	
+	if (thread->state == THREAD_STATE_BLOCKED)
+	{
+		if (thread->tick_to_wake != 0xffffffffffffffff)
+		{
+			scheduler_delay_remove(thread);
+		}
+		
+		thread->state = THREAD_STATE_RUNNING;
+		scheduler_running_queue_insert_last(thread);
+	}
+	else
+	{
+		// The thread has not been switched out yet. The scheduler will place it in the running queue
+		thread->state = THREAD_STATE_RUNNING;
+	}
 }
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
-void scheduler_set_dynamic_loader_handler(void (*handler)(void))
+// Wakes the thread like scheduler_wake_thread, and returns 1 if the caller should reschedule. The
+// woken thread preempts the current thread if it has a higher priority. The idle thread is always
+// preempted whatever priority the woken thread has, since it has the normal priority, and with
+// tickless idle the next tick may be many milliseconds away. This must be called inside a critical
+// section. A caller waking several threads should call reschedule once after the last one.
+
+uint8_t scheduler_wake_thread_preempt(struct thread_structure* thread, enum thread_wait_status status)
 {
-	fast_program_interface_delete = handler;
+	scheduler_wake_thread(thread, status);
+	
+	if (scheduler.current_thread == scheduler.idle_thread)
+	{
+		return 1;
+	}
+	
+	return (thread->priority < scheduler.current_thread->priority);
 }
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
-void thread_stack_overflow_event(char* data)
+// Changes the priority of a thread and moves it to the right position in the running queue or the
+// wait list it is in. This must be called inside a critical section.
+
+void scheduler_set_priority(struct thread_structure* thread, enum thread_priority priority)
 {
-	board_serial_print("Warning: Stack overflow on ");
-	board_serial_print(data);
-	board_serial_print(" thread\n");
+	if (thread->priority == priority)
+	{
+		return;
+	}
+	
+	if (thread->current_list == &scheduler.running_queue[thread->priority])
+	{
+		scheduler_running_queue_remove(thread);
+		
+		thread->priority = priority;
+		scheduler_running_queue_insert_last(thread);
+	}
+	else if (thread->wait_list != NULL)
+	{
+		list_remove_item(&(thread->wait_node), thread->wait_list);
+		
+		thread->priority = priority;
+		thread->wait_node.value = priority;
+		list_insert_delay(&(thread->wait_node), thread->wait_list);
+	}
+	else
+	{
+		thread->priority = priority;
+	}
 }
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
-void print_runtime_statistics(void)
+static inline void process_expired_delays(void)
 {
-	struct thread_structure* tmp_thread;
-	
-	board_serial_programming_print("Runtime\tStack\tCPU\n");
-	
-	int32_t cpu_usage = 1000000 - scheduler.idle_thread->stats.window_time;
-	char k = cpu_usage / 10000;
-	board_serial_programming_print("\t\t\t");
-	board_serial_programming_write_percent(k, cpu_usage / 1000 - (k * 10));
-	board_serial_programming_print(" : CPU");
-	
-	
-	uint32_t use;
-	uint32_t tot;
-	
-	use = dynamic_memory_get_used_size(DRAM_BANK_0);
-	tot = dynamic_memory_get_total_size(DRAM_BANK_0);
-	
-	k = 100 * use / tot;
-	uint32_t l = (100 * use) % tot;
+	struct delay_wheel* wheel = &scheduler.delay_queue;
 	
-	board_serial_programming_print("\t\t");
-	board_serial_programming_write_percent(k, 100 * l / tot);
-	board_serial_programming_print("DRAM Bank 0");
+	uint64_t current_slot = scheduler.tick >> KERNEL_DELAY_WHEEL_SLOT_SHIFT;
+	uint64_t next_wake = 0xffffffffffffffff;
 	
-	use = dynamic_memory_get_used_size(DRAM_BANK_1);
-	tot = dynamic_memory_get_total_size(DRAM_BANK_1);
+	// Visit every slot from the last processed slot up to the current slot. The kernel tick may
+	// have advanced several slots since the last visit. If it has advanced more than one revolution
+	// every slot is visited once.
+	uint64_t slot_count = current_slot - wheel->position + 1;
 	
-	k = 100 * use / tot;
-	l = (100 * use) % tot;
+	if (slot_count > DELAY_WHEEL_SLOTS)
+	{
+		slot_count = DELAY_WHEEL_SLOTS;
+	}
 	
-	board_serial_programming_print("\t\t");
-	board_serial_programming_write_percent(k, 100 * l / tot);
-	board_serial_programming_print("DRAM Bank 1");
+	for (uint32_t i = 0; i < slot_count; i++)
+	{
+		uint32_t slot = (uint32_t)(wheel->position + i) & (DELAY_WHEEL_SLOTS - 1);
+		
+		if ((wheel->bitmap & (0x80000000 >> slot)) == 0)
+		{
+			continue;
+		}
+		
+		list_node_s* list_iterator = wheel->slots[slot].first;
+		
+		while (list_iterator != NULL)
+		{
+			list_node_s* tmp = list_iterator;
+			list_iterator = list_iterator->next;
+			
+			if (tmp->value <= scheduler.tick)
+			{
+				// The delay has expired. Place the thread last in the running queue
+				struct thread_structure* thread = (struct thread_structure *)(tmp->object);
+				
+				list_remove_item(tmp, &wheel->slots[slot]);
+				
+				if (thread->state == THREAD_STATE_BLOCKED)
+				{
+					// A blocking call has timed out. The thread no longer passes its priority on to a
+					// mutex owner.
+					list_remove_item(&(thread->wait_node), thread->wait_list);
+					
+					thread->wait_list = NULL;
+					thread->wait_status = THREAD_WAIT_TIMEOUT;
+					thread->blocked_mutex = NULL;
+				}
+				
+				thread->state = THREAD_STATE_RUNNING;
+				scheduler_running_queue_insert_last(thread);
+			}
+			else if ((tmp->value >> KERNEL_DELAY_WHEEL_SLOT_SHIFT) == current_slot)
+			{
+				// The delay expires later in the current slot
+				if (tmp->value < next_wake)
+				{
+					next_wake = tmp->value;
+				}
+			}
+		}
+		
+		if (wheel->slots[slot].size == 0)
+		{
+			wheel->bitmap &= ~(0x80000000 >> slot);
+		}
+	}
+	
+	// The current slot is visited again the next time, since it may hold delays that have not
+	// expired yet
+	wheel->position = current_slot;
+	
+	if ((next_wake == 0xffffffffffffffff) && (wheel->bitmap != 0))
+	{
+		// Rotate the bitmap so that the slot after the current slot is in bit 31. The number of
+		// leading zeros is then the distance to the next slot holding a thread. That slot may only
+		// hold delays of a later revolution, in which case the wheel is just checked once more.
+		uint32_t shift = (uint32_t)(current_slot + 1) & (DELAY_WHEEL_SLOTS - 1);
+		uint32_t rotated = wheel->bitmap;
+		
+		if (shift != 0)
+		{
+			rotated = (wheel->bitmap << shift) | (wheel->bitmap >> (32 - shift));
+		}
+		
+		next_wake = (current_slot + 1 + __CLZ(rotated)) << KERNEL_DELAY_WHEEL_SLOT_SHIFT;
+	}
+	
+	scheduler.tick_to_wake = next_wake;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Changes the length of the SysTick period that started at the last SysTick interrupt. The cycles
+// counted since then are subtracted from the first reload, so the kernel tick does not drift when
+// the period is changed from inside the SysTick handler. The counter is forced to reload the
+// compensated value, and the reload register is then set to the full period for the next reloads.
+//
+// The handler may already have run longer than a short new period. The period is then lengthened
+// to end at least one microsecond from now, since a negative first reload would wrap around to a
+// period of many milliseconds, and a zero reload would stop the counter.
+
+static void scheduler_set_tick_period(uint32_t period)
+{
+	uint32_t elapsed = systick_get_reload_value() - systick_get_counter_value();
+	
+	if ((period * scheduler.systick_divider) <= (elapsed + scheduler.systick_divider))
+	{
+		period = elapsed / scheduler.systick_divider + 2;
+	}
+	
+	uint32_t reload = period * scheduler.systick_divider;
+	
+	systick_set_reload_value(reload - elapsed);
+	systick_set_counter_value(0);
+	
+	// Wait for the counter to reload
+	while (systick_get_counter_value() == 0)
+	{
+		
+	}
+	
+	systick_set_reload_value(reload);
+	
+	scheduler.tick_period = period;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Tickless idle. If the scheduler has chosen the idle thread there is nothing to do before the
+// next delay or software timer expires, so the SysTick period is set to end at that point. This
+// stretches the period, or shortens it if the expiry is less than a time slice away, since the
+// periods are not aligned to the expiries after a reschedule. The period is bounded by
+// the range of the SysTick counter. The SysTick handler adds the stretched period to the kernel
+// tick, and an early wake up through reschedule() accounts for the time actually spent. Once any other
+// thread is chosen the normal time slice is restored.
+//
+// A real time thread is given a shorter time slice when less than one slice is left of its budget,
+// so that an overrun is caught when the budget runs out.
+
+static inline void scheduler_update_tick_period(void)
+{
+	uint32_t period = 1000000 / KERNEL_TICK_FREQUENCY;
+	
+	struct thread_real_time* real_time = &scheduler.next_thread->real_time;
+	
+	if ((real_time->period != 0) && (scheduler.status == SCHEDULER_STATUS_RUNNING) && (real_time->budget_used < real_time->budget))
+	{
+		if ((real_time->budget - real_time->budget_used) < period)
+		{
+			period = real_time->budget - real_time->budget_used;
+		}
+		
+		if (period < KERNEL_REAL_TIME_MIN_SLICE)
+		{
+			period = KERNEL_REAL_TIME_MIN_SLICE;
+		}
+	}
+	
+	#if KERNEL_TICKLESS_IDLE
+	if ((scheduler.next_thread == scheduler.idle_thread) && (scheduler.status == SCHEDULER_STATUS_RUNNING))
+	{
+		uint64_t wake = scheduler.tick_to_wake;
+		
+		if (scheduler.tick_to_timer < wake)
+		{
+			wake = scheduler.tick_to_timer;
+		}
+		
+		if (wake > scheduler.tick)
+		{
+			if ((wake - scheduler.tick) > scheduler.tick_period_max)
+			{
+				period = scheduler.tick_period_max;
+			}
+			else
+			{
+				period = (uint32_t)(wake - scheduler.tick);
+			}
+		}
+	}
+	#endif
+	
+	if (period != scheduler.tick_period)
+	{
+		scheduler_set_tick_period(period);
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Places a delayed thread in the delay wheel slot given by its tick to wake. A real time job
+// released after an overrun may already be due. The wheel is only processed from its position and
+// forward, so such a thread is placed in the slot at the position, and wakes on the next check.
+
+static inline void scheduler_delay_insert(struct thread_structure* thread)
+{
+	uint64_t wake_slot = thread->tick_to_wake >> KERNEL_DELAY_WHEEL_SLOT_SHIFT;
+	
+	if (wake_slot < scheduler.delay_queue.position)
+	{
+		wake_slot = scheduler.delay_queue.position;
+	}
+	
+	uint32_t slot = (uint32_t)wake_slot & (DELAY_WHEEL_SLOTS - 1);
+	
+	list_insert_first(&(thread->list_node), &scheduler.delay_queue.slots[slot]);
+	
+	thread->current_list = &scheduler.delay_queue.slots[slot];
+	scheduler.delay_queue.bitmap |= (0x80000000 >> slot);
+	
+	// Update the kernel tick to wake
+	if (thread->tick_to_wake < scheduler.tick_to_wake)
+	{
+		scheduler.tick_to_wake = thread->tick_to_wake;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Removes a thread from the delay wheel before its tick to wake. The kernel tick to wake is left
+// as it is, so the wheel might be checked once without anything to do. The slot is found from the
+// current list, since a thread that was due when inserted is not in the slot of its tick to wake.
+
+static inline void scheduler_delay_remove(struct thread_structure* thread)
+{
+	uint32_t slot = (uint32_t)(thread->current_list - scheduler.delay_queue.slots);
+	
+	list_remove_item(&(thread->list_node), &scheduler.delay_queue.slots[slot]);
+	
+	if (scheduler.delay_queue.slots[slot].size == 0)
+	{
+		scheduler.delay_queue.bitmap &= ~(0x80000000 >> slot);
+	}
+	
+	thread->current_list = NULL;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Places a periodic real time thread in the real time queue. With earliest deadline first the
+// queue is sorted by the absolute deadline of the current job, and otherwise by the relative
+// deadline. Threads with the same key run in the order they were inserted.
+
+static inline void scheduler_real_time_queue_insert(struct thread_structure* thread)
+{
+	#if KERNEL_REAL_TIME_EDF
+	thread->list_node.value = thread->real_time.absolute_deadline;
+	#else
+	thread->list_node.value = thread->real_time.deadline;
+	#endif
+	
+	list_insert_delay(&(thread->list_node), &scheduler.real_time_queue);
+	
+	thread->current_list = &scheduler.real_time_queue;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Moves a real time thread on to its next job. Jobs whose deadline has already passed are never
+// released, and count as deadline misses.
+
+static inline void scheduler_real_time_next_job(struct thread_structure* thread)
+{
+	struct thread_real_time* real_time = &thread->real_time;
+	
+	real_time->release += real_time->period;
+	
+	while (real_time->release + real_time->deadline <= scheduler.tick)
+	{
+		real_time->release += real_time->period;
+		real_time->deadline_misses++;
+	}
+	
+	real_time->absolute_deadline = real_time->release + real_time->deadline;
+	real_time->budget_used = 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Budget enforcement. A real time job that has used its budget is delayed until the next release,
+// where it continues with a new budget. This keeps an overrunning thread from taking the time
+// of the other real time threads.
+
+static inline void scheduler_real_time_throttle(struct thread_structure* thread)
+{
+	thread->real_time.overruns++;
+	
+	scheduler_real_time_next_job(thread);
+	
+	thread->tick_to_wake = thread->real_time.release;
+	thread->list_node.value = thread->real_time.release;
+	thread->state = THREAD_STATE_DELAYED;
+	
+	scheduler_delay_insert(thread);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Admission control for a new periodic real time thread. The thread is admitted if the total
+// utilization of the periodic threads stays below the schedulable bound. With earliest deadline
+// first the bound is 100 %. With deadline monotonic priorities the Liu and Layland bound
+// n(2^(1/n) - 1) is used. Both are further limited by KERNEL_REAL_TIME_MAX_UTILIZATION, so that
+// the other threads still get CPU time. Returns 1 and reserves the utilization if the thread is
+// admitted.
+
+uint8_t scheduler_real_time_admit(struct thread_real_time* real_time)
+{
+	uint8_t admitted = 0;
+	
+	real_time->utilization = (uint32_t)((uint64_t)real_time->budget * 1000000 / real_time->deadline);
+	
+	CRITICAL_SECTION_ENTER();
+	
+	uint32_t bound = KERNEL_REAL_TIME_MAX_UTILIZATION * 10000;
+	
+	#if KERNEL_REAL_TIME_EDF == 0
+	static const uint32_t liu_layland_bound[] = { 1000000, 828427, 779763, 756828, 743492, 734772, 728627, 724062 };
+	
+	uint32_t count = scheduler.real_time_count + 1;
+	uint32_t rate_monotonic_bound = 693147;
+	
+	if (count <= (sizeof(liu_layland_bound) / sizeof(uint32_t)))
+	{
+		rate_monotonic_bound = liu_layland_bound[count - 1];
+	}
+	
+	if (rate_monotonic_bound < bound)
+	{
+		bound = rate_monotonic_bound;
+	}
+	#endif
+	
+	if (scheduler.real_time_utilization + real_time->utilization <= bound)
+	{
+		scheduler.real_time_utilization += real_time->utilization;
+		scheduler.real_time_count++;
+		
+		admitted = 1;
+	}
+	
+	CRITICAL_SECTION_LEAVE();
+	
+	return admitted;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Gives back the utilization of a periodic real time thread
+
+void scheduler_real_time_remove(struct thread_real_time* real_time)
+{
+	CRITICAL_SECTION_ENTER();
+	
+	scheduler.real_time_utilization -= real_time->utilization;
+	scheduler.real_time_count--;
+	
+	CRITICAL_SECTION_LEAVE();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// This is called from the PendSV handler before the context switch, with interrupts disabled.
+// The cycles since the last context switch are charged to the thread that is switched out,
+// except the cycles spent in interrupt handlers. The cycle counter is 32 bits and wraps every
+// 14 seconds at 300 MHz, which is far longer than the maximum SysTick period.
+
+void scheduler_context_switch_accounting(void)
+{
+	uint32_t cycles = DWT->CYCCNT;
+	uint32_t elapsed = cycles - scheduler.switch_cycles;
+	
+	scheduler.current_thread->stats.cycles += elapsed - scheduler.interrupt_cycles;
+	scheduler.interrupt_stats.cycles += scheduler.interrupt_cycles;
+	scheduler.total_cycles += elapsed;
+	
+	scheduler.switch_cycles = cycles;
+	scheduler.interrupt_cycles = 0;
+	
+	TRACE(TRACE_EVENT_SWITCH, TRACE_REASON_NONE, scheduler.current_thread, scheduler.next_thread);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Interrupt handlers call these functions on entry and exit, so that the time spent in them is
+// not charged to the interrupted thread. Only the outermost interrupt is timed. A nested
+// interrupt always returns before the interrupt it preempted, so the nesting counter needs no
+// further protection.
+
+void scheduler_interrupt_enter(void)
+{
+	if (scheduler.interrupt_nesting++ == 0)
+	{
+		scheduler.interrupt_entry_cycles = DWT->CYCCNT;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void scheduler_interrupt_leave(void)
+{
+	if (--scheduler.interrupt_nesting == 0)
+	{
+		scheduler.interrupt_cycles += DWT->CYCCNT - scheduler.interrupt_entry_cycles;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Computes the window usage of one runtime statistics entry, and starts a new window for it
+
+static inline void update_window_usage(struct thread_time* stats, uint64_t window_cycles)
+{
+	uint64_t cycles;
+	
+	CRITICAL_SECTION_ENTER();
+	cycles = stats->cycles;
+	CRITICAL_SECTION_LEAVE();
+	
+	if (window_cycles != 0)
+	{
+		stats->window_usage = (uint32_t)((cycles - stats->window_start) * 1000 / window_cycles);
+	}
+	
+	stats->window_start = cycles;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Ends the current runtime statistics window and calculates the CPU usage of every thread in that
+// window. This runs in the thread reading the statistics, not in the kernel. The counters are
+// 64 bits and are only read inside short critical sections.
+
+static void update_runtime_statistics(void)
+{
+	uint64_t total_cycles;
+	
+	CRITICAL_SECTION_ENTER();
+	total_cycles = scheduler.total_cycles;
+	CRITICAL_SECTION_LEAVE();
+	
+	uint64_t window_cycles = total_cycles - scheduler.window_start;
+	scheduler.window_start = total_cycles;
+	
+	update_window_usage(&scheduler.idle_thread->stats, window_cycles);
+	update_window_usage(&scheduler.interrupt_stats, window_cycles);
+	
+	if (scheduler.threads.size > 0)
+	{
+		list_node_s* list_node;
+		
+		list_iterate(list_node, &scheduler.threads)
+		{
+			update_window_usage(&((struct thread_structure *)(list_node->object))->stats, window_cycles);
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void suspend_scheduler(void)
+{
+	(void)scheduler.status;
+	scheduler.status = SCHEDULER_STATUS_SUSPENDED;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void resume_scheduler(void)
+{
+	(void)scheduler.status;
+	scheduler.status = SCHEDULER_STATUS_RUNNING;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void thread_stack_overflow_event(char* data)
+{
+	board_serial_print("Warning: Stack overflow on ");
+	board_serial_print(data);
+	board_serial_print(" thread\n");
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void print_runtime_statistics(void)
+{
+	struct thread_structure* tmp_thread;
+	
+	// Close the statistics window since the last print
+	update_runtime_statistics();
+	
+	board_serial_programming_print("Runtime\tStack\tCPU\n");
+	
+	int32_t cpu_usage = 1000 - scheduler.idle_thread->stats.window_usage;
+	char k = cpu_usage / 10;
+	board_serial_programming_print("\t\t\t");
+	board_serial_programming_write_percent(k, cpu_usage % 10);
+	board_serial_programming_print(" : CPU");
+	
+	k = scheduler.interrupt_stats.window_usage / 10;
+	board_serial_programming_print("\t\t");
+	board_serial_programming_write_percent(k, scheduler.interrupt_stats.window_usage % 10);
+	board_serial_programming_print(" : IRQ");
+	
+	
+	uint32_t use;
+	uint32_t tot;
+	
+	use = dynamic_memory_get_used_size(DRAM_BANK_0);
+	tot = dynamic_memory_get_total_size(DRAM_BANK_0);
+	
+	k = 100 * use / tot;
+	uint32_t l = (100 * use) % tot;
+	
+	board_serial_programming_print("\t\t");
+	board_serial_programming_write_percent(k, 100 * l / tot);
+	board_serial_programming_print("DRAM Bank 0");
+	
+	use = dynamic_memory_get_used_size(DRAM_BANK_1);
+	tot = dynamic_memory_get_total_size(DRAM_BANK_1);
+	
+	k = 100 * use / tot;
+	l = (100 * use) % tot;
+	
+	board_serial_programming_print("\t\t");
+	board_serial_programming_write_percent(k, 100 * l / tot);
+	board_serial_programming_print("DRAM Bank 1");
 	
 	use = dynamic_memory_get_used_size(SRAM);
 	tot = dynamic_memory_get_total_size(SRAM);
@@ -503,7 +1326,8 @@ void print_runtime_statistics(void)
 			// Calculate the stach usage
 			board_serial_programming_print("%d\t\t", (uint32_t)tmp_thread->context_switches);
 			
-			uint32_t used_stack = tmp_thread->stack_size - ((uint32_t)tmp_thread->stack_pointer - (uint32_t)tmp_thread->stack_base);
+			// Peak stack usage found by the stack scanner
+			uint32_t used_stack = tmp_thread->stack_size - ((uint32_t)tmp_thread->stack_watermark - (uint32_t)tmp_thread->stack_base);
 			
 			// Warning message for stach overflow
 			
@@ -512,14 +1336,66 @@ void print_runtime_statistics(void)
 			board_serial_programming_write_percent(k, 10 * l / tmp_thread->stack_size);
 			board_serial_programming_print("\t");
 			
-			uint8_t tmp = tmp_thread->stats.window_time / 10000;
+			uint8_t tmp = tmp_thread->stats.window_usage / 10;
 			
-			board_serial_programming_write_percent(tmp, tmp_thread->stats.window_time / 1000 - (tmp * 10));
+			board_serial_programming_write_percent(tmp, tmp_thread->stats.window_usage % 10);
 			board_serial_programming_print(" : %s", tmp_thread->name);
+			
+			// Deadline misses and overruns of periodic real time threads
+			if (tmp_thread->real_time.period != 0)
+			{
+				board_serial_programming_print("\t%d misses, %d overruns", tmp_thread->real_time.deadline_misses, tmp_thread->real_time.overruns);
+			}
+			
 			board_serial_programming_print("\n");
 		}
 	}
 
+#if CRITICAL_SECTION_MEASURE
+	struct critical_section_stats critical_stats;
+	char call_site[11] = "0x00000000";
+	
+	critical_section_get_stats(&critical_stats);
+	
+	for (uint32_t i = 0; i < 8; i++)
+	{
+		call_site[9 - i] = "0123456789abcdef"[(critical_stats.max_call_site >> (4 * i)) & 0xf];
+	}
+	
+	board_serial_programming_print("\nLongest critical section %u cycles at %s\n", critical_stats.max_cycles, call_site);
+#endif
+
+	struct slab_cache* cache = slab_cache_get_list();
+	
+	if (cache != NULL)
+	{
+		board_serial_programming_print("\nCache\t\tSize\tUsed\tPeak\tTotal\tFailed\n");
+	}
+	
+	while (cache != NULL)
+	{
+		struct slab_cache_stats cache_stats;
+		
+		slab_cache_get_stats(cache, &cache_stats);
+		
+		board_serial_programming_print("%s\t\t%u\t%u\t%u\t%u\t%u\n", cache->name, cache_stats.object_size, cache_stats.used_objects, cache_stats.peak_used_objects, cache_stats.total_objects, cache_stats.failures);
+		
+		cache = cache->next;
+	}
+
+#if SPINLOCK_MEASURE
+	struct spinlock_stats* lock_stats = spinlock_get_stats_list();
+	
+	board_serial_programming_print("\nLock\t\tTaken\tWaited\tMax hold\n");
+	
+	while (lock_stats != NULL)
+	{
+		board_serial_programming_print("%s\t\t%u\t%u\t%u\n", lock_stats->name, lock_stats->acquisitions, lock_stats->contended, lock_stats->max_hold_cycles);
+		
+		lock_stats = lock_stats->next;
+	}
+#endif
+	
 	board_serial_programming_print("\n\n");
 }
 
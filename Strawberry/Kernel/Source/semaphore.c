@@ -0,0 +1,145 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#include "semaphore.h"
+#include "scheduler.h"
+#include "critical_section.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include <stddef.h>
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+extern struct scheduler_info scheduler;
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static uint8_t semaphore_post(struct semaphore* semaphore);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void semaphore_init(struct semaphore* semaphore, uint32_t count)
+{
+	semaphore->count = count;
+	
+	semaphore->wait_list.first = NULL;
+	semaphore->wait_list.last = NULL;
+	semaphore->wait_list.size = 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Takes the semaphore, or blocks the thread for at most timeout milliseconds. A timeout of zero
+// returns immediately. Returns 1 if the semaphore was taken and 0 on timeout.
+
+uint8_t semaphore_take(struct semaphore* semaphore, uint32_t timeout)
+{
+	uint8_t taken = 0;
+	uint8_t blocked = 0;
+	
+	CRITICAL_SECTION_ENTER();
+	
+	if (semaphore->count != 0)
+	{
+		semaphore->count--;
+		taken = 1;
+	}
+	else if (timeout != 0)
+	{
+		scheduler_block_current_thread(&semaphore->wait_list, timeout);
+		blocked = 1;
+	}
+	
+	CRITICAL_SECTION_LEAVE();
+	
+	if (blocked == 0)
+	{
+		return taken;
+	}
+	
+	reschedule();
+	
+	return (scheduler.current_thread->wait_status == THREAD_WAIT_SUCCESS);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void semaphore_give(struct semaphore* semaphore)
+{
+	if (semaphore_post(semaphore))
+	{
+		reschedule();
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The waiter is moved straight to the running queue, and a reschedule is requested if it should
+// preempt the interrupted thread. The SysTick handler runs at the kernel interrupt level, so it
+// runs the scheduler as soon as no interrupt at or above that level is active, possibly nested on
+// top of this one. The context switch is done by PendSV after every interrupt has returned.
+
+void semaphore_give_from_isr(struct semaphore* semaphore)
+{
+	semaphore_give(semaphore);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+uint32_t semaphore_get_count(struct semaphore* semaphore)
+{
+	return semaphore->count;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Wakes the first waiter or increments the count. Returns 1 if the woken thread should preempt
+// the current thread.
+
+static uint8_t semaphore_post(struct semaphore* semaphore)
+{
+	uint8_t preempt = 0;
+	
+	CRITICAL_SECTION_ENTER();
+	
+	if (semaphore->wait_list.size != 0)
+	{
+		struct thread_structure* waiter = (struct thread_structure *)(semaphore->wait_list.first->object);
+		
+		preempt = scheduler_wake_thread_preempt(waiter, THREAD_WAIT_SUCCESS);
+	}
+	else
+	{
+		semaphore->count++;
+	}
+	
+	CRITICAL_SECTION_LEAVE();
+	
+	return preempt;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
\ No newline at end of file
@@ -0,0 +1,330 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#include "software_timer.h"
+#include "scheduler.h"
+#include "thread.h"
+#include "dynamic_memory.h"
+#include "critical_section.h"
+#include "check.h"
+#include "config.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include <stddef.h>
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+extern struct scheduler_info scheduler;
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The timer service keeps all active timers in a list sorted by expiry. The SysTick handler only
+// compares the kernel tick against the first expiry and wakes the timer thread, so the interrupt
+// time does not depend on the number of timers. The timer thread then runs the callbacks of every
+// timer that has expired, and blocks in the wait list until the next expiry.
+
+struct software_timer_service
+{
+	list_s						active_list;
+	list_s						wait_list;
+	
+	struct thread_structure*	thread;
+};
+
+
+static struct software_timer_service timer_service;
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void software_timer_thread(void* param);
+
+static inline uint8_t software_timer_insert(struct software_timer* timer, uint64_t tick_to_expire);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void software_timer_config(void)
+{
+	// No timer has expired yet
+	scheduler.tick_to_timer = 0xffffffffffffffff;
+	
+	timer_service.thread = thread_new("Timer", software_timer_thread, NULL, KERNEL_TIMER_THREAD_PRIORITY, KERNEL_TIMER_THREAD_STACK_SIZE);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Initializes a statically allocated timer. The period is given in milliseconds. The timer
+// is not started.
+
+void software_timer_init(struct software_timer* timer, software_timer_callback callback, void* parameter, uint32_t period, enum software_timer_mode mode)
+{
+	// A periodic timer with no period would expire forever
+	check((mode == SOFTWARE_TIMER_ONE_SHOT) || (period != 0));
+	
+	timer->list_node.object = timer;
+	timer->list_node.next = NULL;
+	timer->list_node.prev = NULL;
+	
+	timer->callback = callback;
+	timer->parameter = parameter;
+	timer->period = period * 1000;
+	timer->mode = mode;
+	timer->active = 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Allocates and initializes a new timer. This must not be called from interrupt context.
+
+struct software_timer* software_timer_new(software_timer_callback callback, void* parameter, uint32_t period, enum software_timer_mode mode)
+{
+	struct software_timer* timer = (struct software_timer *)dynamic_memory_new(DRAM_BANK_0, sizeof(struct software_timer));
+	
+	if (timer == NULL)
+	{
+		check(0);
+		return NULL;
+	}
+	
+	software_timer_init(timer, callback, parameter, period, mode);
+	
+	return timer;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void software_timer_delete(struct software_timer* timer)
+{
+	software_timer_stop(timer);
+	
+	dynamic_memory_free(timer);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Starts the timer one period from now. Starting an active timer has no effect. The start, stop
+// and reset functions only touch the active list inside a critical section, and may be called
+// from both threads and interrupts.
+
+void software_timer_start(struct software_timer* timer)
+{
+	uint8_t preempt = 0;
+	
+	CRITICAL_SECTION_ENTER();
+	
+	if (timer->active == 0)
+	{
+		preempt = software_timer_insert(timer, scheduler_get_tick() + timer->period);
+	}
+	
+	CRITICAL_SECTION_LEAVE();
+	
+	if (preempt)
+	{
+		reschedule();
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void software_timer_stop(struct software_timer* timer)
+{
+	CRITICAL_SECTION_ENTER();
+	
+	if (timer->active)
+	{
+		list_remove_item(&(timer->list_node), &timer_service.active_list);
+		
+		timer->active = 0;
+	}
+	
+	CRITICAL_SECTION_LEAVE();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Restarts the timer one period from now, whether it is active or not
+
+void software_timer_reset(struct software_timer* timer)
+{
+	uint8_t preempt;
+	
+	CRITICAL_SECTION_ENTER();
+	
+	if (timer->active)
+	{
+		list_remove_item(&(timer->list_node), &timer_service.active_list);
+	}
+	
+	preempt = software_timer_insert(timer, scheduler_get_tick() + timer->period);
+	
+	CRITICAL_SECTION_LEAVE();
+	
+	if (preempt)
+	{
+		reschedule();
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Changes the period of the timer. An active timer keeps its current expiry, and the new
+// period is used from the next one.
+
+void software_timer_set_period(struct software_timer* timer, uint32_t period)
+{
+	CRITICAL_SECTION_ENTER();
+	
+	timer->period = period * 1000;
+	
+	CRITICAL_SECTION_LEAVE();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// This is called from the SysTick handler when the first timer has expired. The timer thread
+// might not have blocked yet. In that case it is simply kept in the running queue.
+
+void software_timer_tick_handler(void)
+{
+	struct thread_structure* thread = timer_service.thread;
+	
+	// The timer thread sets the next expiry again before it blocks
+	scheduler.tick_to_timer = 0xffffffffffffffff;
+	
+	if (thread->next_list == &timer_service.wait_list)
+	{
+		thread->next_list = NULL;
+	}
+	else if (timer_service.wait_list.size != 0)
+	{
+		list_remove_item(&(thread->list_node), &timer_service.wait_list);
+		
+		scheduler_running_queue_insert(thread);
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Inserts the timer in the active list. Must be called inside a critical section. Returns 1 if
+// the caller should reschedule, since the idle thread may have stretched the SysTick period past
+// the new expiry. The scheduler then shortens the period when it chooses the idle thread again.
+
+static inline uint8_t software_timer_insert(struct software_timer* timer, uint64_t tick_to_expire)
+{
+	timer->list_node.value = tick_to_expire;
+	timer->active = 1;
+	
+	list_insert_delay(&(timer->list_node), &timer_service.active_list);
+	
+	// Make sure the SysTick handler checks the new expiry
+	if (tick_to_expire < scheduler.tick_to_timer)
+	{
+		scheduler.tick_to_timer = tick_to_expire;
+	}
+	
+	return (scheduler.current_thread == scheduler.idle_thread) && (tick_to_expire < scheduler.tick + scheduler.tick_period);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The timer thread runs the callbacks of all expired timers in one batch. Each timer is removed
+// from the active list, and a periodic timer is restarted, before its callback is called. The
+// callback may therefore stop, reset or delete its own timer. A periodic timer is restarted
+// relative to its previous expiry, so the period does not drift with the thread latency.
+
+static void software_timer_thread(void* param)
+{
+	while (1)
+	{
+		struct software_timer* timer = NULL;
+		
+		CRITICAL_SECTION_ENTER();
+		
+		list_node_s* first = timer_service.active_list.first;
+		
+		if ((first != NULL) && (first->value <= scheduler.tick))
+		{
+			timer = (struct software_timer *)(first->object);
+			
+			list_remove_first(&timer_service.active_list);
+			timer->active = 0;
+			
+			if (timer->mode == SOFTWARE_TIMER_PERIODIC)
+			{
+				uint64_t tick_to_expire = first->value + timer->period;
+				
+				// Skip the periods that have already been missed
+				while (tick_to_expire <= scheduler.tick)
+				{
+					tick_to_expire += timer->period;
+				}
+				
+				software_timer_insert(timer, tick_to_expire);
+			}
+		}
+		else
+		{
+			// Nothing more to do. The thread is blocked in the same critical section as the
+			// next expiry is set, so an expiry can not be missed.
+			if (first != NULL)
+			{
+				scheduler.tick_to_timer = first->value;
+			}
+			else
+			{
+				scheduler.tick_to_timer = 0xffffffffffffffff;
+			}
+			
+			scheduler_current_thread_to_queue(&timer_service.wait_list);
+		}
+		
+		CRITICAL_SECTION_LEAVE();
+		
+		if (timer != NULL)
+		{
+			timer->callback(timer->parameter);
+		}
+		else
+		{
+			reschedule();
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
\ No newline at end of file
@@ -6,41 +6,378 @@
 // the software.
 
 #include "spinlock.h"
+#include "atomic.h"
+#include "critical_section.h"
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
-void spinlock_aquire(struct spinlock* spin)
+#include <stddef.h>
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#define RWLOCK_WRITER				0x80000000
+#define RWLOCK_WRITER_WAITING		0x40000000
+#define RWLOCK_READER_MASK			0x3fffffff
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static inline void spinlock_lock(struct spinlock* spin);
+
+static inline void spinlock_unlock(struct spinlock* spin);
+
+static inline void rwlock_read_lock(struct rwlock* lock);
+
+static inline void rwlock_write_lock(struct rwlock* lock);
+
+static inline void rwlock_write_unlock(struct rwlock* lock);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#if SPINLOCK_MEASURE
+
+// Named locks are linked in this list, so that the runtime statistics can print them
+static struct spinlock_stats* spinlock_stats_list;
+
+
+static void spinlock_stats_register(struct spinlock_stats* stats, const char* name);
+
+static inline void spinlock_stats_aquired(struct spinlock_stats* stats, uint8_t contended);
+
+static inline void spinlock_stats_released(struct spinlock_stats* stats);
+
+#endif
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// A spinlock that is zero initialized is also valid, but it is not listed in the statistics
+
+void spinlock_init(struct spinlock* spin, const char* name)
 {
-	uint32_t status = 0;
+	spin->next_ticket = 0;
+	spin->serving = 0;
 	
-	do {
-		while (__LDREXW(&(spin->lock)) != 0)
+#if SPINLOCK_MEASURE
+	spinlock_stats_register(&spin->stats, name);
+#else
+	(void)name;
+#endif
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static inline void spinlock_lock(struct spinlock* spin)
+{
+	uint32_t ticket = atomic_fetch_add(&spin->next_ticket, 1);
+	uint8_t contended = 0;
+	
+	// The barrier in atomic_read keeps the protected accesses after the lock is taken
+	while (atomic_read(&spin->serving) != ticket)
+	{
+		contended = 1;
+	}
+	
+#if SPINLOCK_MEASURE
+	spinlock_stats_aquired(&spin->stats, contended);
+#else
+	(void)contended;
+#endif
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static inline void spinlock_unlock(struct spinlock* spin)
+{
+#if SPINLOCK_MEASURE
+	spinlock_stats_released(&spin->stats);
+#endif
+	
+	// Only the holder writes the serving counter
+	atomic_write(&spin->serving, spin->serving + 1);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Masks the kernel interrupts before taking the lock. The returned state must be passed to
+// spinlock_release_irqrestore.
+
+uint32_t spinlock_aquire_irqsave(struct spinlock* spin)
+{
+	volatile uint32_t state;
+	
+	core_enter_critical_section(&state);
+	
+	spinlock_lock(spin);
+	
+	return state;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void spinlock_release_irqrestore(struct spinlock* spin, uint32_t state)
+{
+	volatile uint32_t saved_state = state;
+	
+	spinlock_unlock(spin);
+	
+	core_leave_critical_section(&saved_state);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void rwlock_init(struct rwlock* lock, const char* name)
+{
+	lock->state = 0;
+	
+#if SPINLOCK_MEASURE
+	spinlock_stats_register(&lock->stats, name);
+#else
+	(void)name;
+#endif
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Masks the kernel interrupts before taking the lock for reading. The returned state must be
+// passed to rwlock_read_release_irqrestore.
+
+uint32_t rwlock_read_aquire_irqsave(struct rwlock* lock)
+{
+	volatile uint32_t state;
+	
+	core_enter_critical_section(&state);
+	
+	rwlock_read_lock(lock);
+	
+	return state;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void rwlock_read_release_irqrestore(struct rwlock* lock, uint32_t state)
+{
+	volatile uint32_t saved_state = state;
+	
+	atomic_decrement(&lock->state);
+	
+	core_leave_critical_section(&saved_state);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+uint32_t rwlock_write_aquire_irqsave(struct rwlock* lock)
+{
+	volatile uint32_t state;
+	
+	core_enter_critical_section(&state);
+	
+	rwlock_write_lock(lock);
+	
+	return state;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void rwlock_write_release_irqrestore(struct rwlock* lock, uint32_t state)
+{
+	volatile uint32_t saved_state = state;
+	
+	rwlock_write_unlock(lock);
+	
+	core_leave_critical_section(&saved_state);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static inline void rwlock_read_lock(struct rwlock* lock)
+{
+	uint32_t state = lock->state;
+	uint8_t contended = 0;
+	
+	while (1)
+	{
+		if (state & (RWLOCK_WRITER | RWLOCK_WRITER_WAITING))
+		{
+			contended = 1;
+			state = atomic_read(&lock->state);
+		}
+		else if (atomic_compare_exchange(&lock->state, &state, state + 1))
+		{
+			break;
+		}
+	}
+	
+#if SPINLOCK_MEASURE
+	// The readers only count the acquisitions, since the hold times overlap
+	atomic_increment(&lock->stats.acquisitions);
+	
+	if (contended)
+	{
+		atomic_increment(&lock->stats.contended);
+	}
+#else
+	(void)contended;
+#endif
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// While readers hold the lock, the writer sets the waiting flag so that no new readers enter.
+// Several writers may set the flag. The one that gets the lock clears it, and the others set it
+// again on their next try.
+
+static inline void rwlock_write_lock(struct rwlock* lock)
+{
+	uint32_t state = lock->state;
+	uint8_t contended = 0;
+	
+	while (1)
+	{
+		if (state & RWLOCK_WRITER)
+		{
+			contended = 1;
+			state = atomic_read(&lock->state);
+		}
+		else if (state & RWLOCK_READER_MASK)
+		{
+			contended = 1;
+			
+			if ((state & RWLOCK_WRITER_WAITING) == 0)
+			{
+				atomic_compare_exchange(&lock->state, &state, state | RWLOCK_WRITER_WAITING);
+			}
+			
+			state = atomic_read(&lock->state);
+		}
+		else if (atomic_compare_exchange(&lock->state, &state, RWLOCK_WRITER))
 		{
-			// Spin
+			break;
 		}
-		
-		status = __STREXW(1, &(spin->lock));
-		
-	} while (status != 0);
+	}
 	
+#if SPINLOCK_MEASURE
+	spinlock_stats_aquired(&lock->stats, contended);
+#else
+	(void)contended;
+#endif
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static inline void rwlock_write_unlock(struct rwlock* lock)
+{
+#if SPINLOCK_MEASURE
+	spinlock_stats_released(&lock->stats);
+#endif
 	
-	// Do not start any other memory access until DMB has finished
-	__DMB();
+	atomic_fetch_and(&lock->state, ~RWLOCK_WRITER);
 }
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
-void spinlock_release(struct spinlock* spin)
+#if SPINLOCK_MEASURE
+
+
+struct spinlock_stats* spinlock_get_stats_list(void)
 {
-	__DMB();
+	return spinlock_stats_list;
+}
+
 
+//--------------------------------------------------------------------------------------------------//
 
-	spin->lock = 0;
+
+static void spinlock_stats_register(struct spinlock_stats* stats, const char* name)
+{
+	stats->name = name;
+	stats->acquisitions = 0;
+	stats->contended = 0;
+	stats->max_hold_cycles = 0;
+	stats->hold_start = 0;
+	stats->next = NULL;
+	
+	if (name == NULL)
+	{
+		return;
+	}
+	
+	CRITICAL_SECTION_ENTER();
+	
+	stats->next = spinlock_stats_list;
+	spinlock_stats_list = stats;
+	
+	CRITICAL_SECTION_LEAVE();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Called with the lock held, so the counters need no further protection
+
+static inline void spinlock_stats_aquired(struct spinlock_stats* stats, uint8_t contended)
+{
+	stats->acquisitions++;
+	
+	if (contended)
+	{
+		stats->contended++;
+	}
+	
+	stats->hold_start = DWT->CYCCNT;
 }
 
 
-//--------------------------------------------------------------------------------------------------//
\ No newline at end of file
+//--------------------------------------------------------------------------------------------------//
+
+
+static inline void spinlock_stats_released(struct spinlock_stats* stats)
+{
+	uint32_t cycles = DWT->CYCCNT - stats->hold_start;
+	
+	if (cycles > stats->max_hold_cycles)
+	{
+		stats->max_hold_cycles = cycles;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#endif
\ No newline at end of file
@@ -8,18 +8,146 @@
 #include "syscall.h"
 #include "board_serial.h"
 #include "kernel.h"
+#include "thread.h"
+#include "mutex.h"
+#include "semaphore.h"
+#include "message_queue.h"
 #include "gpio.h"
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
+#include <stddef.h>
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
 // Attribute for the SVC handler
 #define SYSCALL_NAKED __attribute__((naked))
 
 
-// Macro for calling the SVC handler with the specified SVC number
-#define SYSCALL(svc_number) asm volatile ("svc %[arg]" : : [arg] "I" (svc_number))
+// Macro for calling the SVC handler with the specified SVC number. The arguments are passed in
+// R0 to R3, and the service returns its result in R0. The kernel service is called as a normal
+// function, so R12 and LR are changed as well.
+#define SYSCALL(svc_number, argument_0, argument_1, argument_2, argument_3)								\
+({																										\
+	register uint32_t r0 asm("r0") = (uint32_t)(argument_0);											\
+	register uint32_t r1 asm("r1") = (uint32_t)(argument_1);											\
+	register uint32_t r2 asm("r2") = (uint32_t)(argument_2);											\
+	register uint32_t r3 asm("r3") = (uint32_t)(argument_3);											\
+	asm volatile ("svc %[arg]" : "+r" (r0), "+r" (r1), "+r" (r2), "+r" (r3) : [arg] "I" (svc_number) : "r12", "lr", "memory");	\
+	r0;																									\
+})
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Each argument of a service is checked by the SVC handler before the service runs. A value is
+// not checked. A pointer must point to RAM, while a constant may point to RAM or flash. A buffer
+// must be in RAM, with the number of bytes given in the argument number in the upper bits. A
+// constant buffer is only read by the service, and may also be in flash.
+
+#define SYSCALL_VALUE						0x00
+#define SYSCALL_POINTER						0x01
+#define SYSCALL_CONSTANT					0x02
+#define SYSCALL_BUFFER(size)				(0x10 | ((size) << 5))
+#define SYSCALL_CONSTANT_BUFFER(size)		(0x08 | ((size) << 5))
+
+#define SYSCALL_ARGUMENT_TYPE(x)	((x) & 0x1f)
+#define SYSCALL_ARGUMENT_SIZE(x)	((x) >> 5)
+
+
+// A service is called with the four argument registers, and returns its result in R0
+typedef uint32_t (*syscall_function)(uint32_t, uint32_t, uint32_t, uint32_t);
+
+struct syscall_service
+{
+	syscall_function	function;
+	uint8_t				arguments[4];
+};
+
+
+// Memory regions a service argument may point to
+struct syscall_region
+{
+	uint32_t	start_address;
+	uint32_t	end_address;
+	uint8_t		writable;
+};
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void kernel_service_handler(uint32_t* svc_argv);
+
+static uint32_t syscall_batch_run(struct syscall_request* requests, uint32_t count);
+
+static uint8_t syscall_check_arguments(const struct syscall_service* service, uint32_t* arguments);
+
+static uint8_t syscall_check_range(uint32_t address, uint32_t size, uint8_t writable);
+
+static const struct syscall_region* syscall_find_region(uint32_t address, uint8_t writable);
+
+static uint32_t syscall_service_delay(uint32_t ticks);
+
+static uint32_t syscall_service_print(char* data);
+
+static uint32_t syscall_service_gpio_status(Pio* port, uint32_t* reg);
+
+static struct thread_structure* syscall_service_thread_new(char* name, thread_function thread_func, void* parameter, uint32_t stack_size);
+
+static void* syscall_service_memory_new(Dynamic_memory_section memory_section, uint32_t size);
+
+static uint32_t syscall_service_queue_send(struct message_queue* queue, const void* message, uint32_t timeout);
+
+static uint32_t syscall_service_queue_receive(struct message_queue* queue, void* message, uint32_t timeout);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The service table is indexed by the service number. Services with up to four word sized
+// arguments are called directly, while the others go through a small service function.
+
+static const struct syscall_service syscall_services[SYSCALL_COUNT] =
+{
+	[SYSCALL_BATCH]				= { (syscall_function)syscall_batch_run,			{ SYSCALL_POINTER, SYSCALL_VALUE, SYSCALL_VALUE, SYSCALL_VALUE } },
+	[SYSCALL_DELAY]				= { (syscall_function)syscall_service_delay,		{ SYSCALL_VALUE, SYSCALL_VALUE, SYSCALL_VALUE, SYSCALL_VALUE } },
+	[SYSCALL_THREAD_NEW]		= { (syscall_function)syscall_service_thread_new,	{ SYSCALL_CONSTANT, SYSCALL_VALUE, SYSCALL_VALUE, SYSCALL_VALUE } },
+	[SYSCALL_THREAD_EXIT]		= { (syscall_function)thread_exit,					{ SYSCALL_VALUE, SYSCALL_VALUE, SYSCALL_VALUE, SYSCALL_VALUE } },
+	[SYSCALL_THREAD_JOIN]		= { (syscall_function)thread_join,					{ SYSCALL_POINTER, SYSCALL_VALUE, SYSCALL_VALUE, SYSCALL_VALUE } },
+	[SYSCALL_MUTEX_INIT]		= { (syscall_function)mutex_init,					{ SYSCALL_POINTER, SYSCALL_VALUE, SYSCALL_VALUE, SYSCALL_VALUE } },
+	[SYSCALL_MUTEX_LOCK]		= { (syscall_function)mutex_lock_timeout,			{ SYSCALL_POINTER, SYSCALL_VALUE, SYSCALL_VALUE, SYSCALL_VALUE } },
+	[SYSCALL_MUTEX_UNLOCK]		= { (syscall_function)mutex_unlock,					{ SYSCALL_POINTER, SYSCALL_VALUE, SYSCALL_VALUE, SYSCALL_VALUE } },
+	[SYSCALL_SEMAPHORE_INIT]	= { (syscall_function)semaphore_init,				{ SYSCALL_POINTER, SYSCALL_VALUE, SYSCALL_VALUE, SYSCALL_VALUE } },
+	[SYSCALL_SEMAPHORE_TAKE]	= { (syscall_function)semaphore_take,				{ SYSCALL_POINTER, SYSCALL_VALUE, SYSCALL_VALUE, SYSCALL_VALUE } },
+	[SYSCALL_PRINT]				= { (syscall_function)syscall_service_print,		{ SYSCALL_CONSTANT, SYSCALL_VALUE, SYSCALL_VALUE, SYSCALL_VALUE } },
+	[SYSCALL_GPIO_STATUS]		= { (syscall_function)syscall_service_gpio_status,	{ SYSCALL_VALUE, SYSCALL_POINTER, SYSCALL_VALUE, SYSCALL_VALUE } },
+	[SYSCALL_SEMAPHORE_GIVE]	= { (syscall_function)semaphore_give,				{ SYSCALL_POINTER, SYSCALL_VALUE, SYSCALL_VALUE, SYSCALL_VALUE } },
+	[SYSCALL_QUEUE_NEW]			= { (syscall_function)message_queue_new,			{ SYSCALL_VALUE, SYSCALL_VALUE, SYSCALL_VALUE, SYSCALL_VALUE } },
+	[SYSCALL_QUEUE_DELETE]		= { (syscall_function)message_queue_delete,			{ SYSCALL_POINTER, SYSCALL_VALUE, SYSCALL_VALUE, SYSCALL_VALUE } },
+	[SYSCALL_QUEUE_SEND]		= { (syscall_function)syscall_service_queue_send,	{ SYSCALL_POINTER, SYSCALL_CONSTANT, SYSCALL_VALUE, SYSCALL_VALUE } },
+	[SYSCALL_QUEUE_RECEIVE]		= { (syscall_function)syscall_service_queue_receive,	{ SYSCALL_POINTER, SYSCALL_POINTER, SYSCALL_VALUE, SYSCALL_VALUE } },
+	[SYSCALL_FILE_OPEN]			= { (syscall_function)file_open,					{ SYSCALL_POINTER, SYSCALL_CONSTANT, SYSCALL_VALUE, SYSCALL_VALUE } },
+	[SYSCALL_FILE_CLOSE]		= { (syscall_function)file_close,					{ SYSCALL_POINTER, SYSCALL_VALUE, SYSCALL_VALUE, SYSCALL_VALUE } },
+	[SYSCALL_FILE_READ]			= { (syscall_function)file_read,					{ SYSCALL_POINTER, SYSCALL_BUFFER(2), SYSCALL_VALUE, SYSCALL_POINTER } },
+	[SYSCALL_FILE_WRITE]		= { (syscall_function)file_write,					{ SYSCALL_POINTER, SYSCALL_CONSTANT_BUFFER(2), SYSCALL_VALUE, SYSCALL_POINTER } },
+	[SYSCALL_MEMORY_NEW]		= { (syscall_function)syscall_service_memory_new,	{ SYSCALL_VALUE, SYSCALL_VALUE, SYSCALL_VALUE, SYSCALL_VALUE } },
+	[SYSCALL_MEMORY_FREE]		= { (syscall_function)dynamic_memory_free,			{ SYSCALL_POINTER, SYSCALL_VALUE, SYSCALL_VALUE, SYSCALL_VALUE } }
+};
+
+
+// Internal SRAM, the SDRAM and the internal flash
+static const struct syscall_region syscall_regions[] =
+{
+	{ 0x20400000, 0x2045FFFF, 1 },
+	{ 0x70000000, 0x700FFFFF, 1 },
+	{ 0x00400000, 0x005FFFFF, 0 }
+};
 
 
 //--------------------------------------------------------------------------------------------------//
@@ -27,7 +155,7 @@
 
 void SYSCALL_NOINLINE syscall_print(char* data)
 {
-	SYSCALL(SYSCALL_PRINT);
+	SYSCALL(SYSCALL_PRINT, data, 0, 0, 0);
 }
 
 
@@ -36,7 +164,7 @@ void SYSCALL_NOINLINE syscall_print(char* data)
 
 void SYSCALL_NOINLINE syscall_sleep(uint32_t ticks)
 {
-	SYSCALL(SYSCALL_DELAY);
+	SYSCALL(SYSCALL_DELAY, ticks, 0, 0, 0);
 }
 
 
@@ -45,36 +173,447 @@ void SYSCALL_NOINLINE syscall_sleep(uint32_t ticks)
 
 void SYSCALL_NOINLINE syscall_gpio_status(Pio* port, uint32_t* reg)
 {
-	SYSCALL(SYSCALL_GPIO_STATUS);
+	SYSCALL(SYSCALL_GPIO_STATUS, port, reg, 0, 0);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Makes a joinable thread on the normal priority level. The thread must be joined with
+// syscall_thread_join to free its memory.
+
+struct thread_structure* SYSCALL_NOINLINE syscall_thread_new(char* name, thread_function thread_func, void* parameter, uint32_t stack_size)
+{
+	return (struct thread_structure *)SYSCALL(SYSCALL_THREAD_NEW, name, thread_func, parameter, stack_size);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void SYSCALL_NOINLINE syscall_thread_exit(int32_t exit_code)
+{
+	SYSCALL(SYSCALL_THREAD_EXIT, exit_code, 0, 0, 0);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+int32_t SYSCALL_NOINLINE syscall_thread_join(struct thread_structure* thread)
+{
+	return (int32_t)SYSCALL(SYSCALL_THREAD_JOIN, thread, 0, 0, 0);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void SYSCALL_NOINLINE syscall_mutex_init(struct mutex* mutex)
+{
+	SYSCALL(SYSCALL_MUTEX_INIT, mutex, 0, 0, 0);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+uint8_t SYSCALL_NOINLINE syscall_mutex_lock(struct mutex* mutex, uint32_t timeout)
+{
+	return (uint8_t)SYSCALL(SYSCALL_MUTEX_LOCK, mutex, timeout, 0, 0);
 }
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
-// The kernel services runs in from an interrupt handler with low priority
-// (lowest of the cortex-m7 implemented interrupts) and should therefore execute
-// as fast as possible. If a service takes long to execute, it will destroy
-// the system, and the kernel functionality
+void SYSCALL_NOINLINE syscall_mutex_unlock(struct mutex* mutex)
+{
+	SYSCALL(SYSCALL_MUTEX_UNLOCK, mutex, 0, 0, 0);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void SYSCALL_NOINLINE syscall_semaphore_init(struct semaphore* semaphore, uint32_t count)
+{
+	SYSCALL(SYSCALL_SEMAPHORE_INIT, semaphore, count, 0, 0);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+uint8_t SYSCALL_NOINLINE syscall_semaphore_take(struct semaphore* semaphore, uint32_t timeout)
+{
+	return (uint8_t)SYSCALL(SYSCALL_SEMAPHORE_TAKE, semaphore, timeout, 0, 0);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void SYSCALL_NOINLINE syscall_semaphore_give(struct semaphore* semaphore)
+{
+	SYSCALL(SYSCALL_SEMAPHORE_GIVE, semaphore, 0, 0, 0);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+struct message_queue* SYSCALL_NOINLINE syscall_queue_new(uint32_t slot_size, uint32_t slot_count, uint8_t mode)
+{
+	return (struct message_queue *)SYSCALL(SYSCALL_QUEUE_NEW, slot_size, slot_count, mode, 0);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void SYSCALL_NOINLINE syscall_queue_delete(struct message_queue* queue)
+{
+	SYSCALL(SYSCALL_QUEUE_DELETE, queue, 0, 0, 0);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+uint8_t SYSCALL_NOINLINE syscall_queue_send(struct message_queue* queue, const void* message, uint32_t timeout)
+{
+	return (uint8_t)SYSCALL(SYSCALL_QUEUE_SEND, queue, message, timeout, 0);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+uint8_t SYSCALL_NOINLINE syscall_queue_receive(struct message_queue* queue, void* message, uint32_t timeout)
+{
+	return (uint8_t)SYSCALL(SYSCALL_QUEUE_RECEIVE, queue, message, timeout, 0);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+FRESULT SYSCALL_NOINLINE syscall_file_open(FIL* file, const char* path, uint8_t mode)
+{
+	return (FRESULT)SYSCALL(SYSCALL_FILE_OPEN, file, path, mode, 0);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+FRESULT SYSCALL_NOINLINE syscall_file_close(FIL* file)
+{
+	return (FRESULT)SYSCALL(SYSCALL_FILE_CLOSE, file, 0, 0, 0);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+FRESULT SYSCALL_NOINLINE syscall_file_read(FIL* file, void* buffer, uint32_t size, uint32_t* bytes_read)
+{
+	return (FRESULT)SYSCALL(SYSCALL_FILE_READ, file, buffer, size, bytes_read);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+FRESULT SYSCALL_NOINLINE syscall_file_write(FIL* file, const void* buffer, uint32_t size, uint32_t* bytes_written)
+{
+	return (FRESULT)SYSCALL(SYSCALL_FILE_WRITE, file, buffer, size, bytes_written);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void* SYSCALL_NOINLINE syscall_memory_new(Dynamic_memory_section memory_section, uint32_t size)
+{
+	return (void *)SYSCALL(SYSCALL_MEMORY_NEW, memory_section, size, 0, 0);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void SYSCALL_NOINLINE syscall_memory_free(void* memory)
+{
+	SYSCALL(SYSCALL_MEMORY_FREE, memory, 0, 0, 0);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Runs a list of service requests with a single SVC call. The requests run in order, and each
+// result is stored in the request. Returns the number of requests that were run. This is less
+// than the count if a request had invalid arguments, and the result of that request is set to
+// SYSCALL_ERROR.
+
+uint32_t SYSCALL_NOINLINE syscall_batch(struct syscall_request* requests, uint32_t count)
+{
+	return SYSCALL(SYSCALL_BATCH, requests, count, 0, 0);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The SVC handler only checks the request and sets up the service call, so it runs in constant
+// time. The stacked PC is changed to the service function, and the stacked LR to the instruction
+// after the SVC. When the exception returns, the service runs in the calling thread like any
+// function called from the service stub, and returns to the stub with the result in R0. A service
+// may therefore block, and the SVC priority does not matter.
 
 void kernel_service_handler(uint32_t* svc_argv)
 {
 	// Extract the SVC number from the parameter list
-	uint32_t svc_number = ((char *)svc_argv[6])[-2];
+	uint32_t svc_number = ((uint8_t *)svc_argv[6])[-2];
+	
+	if ((svc_number >= SYSCALL_COUNT) || (syscall_services[svc_number].function == NULL))
+	{
+		svc_argv[0] = SYSCALL_ERROR;
+		return;
+	}
+	
+	const struct syscall_service* service = &syscall_services[svc_number];
+	
+	if (syscall_check_arguments(service, svc_argv) == 0)
+	{
+		svc_argv[0] = SYSCALL_ERROR;
+		return;
+	}
+	
+	// Return to the stub in Thumb state, and start the service on a halfword aligned address
+	svc_argv[5] = svc_argv[6] | 1;
+	svc_argv[6] = (uint32_t)service->function & ~1;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Runs in the calling thread like the other services. The request list is checked here, since the
+// SVC handler only knows the address of it. The count is compared with the number of requests
+// that fit in the region, since the size of the list in bytes could overflow.
+
+static uint32_t syscall_batch_run(struct syscall_request* requests, uint32_t count)
+{
+	const struct syscall_region* region = syscall_find_region((uint32_t)requests, 1);
+	
+	if ((region == NULL) || (count > ((region->end_address - (uint32_t)requests + 1) / sizeof(struct syscall_request))))
+	{
+		return 0;
+	}
+	
+	for (uint32_t i = 0; i < count; i++)
+	{
+		struct syscall_request* request = &requests[i];
+		
+		// A batch can not run another batch
+		if ((request->service == SYSCALL_BATCH) || (request->service >= SYSCALL_COUNT))
+		{
+			request->result = SYSCALL_ERROR;
+			return i;
+		}
+		
+		const struct syscall_service* service = &syscall_services[request->service];
+		
+		if ((service->function == NULL) || (syscall_check_arguments(service, request->arguments) == 0))
+		{
+			request->result = SYSCALL_ERROR;
+			return i;
+		}
+		
+		request->result = service->function(request->arguments[0], request->arguments[1], request->arguments[2], request->arguments[3]);
+	}
+	
+	return count;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
 
-	switch (svc_number)
+static uint8_t syscall_check_arguments(const struct syscall_service* service, uint32_t* arguments)
+{
+	for (uint32_t i = 0; i < 4; i++)
 	{
-		case SYSCALL_DELAY:
-			thread_delay((uint32_t)svc_argv[0]);
-			break;
+		uint8_t type = SYSCALL_ARGUMENT_TYPE(service->arguments[i]);
 		
-		case SYSCALL_PRINT:
-			board_serial_print((char*)svc_argv[0]);
-			break;
-		case SYSCALL_GPIO_STATUS:
-			*((uint32_t *)svc_argv[1]) = gpio_get_pin_value_status_register((Pio *)svc_argv[0]);
-			break;
+		if (type == SYSCALL_POINTER)
+		{
+			if (syscall_check_range(arguments[i], 1, 1) == 0)
+			{
+				return 0;
+			}
+		}
+		else if (type == SYSCALL_CONSTANT)
+		{
+			if (syscall_check_range(arguments[i], 1, 0) == 0)
+			{
+				return 0;
+			}
+		}
+		else if (type == SYSCALL_ARGUMENT_TYPE(SYSCALL_BUFFER(0)))
+		{
+			if (syscall_check_range(arguments[i], arguments[SYSCALL_ARGUMENT_SIZE(service->arguments[i])], 1) == 0)
+			{
+				return 0;
+			}
+		}
+		else if (type == SYSCALL_ARGUMENT_TYPE(SYSCALL_CONSTANT_BUFFER(0)))
+		{
+			if (syscall_check_range(arguments[i], arguments[SYSCALL_ARGUMENT_SIZE(service->arguments[i])], 0) == 0)
+			{
+				return 0;
+			}
+		}
+	}
+	
+	return 1;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Returns 1 if the address range lies within one memory region. A read only range may also be in
+// flash.
+
+static uint8_t syscall_check_range(uint32_t address, uint32_t size, uint8_t writable)
+{
+	const struct syscall_region* region = syscall_find_region(address, writable);
+	
+	if (region == NULL)
+	{
+		return 0;
+	}
+	
+	// The end of the range is compared without overflowing
+	return (size <= (region->end_address - address + 1));
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Returns the memory region holding the address, or NULL. Flash is skipped for a writable address.
+
+static const struct syscall_region* syscall_find_region(uint32_t address, uint8_t writable)
+{
+	for (uint32_t i = 0; i < (sizeof(syscall_regions) / sizeof(struct syscall_region)); i++)
+	{
+		const struct syscall_region* region = &syscall_regions[i];
+		
+		if (writable && (region->writable == 0))
+		{
+			continue;
+		}
+		
+		if ((address >= region->start_address) && (address <= region->end_address))
+		{
+			return region;
+		}
+	}
+	
+	return NULL;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static uint32_t syscall_service_delay(uint32_t ticks)
+{
+	thread_delay(ticks);
+	
+	return 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static uint32_t syscall_service_print(char* data)
+{
+	board_serial_print(data);
+	
+	return 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static uint32_t syscall_service_gpio_status(Pio* port, uint32_t* reg)
+{
+	*reg = gpio_get_pin_value_status_register(port);
+	
+	return 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static struct thread_structure* syscall_service_thread_new(char* name, thread_function thread_func, void* parameter, uint32_t stack_size)
+{
+	return thread_new_joinable(name, thread_func, parameter, THREAD_PRIORITY_NORMAL, stack_size);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void* syscall_service_memory_new(Dynamic_memory_section memory_section, uint32_t size)
+{
+	if (memory_section > DRAM_BANK_1)
+	{
+		return NULL;
+	}
+	
+	return dynamic_memory_new(memory_section, size);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The message size is given by the queue, so the message is checked here after the queue. The
+// queue itself must be in RAM before its slot size is read.
+
+static uint32_t syscall_service_queue_send(struct message_queue* queue, const void* message, uint32_t timeout)
+{
+	if ((syscall_check_range((uint32_t)queue, sizeof(struct message_queue), 1) == 0) || (syscall_check_range((uint32_t)message, queue->slot_size, 0) == 0))
+	{
+		return SYSCALL_ERROR;
+	}
+	
+	return message_queue_send(queue, message, timeout);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static uint32_t syscall_service_queue_receive(struct message_queue* queue, void* message, uint32_t timeout)
+{
+	if ((syscall_check_range((uint32_t)queue, sizeof(struct message_queue), 1) == 0) || (syscall_check_range((uint32_t)message, queue->slot_size, 1) == 0))
+	{
+		return SYSCALL_ERROR;
 	}
+	
+	return message_queue_receive(queue, message, timeout);
 }
 
 
@@ -10,6 +10,12 @@
 #include "critical_section.h"
 #include "check.h"
 #include "interrupt.h"
+#include "software_timer.h"
+#include "work_queue.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include "kernel_time.h"
+#include "cache.h"
 
 
 //--------------------------------------------------------------------------------------------------//
@@ -27,12 +33,37 @@ extern struct scheduler_info scheduler;
 //--------------------------------------------------------------------------------------------------//
 
 
+// Threads that have exited are placed in the zombie list. The reaper thread runs on the lowest
+// priority level, and frees the memory of the zombies. The reaper blocks in the wait list when
+// the zombie list is empty.
+
+struct thread_reaper
+{
+	list_s						zombie_list;
+	list_s						wait_list;
+	
+	struct thread_structure*	thread;
+};
+
+
+static struct thread_reaper reaper;
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
 uint32_t* thread_stack_init(uint32_t* stack_pointer, thread_function thread_func, void* param);
 
 static void round_robin_idle_thread(void* param);
 
 static void kernel_delete_thread(void);
 
+static void thread_reaper(void* param);
+
+static void thread_stack_scan(void);
+
+static struct thread_structure* thread_make(char* thread_name, thread_function thread_func, void* thread_parameter, enum thread_priority priority, uint32_t stack_size, struct thread_real_time* real_time, uint8_t joinable, thread_function cleanup, void* cleanup_parameter);
+
 
 //--------------------------------------------------------------------------------------------------//
 
@@ -42,8 +73,23 @@ void thread_config(void)
 	// Interrupt should already be enabled
 	interrupt_global_disable();
 	
+	// Allocate the thread structure and stack pools
+	thread_pool_config();
+	
 	// Add the idle thread on priority level 7 (lowest)
 	thread_new("Idle", round_robin_idle_thread, NULL, THREAD_PRIORITY_NORMAL, KERNEL_IDLE_THREAD_STACK_SIZE);
+	
+	// Start the reaper thread freeing the threads that have exited
+	reaper.thread = thread_new("Reaper", thread_reaper, NULL, KERNEL_REAPER_THREAD_PRIORITY, KERNEL_REAPER_THREAD_STACK_SIZE);
+	
+	// Start the software timer service
+	software_timer_config();
+	
+	// Start the system work queue
+	work_queue_config();
+	
+	// Start the high resolution kernel clock
+	kernel_time_config();
 }
 
 
@@ -52,29 +98,113 @@ void thread_config(void)
 
 struct thread_structure* thread_new(char* thread_name, thread_function thread_func, void* thread_parameter, enum thread_priority priority, uint32_t stack_size)
 {
-	// We do NOT want any scheduler interrupting inside here
-	suspend_scheduler();
+	return thread_make(thread_name, thread_func, thread_parameter, priority, stack_size, NULL, 0, NULL, NULL);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Makes a thread that is kept after it exits, until another thread has called thread_join on it.
+// Every joinable thread must be joined exactly once, or its memory is never freed.
+
+struct thread_structure* thread_new_joinable(char* thread_name, thread_function thread_func, void* thread_parameter, enum thread_priority priority, uint32_t stack_size)
+{
+	return thread_make(thread_name, thread_func, thread_parameter, priority, stack_size, NULL, 1, NULL, NULL);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Makes a thread with a function to be called by the reaper thread when the thread has exited,
+// before its memory is freed. This can be used to free resources owned by the thread, like the
+// code of a loaded program. The cleanup function runs in the reaper thread and may block. It is
+// set before the thread is placed in the running queue, so it is in place even if the thread
+// exits right away.
+
+struct thread_structure* thread_new_with_cleanup(char* thread_name, thread_function thread_func, void* thread_parameter, enum thread_priority priority, uint32_t stack_size, thread_function cleanup, void* cleanup_parameter)
+{
+	return thread_make(thread_name, thread_func, thread_parameter, priority, stack_size, NULL, 0, cleanup, cleanup_parameter);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Makes a periodic real time thread. The period, budget and relative deadline are given in
+// microseconds, and a deadline of zero is the same as the period. The thread function must call
+// thread_wait_period at the end of every job. Returns NULL if the parameters are invalid, or if
+// the admission control finds that the real time threads would no longer be schedulable.
+
+struct thread_structure* thread_new_periodic(char* thread_name, thread_function thread_func, void* thread_parameter, uint32_t stack_size, uint32_t period, uint32_t budget, uint32_t deadline)
+{
+	struct thread_real_time real_time = { 0 };
 	
-	// First we have to allocate memory for the thread and
-	// for the stack that is going to be used by that thread
-	struct thread_structure* new_thread = (struct thread_structure*)dynamic_memory_new(DRAM_BANK_0, sizeof(struct thread_structure) + stack_size * sizeof(uint32_t));
+	if (deadline == 0)
+	{
+		deadline = period;
+	}
+	
+	if ((budget == 0) || (budget > deadline) || (deadline > period))
+	{
+		return NULL;
+	}
+	
+	real_time.period = period;
+	real_time.budget = budget;
+	real_time.deadline = deadline;
+	
+	if (scheduler_real_time_admit(&real_time) == 0)
+	{
+		return NULL;
+	}
 	
-	// Allocate the stack
-	new_thread->stack_base = (uint32_t *)((uint8_t *)new_thread + sizeof(struct thread_structure));
+	struct thread_structure* thread = thread_make(thread_name, thread_func, thread_parameter, THREAD_PRIORITY_REAL_TIME, stack_size, &real_time, 0, NULL, NULL);
 	
+	if (thread == NULL)
+	{
+		scheduler_real_time_remove(&real_time);
+	}
+	
+	return thread;
+}
+
 
-	if ((new_thread == NULL) || (new_thread->stack_base == NULL))
+//--------------------------------------------------------------------------------------------------//
+
+
+static struct thread_structure* thread_make(char* thread_name, thread_function thread_func, void* thread_parameter, enum thread_priority priority, uint32_t stack_size, struct thread_real_time* real_time, uint8_t joinable, thread_function cleanup, void* cleanup_parameter)
+{
+	// We do NOT want any scheduler interrupting inside here
+	suspend_scheduler();
+	
+	// First we have to allocate memory for the thread and for the stack that is going to be used
+	// by that thread. The stack size may be rounded up to the size of a pooled stack.
+	struct thread_structure* new_thread = thread_pool_new(stack_size);
+	
+	if (new_thread == NULL)
 	{
 		// Allocation failed
 		check(0);
+		resume_scheduler();
 		return NULL;
 	}
 	
+	stack_size = new_thread->stack_size / sizeof(uint32_t);
+	
+	// Paint the stack so that the peak usage can be found later
+	for (uint32_t i = 0; i < stack_size; i++)
+	{
+		new_thread->stack_base[i] = KERNEL_STACK_PAINT_PATTERN;
+	}
+	
 	// Get the stack pointer to point to top of stack
 	new_thread->stack_pointer = new_thread->stack_base + stack_size - 1;
 	
 	// Initialize the stack
 	new_thread->stack_pointer = thread_stack_init(new_thread->stack_pointer, thread_func, thread_parameter);
+	new_thread->stack_watermark = new_thread->stack_pointer;
 	
 	// Set the thread name
 	for (uint32_t i = 0; i < KERNEL_THREAD_MAX_NAME_LENGTH; i++)
@@ -89,8 +219,21 @@ struct thread_structure* thread_new(char* thread_name, thread_function thread_fu
 	
 	// Set the thread priority
 	new_thread->priority = priority;
+	new_thread->base_priority = priority;
 	new_thread->state = THREAD_STATE_RUNNING;
-	new_thread->stack_size = 4 * stack_size;
+	new_thread->joinable = joinable;
+	new_thread->cleanup = cleanup;
+	new_thread->cleanup_parameter = cleanup_parameter;
+	
+	// The first job of a real time thread is released right away
+	if (real_time != NULL)
+	{
+		new_thread->real_time = *real_time;
+		new_thread->real_time.release = scheduler.tick;
+		new_thread->real_time.absolute_deadline = scheduler.tick + real_time->deadline;
+	}
+	
+	TRACE(TRACE_EVENT_THREAD_NEW, TRACE_REASON_NONE, new_thread, priority);
 	
 	
 	// The first thread to be made is the IDLE thread
@@ -103,21 +246,26 @@ struct thread_structure* thread_new(char* thread_name, thread_function thread_fu
 	}
 	else
 	{
-		new_thread->current_list = &scheduler.running_queue;
+		new_thread->current_list = &scheduler.running_queue[priority];
 		new_thread->next_list = NULL;
 		new_thread->list_node.object = new_thread;
 		new_thread->thread_list.object = new_thread;
+		new_thread->wait_node.object = new_thread;
+		
+		// Suspending the scheduler does not mask the interrupts, and an interrupt may wake a
+		// thread into the running queue at any time
+		CRITICAL_SECTION_ENTER();
 		
-		list_insert_first(&(new_thread->list_node), &scheduler.running_queue);
+		scheduler_running_queue_insert(new_thread);
 		list_insert_first(&(new_thread->thread_list), &scheduler.threads);
+		
+		CRITICAL_SECTION_LEAVE();
 	}
 	
-	//cache_clean_addresses((uint32_t *)new_thread, sizeof(thread_s));
-	//cache_clean_addresses((uint32_t *)new_thread->stack_base, stack_size);
-	
-	SCB_CleanDCache();
-	__DSB();
-	__ISB();
+	// Only the thread structure and the initial stack frame have to be written back. The rest of
+	// the stack only holds the paint pattern.
+	cache_clean_addresses((uint32_t *)new_thread, sizeof(struct thread_structure));
+	cache_clean_addresses(new_thread->stack_pointer, (uint32_t)(new_thread->stack_base + stack_size) - (uint32_t)new_thread->stack_pointer);
 	
 	resume_scheduler();
 	
@@ -162,6 +310,133 @@ uint32_t* thread_stack_init(uint32_t* stack_pointer, thread_function thread_func
 //--------------------------------------------------------------------------------------------------//
 
 
+// Ends the current thread. The exit code can be read by thread_join if the thread is joinable.
+
+void thread_exit(int32_t exit_code)
+{
+	scheduler.current_thread->exit_code = exit_code;
+	
+	kernel_delete_thread();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Waits for a joinable thread to exit, and returns its exit code. A thread returning from its
+// thread function has exit code zero. Afterwards the thread is handed to the reaper, and must not
+// be used anymore. This must not be called from interrupt context.
+
+int32_t thread_join(struct thread_structure* thread)
+{
+	uint8_t blocked = 0;
+	
+	// Only one thread can join a thread
+	check(thread->joinable);
+	check(thread->join_list.size == 0);
+	
+	CRITICAL_SECTION_ENTER();
+	
+	if (thread->state != THREAD_STATE_ZOMBIE)
+	{
+		scheduler_block_current_thread(&thread->join_list, THREAD_WAIT_FOREVER);
+		blocked = 1;
+	}
+	
+	CRITICAL_SECTION_LEAVE();
+	
+	if (blocked)
+	{
+		reschedule();
+	}
+	
+	int32_t exit_code = thread->exit_code;
+	
+	CRITICAL_SECTION_ENTER();
+	
+	thread_reaper_insert(thread);
+	
+	CRITICAL_SECTION_LEAVE();
+	
+	return exit_code;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Places a zombie thread in the zombie list and wakes the reaper. This is called from the
+// scheduler when a thread exits, and must otherwise be called inside a critical section. The
+// reaper might not have blocked yet. In that case it is simply kept in the running queue.
+
+void thread_reaper_insert(struct thread_structure* thread)
+{
+	struct thread_structure* reaper_thread = reaper.thread;
+	
+	list_insert_last(&(thread->list_node), &reaper.zombie_list);
+	
+	if (reaper_thread->next_list == &reaper.wait_list)
+	{
+		reaper_thread->next_list = NULL;
+	}
+	else if (reaper.wait_list.size != 0)
+	{
+		list_remove_item(&(reaper_thread->list_node), &reaper.wait_list);
+		
+		scheduler_running_queue_insert(reaper_thread);
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The reaper thread frees the zombies one at a time. The cleanup function and the free run
+// outside the critical section, so the time spent in the heap does not delay any interrupt.
+
+static void thread_reaper(void* param)
+{
+	while (1)
+	{
+		struct thread_structure* zombie = NULL;
+		
+		CRITICAL_SECTION_ENTER();
+		
+		if (reaper.zombie_list.first != NULL)
+		{
+			zombie = (struct thread_structure *)(reaper.zombie_list.first->object);
+			
+			list_remove_first(&reaper.zombie_list);
+		}
+		else
+		{
+			// The thread is blocked in the same critical section as the zombie list is checked,
+			// so a zombie can not be missed
+			scheduler_current_thread_to_queue(&reaper.wait_list);
+		}
+		
+		CRITICAL_SECTION_LEAVE();
+		
+		if (zombie != NULL)
+		{
+			if (zombie->cleanup != NULL)
+			{
+				zombie->cleanup(zombie->cleanup_parameter);
+			}
+			
+			thread_pool_free(zombie);
+		}
+		else
+		{
+			reschedule();
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
 static void kernel_delete_thread(void)
 {
 	scheduler.current_thread->state = THREAD_STATE_EXIT_PENDING;
@@ -182,9 +457,87 @@ static void round_robin_idle_thread(void* param)
 {
 	while (1)
 	{
-		// The idle thread should not do anything
+		thread_stack_scan();
+		
+		// Sleep until the next interrupt, which in tickless mode is the
+		// next delay expiry
+		__WFI();
 	}
 }
 
 
+//--------------------------------------------------------------------------------------------------//
+
+
+// Incremental stack scanner run by the idle thread. The words below the watermark of a stack have
+// been checked to still hold the paint pattern. Each call checks a few more of them, starting from
+// the stack base. If an overwritten word is found, the thread has used more stack than before and
+// the watermark is moved down. When the scan reaches the watermark it moves on to the next thread.
+// The scan runs in a critical section, so that the thread can not be deleted in between.
+
+static void thread_stack_scan(void)
+{
+	CRITICAL_SECTION_ENTER();
+	
+	struct thread_structure* thread = scheduler.stack_scan_thread;
+	
+	if (thread == NULL)
+	{
+		if (scheduler.threads.first != NULL)
+		{
+			thread = (struct thread_structure *)(scheduler.threads.first->object);
+			
+			scheduler.stack_scan_thread = thread;
+			scheduler.stack_scan_position = thread->stack_base;
+		}
+	}
+	
+	if (thread != NULL)
+	{
+		uint32_t* position = scheduler.stack_scan_position;
+		
+		for (uint32_t i = 0; i < KERNEL_STACK_SCAN_WORDS; i++)
+		{
+			if (position >= thread->stack_watermark)
+			{
+				// Scan the next thread in the thread list
+				if (thread->thread_list.next != NULL)
+				{
+					scheduler.stack_scan_thread = (struct thread_structure *)(thread->thread_list.next->object);
+				}
+				else
+				{
+					scheduler.stack_scan_thread = NULL;
+				}
+				
+				break;
+			}
+			
+			if (*position != KERNEL_STACK_PAINT_PATTERN)
+			{
+				// New peak. Scan the remaining words from the base again next time
+				thread->stack_watermark = position;
+				position = thread->stack_base;
+				
+				break;
+			}
+			
+			position++;
+		}
+		
+		if (scheduler.stack_scan_thread != NULL)
+		{
+			if (scheduler.stack_scan_thread != thread)
+			{
+				position = scheduler.stack_scan_thread->stack_base;
+			}
+			
+			scheduler.stack_scan_position = position;
+		}
+	}
+	
+	CRITICAL_SECTION_LEAVE();
+}
+
+
 //--------------------------------------------------------------------------------------------------//
\ No newline at end of file
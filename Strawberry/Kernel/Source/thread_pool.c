@@ -0,0 +1,202 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#include "thread_pool.h"
+#include "dynamic_memory.h"
+#include "slab.h"
+#include "critical_section.h"
+#include "check.h"
+#include "config.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include <stddef.h>
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#define THREAD_STACK_POOL_COUNT		(sizeof(thread_stack_pool_sizes) / sizeof(uint32_t))
+
+
+static const uint32_t thread_stack_pool_sizes[] = KERNEL_STACK_POOL_SIZES;
+static const uint32_t thread_stack_pool_counts[] = KERNEL_STACK_POOL_COUNTS;
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static struct slab_cache thread_cache;
+
+static struct thread_stack_pool thread_stack_pools[THREAD_STACK_POOL_COUNT];
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static inline uint32_t* thread_pool_stack_new(uint32_t* stack_size);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Makes the thread cache and allocates the stack pools. This is done once from thread_config
+// before any thread is made.
+
+void thread_pool_config(void)
+{
+	slab_cache_init(&thread_cache, "Thread", DRAM_BANK_0, sizeof(struct thread_structure), 8, KERNEL_THREAD_SLAB_SIZE);
+	
+	// Fill the first slab up front, so that the first threads are made without the dynamic memory
+	if (slab_cache_reserve(&thread_cache, KERNEL_THREAD_SLAB_SIZE) == 0)
+	{
+		check(0);
+	}
+	
+	for (uint32_t i = 0; i < THREAD_STACK_POOL_COUNT; i++)
+	{
+		struct thread_stack_pool* pool = &thread_stack_pools[i];
+		
+		pool->stack_size = thread_stack_pool_sizes[i];
+		pool->start = (uint32_t *)dynamic_memory_new(DRAM_BANK_0, thread_stack_pool_counts[i] * pool->stack_size * sizeof(uint32_t));
+		
+		check(pool->start != NULL);
+		
+		pool->end = pool->start;
+		
+		if (pool->start != NULL)
+		{
+			pool->end = pool->start + thread_stack_pool_counts[i] * pool->stack_size;
+			
+			for (uint32_t* stack = pool->start; stack < pool->end; stack += pool->stack_size)
+			{
+				*stack = (uint32_t)pool->free_list;
+				pool->free_list = stack;
+			}
+			
+			pool->free_count = thread_stack_pool_counts[i];
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Returns a cleared thread structure with a stack of at least stack_size words. The stack base and
+// the actual stack size in bytes are set. The stack content is not initialized.
+
+struct thread_structure* thread_pool_new(uint32_t stack_size)
+{
+	struct thread_structure* thread = (struct thread_structure *)slab_new(&thread_cache);
+	
+	if (thread == NULL)
+	{
+		return NULL;
+	}
+	
+	uint32_t* stack = thread_pool_stack_new(&stack_size);
+	
+	if (stack == NULL)
+	{
+		thread_pool_free(thread);
+		return NULL;
+	}
+	
+	thread->stack_base = stack;
+	thread->stack_size = stack_size * sizeof(uint32_t);
+	
+	return thread;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Gives the memory of a deleted thread back to the pools. This is called by the reaper thread once
+// the thread has exited, and when thread_pool_new fails halfway. A stack outside the pools is
+// given back to the heap.
+
+void thread_pool_free(struct thread_structure* thread)
+{
+	uint32_t* stack = thread->stack_base;
+	
+	if (stack != NULL)
+	{
+		struct thread_stack_pool* pool = NULL;
+		
+		for (uint32_t i = 0; i < THREAD_STACK_POOL_COUNT; i++)
+		{
+			if ((stack >= thread_stack_pools[i].start) && (stack < thread_stack_pools[i].end))
+			{
+				pool = &thread_stack_pools[i];
+				break;
+			}
+		}
+		
+		if (pool != NULL)
+		{
+			CRITICAL_SECTION_ENTER();
+			
+			*stack = (uint32_t)pool->free_list;
+			pool->free_list = stack;
+			pool->free_count++;
+			
+			CRITICAL_SECTION_LEAVE();
+		}
+		else
+		{
+			dynamic_memory_free(stack);
+		}
+	}
+	
+	slab_free(&thread_cache, thread);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Takes a stack from the smallest pool that fits, and updates the stack size to the pool size
+
+static inline uint32_t* thread_pool_stack_new(uint32_t* stack_size)
+{
+	uint32_t* stack = NULL;
+	
+	CRITICAL_SECTION_ENTER();
+	
+	for (uint32_t i = 0; i < THREAD_STACK_POOL_COUNT; i++)
+	{
+		struct thread_stack_pool* pool = &thread_stack_pools[i];
+		
+		if ((pool->stack_size >= *stack_size) && (pool->free_count != 0))
+		{
+			stack = pool->free_list;
+			
+			pool->free_list = (uint32_t *)(*stack);
+			pool->free_count--;
+			
+			*stack_size = pool->stack_size;
+			
+			break;
+		}
+	}
+	
+	CRITICAL_SECTION_LEAVE();
+	
+	if (stack == NULL)
+	{
+		stack = (uint32_t *)dynamic_memory_new(DRAM_BANK_0, *stack_size * sizeof(uint32_t));
+	}
+	
+	return stack;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
\ No newline at end of file
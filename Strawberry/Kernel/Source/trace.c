@@ -0,0 +1,190 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#include "trace.h"
+#include "scheduler.h"
+#include "board_serial.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include <stddef.h>
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+extern struct scheduler_info scheduler;
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#if KERNEL_TRACE_ENABLE
+
+
+// The trace ring overwrites the oldest records when it is full, so it always holds the last
+// KERNEL_TRACE_RECORDS events. The head counts every record ever reserved.
+
+struct trace_ring
+{
+	struct trace_record	records[KERNEL_TRACE_RECORDS];
+	
+	volatile uint32_t	head;
+	volatile uint8_t	enabled;
+};
+
+
+static struct trace_ring trace = { .enabled = 1 };
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Header in front of a trace dump. The host decoder uses the magic word to find the dump in the
+// serial stream, and the frequency to convert cycles to time.
+
+struct trace_dump_header
+{
+	uint32_t	magic;
+	uint16_t	version;
+	uint16_t	thread_count;
+	uint32_t	record_count;
+	uint32_t	frequency;
+};
+
+
+// A dump lists the name of every thread, so that the decoder can map thread addresses to names
+
+struct trace_dump_thread
+{
+	uint32_t	thread;
+	char		name[KERNEL_THREAD_MAX_NAME_LENGTH];
+};
+
+
+#define TRACE_DUMP_MAGIC		0x43525453
+#define TRACE_DUMP_VERSION		1
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void trace_dump_thread_name(struct thread_structure* thread);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Records one event. A slot is reserved by incrementing the head with LDREX / STREX, so any
+// thread or interrupt may record at any time without a lock or a critical section. An interrupt
+// recording in between simply reserves the next slot. The cycle counter is read inside the
+// reservation, since an exception clears the exclusive monitor. The time stamps are therefore in
+// the same order as the slots.
+
+void trace_record(uint8_t event, uint8_t reason, uint32_t thread, uint32_t argument)
+{
+	if (trace.enabled == 0)
+	{
+		return;
+	}
+	
+	uint32_t index;
+	uint32_t cycles;
+	
+	do
+	{
+		index = __LDREXW((uint32_t *)&trace.head);
+		cycles = DWT->CYCCNT;
+		
+	} while (__STREXW(index + 1, (uint32_t *)&trace.head));
+	
+	struct trace_record* record = &trace.records[index & (KERNEL_TRACE_RECORDS - 1)];
+	
+	record->cycles = cycles;
+	record->event = event;
+	record->reason = reason;
+	record->thread = thread;
+	record->argument = argument;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Writes the trace ring to the DMA serial interface. Recording is paused while the records are
+// copied, and the ring is empty afterwards. Tools/trace_to_json.py converts the dump to a Chrome
+// trace file.
+
+void trace_dump(void)
+{
+	trace.enabled = 0;
+	
+	uint32_t head = trace.head;
+	uint32_t count = head;
+	
+	if (count > KERNEL_TRACE_RECORDS)
+	{
+		count = KERNEL_TRACE_RECORDS;
+	}
+	
+	struct trace_dump_header header;
+	
+	header.magic = TRACE_DUMP_MAGIC;
+	header.version = TRACE_DUMP_VERSION;
+	header.thread_count = scheduler.threads.size + 1;
+	header.record_count = count;
+	header.frequency = CPU_FREQUENCY;
+	
+	board_serial_dma_print_size((char *)&header, sizeof(struct trace_dump_header));
+	
+	trace_dump_thread_name(scheduler.idle_thread);
+	
+	if (scheduler.threads.size > 0)
+	{
+		list_node_s* list_node;
+		
+		list_iterate(list_node, &scheduler.threads)
+		{
+			trace_dump_thread_name((struct thread_structure *)(list_node->object));
+		}
+	}
+	
+	// Print the records from the oldest to the newest
+	for (uint32_t i = head - count; i != head; i++)
+	{
+		board_serial_dma_print_size((char *)&trace.records[i & (KERNEL_TRACE_RECORDS - 1)], sizeof(struct trace_record));
+	}
+	
+	trace.head = 0;
+	trace.enabled = 1;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void trace_dump_thread_name(struct thread_structure* thread)
+{
+	struct trace_dump_thread entry;
+	
+	entry.thread = (uint32_t)thread;
+	
+	for (uint32_t i = 0; i < KERNEL_THREAD_MAX_NAME_LENGTH; i++)
+	{
+		entry.name[i] = thread->name[i];
+	}
+	
+	board_serial_dma_print_size((char *)&entry, sizeof(struct trace_dump_thread));
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#endif
\ No newline at end of file
@@ -0,0 +1,188 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#include "work_queue.h"
+#include "thread.h"
+#include "dynamic_memory.h"
+#include "critical_section.h"
+#include "check.h"
+#include "config.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include <stddef.h>
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+extern struct scheduler_info scheduler;
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The system work queue is used by interrupts that do not need a queue of their own
+static struct work_queue* system_work_queue;
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void work_queue_thread(void* param);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void work_queue_config(void)
+{
+	system_work_queue = work_queue_new("Work", KERNEL_WORK_QUEUE_PRIORITY, KERNEL_WORK_QUEUE_STACK_SIZE);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Makes a new work queue with a worker thread of the given priority. This must not be called
+// from interrupt context.
+
+struct work_queue* work_queue_new(char* name, enum thread_priority priority, uint32_t stack_size)
+{
+	struct work_queue* queue = (struct work_queue *)dynamic_memory_new(DRAM_BANK_0, sizeof(struct work_queue));
+	
+	if (queue == NULL)
+	{
+		check(0);
+		return NULL;
+	}
+	
+	queue->work_list.first = NULL;
+	queue->work_list.last = NULL;
+	queue->work_list.size = 0;
+	
+	queue->wait_list.first = NULL;
+	queue->wait_list.last = NULL;
+	queue->wait_list.size = 0;
+	
+	queue->thread = thread_new(name, work_queue_thread, queue, priority, stack_size);
+	
+	return queue;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void work_init(struct work* work, work_function function, void* argument)
+{
+	work->list_node.object = work;
+	work->list_node.next = NULL;
+	work->list_node.prev = NULL;
+	
+	work->function = function;
+	work->argument = argument;
+	work->pending = 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Adds the work item to the end of the queue. This may be called from both threads and
+// interrupts, and only takes a short critical section. If the worker thread has a higher priority
+// than the current thread, or the CPU is idle, a reschedule is requested so that the work runs as
+// soon as the interrupt returns. Returns 1 if the work was queued, and 0 if it was already pending.
+
+uint8_t work_queue_submit(struct work_queue* queue, struct work* work)
+{
+	uint8_t queued = 0;
+	uint8_t preempt = 0;
+	
+	CRITICAL_SECTION_ENTER();
+	
+	if (work->pending == 0)
+	{
+		work->pending = 1;
+		queued = 1;
+		
+		list_insert_last(&(work->list_node), &queue->work_list);
+		
+		if (queue->wait_list.size != 0)
+		{
+			preempt = scheduler_wake_thread_preempt(queue->thread, THREAD_WAIT_SUCCESS);
+		}
+	}
+	
+	CRITICAL_SECTION_LEAVE();
+	
+	if (preempt)
+	{
+		reschedule();
+	}
+	
+	return queued;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Submits the work item to the system work queue
+
+uint8_t work_submit(struct work* work)
+{
+	return work_queue_submit(system_work_queue, work);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The worker thread takes one work item at a time. The item is no longer pending when its function
+// is called, so it may be submitted again while it runs. When the queue is empty the thread blocks
+// in the same critical section, so a submit can not be missed.
+
+static void work_queue_thread(void* param)
+{
+	struct work_queue* queue = (struct work_queue *)param;
+	
+	while (1)
+	{
+		struct work* work = NULL;
+		
+		CRITICAL_SECTION_ENTER();
+		
+		if (queue->work_list.size != 0)
+		{
+			work = (struct work *)(queue->work_list.first->object);
+			
+			list_remove_first(&queue->work_list);
+			work->pending = 0;
+		}
+		else
+		{
+			scheduler_block_current_thread(&queue->wait_list, THREAD_WAIT_FOREVER);
+		}
+		
+		CRITICAL_SECTION_LEAVE();
+		
+		if (work != NULL)
+		{
+			work->function(work->argument);
+		}
+		else
+		{
+			reschedule();
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
\ No newline at end of file
@@ -0,0 +1,57 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#ifndef DMA_MEMORY_H
+#define DMA_MEMORY_H
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include "sam.h"
+#include "dynamic_memory.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Coherent DMA memory
+//
+// The DMA memory is a part of the SRAM that the MPU maps as non-cacheable, so the DMA and the CPU
+// always see the same data without any cache maintenance. Static buffers are placed there with
+// DMA_MEMORY, and the rest is the SRAM_DMA dynamic memory section used by dma_memory_new. Static
+// DMA buffers are not cleared at startup.
+//
+// Drivers call dma_memory_clean before the DMA reads a buffer, and dma_memory_invalidate after the
+// DMA has written one. Both do nothing for buffers in the DMA memory, and only touch the cache
+// lines of the buffer otherwise.
+
+#define DMA_MEMORY		__attribute__((section(".dma_memory")))
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void* dma_memory_new(uint32_t size);
+
+void dma_memory_free(void* buffer);
+
+uint8_t dma_memory_is_coherent(const void* buffer, uint32_t size);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void dma_memory_clean(const void* buffer, uint32_t size);
+
+void dma_memory_invalidate(void* buffer, uint32_t size);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#endif
\ No newline at end of file
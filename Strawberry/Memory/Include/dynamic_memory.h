@@ -14,6 +14,8 @@
 
 #include "sam.h"
 #include "config.h"
+#include "spinlock.h"
+#include "atomic.h"
 
 
 //--------------------------------------------------------------------------------------------------//
@@ -37,7 +39,7 @@
 //------------------------------------------------------//
 // DRAM Bank 1		|		A0			|		20		//
 //------------------------------------------------------//
-// Section 3		|		B0			|		30		//
+// SRAM DMA		|		B0			|		30		//
 //------------------------------------------------------//
 // Section 4		|		C0			|		40		//
 //------------------------------------------------------//
@@ -59,32 +61,75 @@ typedef enum
 {
 	SRAM,
 	DRAM_BANK_0,
-	DRAM_BANK_1
+	DRAM_BANK_1,
+	SRAM_DMA
 } Dynamic_memory_section;
 
 
+// Allocation flags for dynamic_memory_new_extended
+//
+// Memory is cleared by default. Buffers that are filled right away, for example by DMA, may skip
+// it with DYNAMIC_MEMORY_FLAG_NO_ZERO.
+
+#define DYNAMIC_MEMORY_FLAG_NONE			0x00
+#define DYNAMIC_MEMORY_FLAG_NO_ZERO			0x01
+
+// DMA buffers should be aligned to the data cache line, so that cache maintenance on the buffer
+// never touches other data
+#define DYNAMIC_MEMORY_CACHE_LINE_SIZE		32
+
+
 //--------------------------------------------------------------------------------------------------//
 
 
-// This dynamic memory implementation uses a lightweight algorithm and is optimized for
-// allocations across multiple sections. The user can request dynamic memory and specify where to
-// put it, and the memory driver will automatically allocate memory in that section. To delete
-// memory only the pointer is required.
+// The user can request dynamic memory and specify which section to put it in. To delete memory
+// only the pointer is required.
+//
+// Each section is managed by a two-level segregated fit (TLSF) allocator. The free blocks are
+// kept in segregated lists. The first level splits the block sizes in powers of two, and the
+// second level splits each power of two range in DYNAMIC_MEMORY_SECOND_LEVEL_COUNT lists of
+// equal width. A bitmap for each level tells which lists have free blocks, so a suitable list is
+// found with a few bit instructions. Allocation and free therefore take the same bounded time no
+// matter how many blocks the section holds. Adjacent free blocks are merged on free.
+//
+// Every section has its own lock, so allocations in different sections do not wait for each
+// other. The lock masks the kernel interrupts while it is held, and threads and interrupts at or
+// below the kernel interrupt level may allocate and free in any section. Memory is cleared after
+// the lock is released, so the time the interrupts are masked does not depend on the size.
 //
-// This implementation uses only free blocks to navigate in memory, thus increasing allocation
-// speed. It combines adjacent memory block to prevent memory fragmentation.
+// A section may also keep a small reserve of equally sized blocks on a lock free stack, see
+// dynamic_memory_reserve. dynamic_memory_new_from_isr only takes blocks from the reserve, and
+// can be used from any interrupt. Freed blocks of the reserve size refill the reserve. Interrupts
+// above the kernel interrupt level must not use any other dynamic memory function.
+
+#define DYNAMIC_MEMORY_ALIGN_LOG2			3
+#define DYNAMIC_MEMORY_SECOND_LEVEL_COUNT	(1 << DYNAMIC_MEMORY_SECOND_LEVEL_LOG2)
+
+// Blocks smaller than this are all kept in the first first level list, in steps of 8 bytes
+#define DYNAMIC_MEMORY_SMALL_BLOCK_SIZE		(1 << (DYNAMIC_MEMORY_SECOND_LEVEL_LOG2 + DYNAMIC_MEMORY_ALIGN_LOG2))
+#define DYNAMIC_MEMORY_FIRST_LEVEL_SHIFT	(DYNAMIC_MEMORY_SECOND_LEVEL_LOG2 + DYNAMIC_MEMORY_ALIGN_LOG2)
+#define DYNAMIC_MEMORY_FIRST_LEVEL_COUNT	(DYNAMIC_MEMORY_FIRST_LEVEL_MAX - DYNAMIC_MEMORY_FIRST_LEVEL_SHIFT + 1)
+
+
+//--------------------------------------------------------------------------------------------------//
+
 
 // This is the dynamic memory descriptor
-// Every block that is allocated or freed will start with this descriptor
+// Every block that is allocated or freed will start with this descriptor. Only the first two
+// fields are kept in an allocated block, the free list pointers overlap the user data.
 
 typedef struct dynamic_memory_descriptor_s
 {
-	// Pointer to next element in the linked list
-	struct dynamic_memory_descriptor_s* next;
+	// The block right before this block in memory, so that a freed block can be merged with it
+	struct dynamic_memory_descriptor_s* previous_physical;
 	
-	// Size of the memory block
+	// Size of the memory block including the descriptor
 	uint32_t size;
-		
+	
+	// Links in the segregated free list. Only valid while the block is free.
+	struct dynamic_memory_descriptor_s* next_free;
+	struct dynamic_memory_descriptor_s* previous_free;
+	
 } dynamic_memory_descriptor;
 
 
@@ -110,11 +155,28 @@ typedef struct
 	uint32_t minimum_block_size;
 	uint32_t allignment;
 	
-	// Define descriptors
-	dynamic_memory_descriptor start_descriptor_object;
+	// The first block in the section, and the empty used block at the end of the section which
+	// stops the merging
 	dynamic_memory_descriptor* start_descriptor;
 	dynamic_memory_descriptor* end_descriptor;
 	
+	// One bit for every first level with free blocks, and one bit for every non-empty list
+	uint32_t first_level_bitmap;
+	uint32_t second_level_bitmap[DYNAMIC_MEMORY_FIRST_LEVEL_COUNT];
+	
+	dynamic_memory_descriptor* free_lists[DYNAMIC_MEMORY_FIRST_LEVEL_COUNT][DYNAMIC_MEMORY_SECOND_LEVEL_COUNT];
+	
+	// Protects the free lists and the block descriptors
+	struct spinlock lock;
+	
+	// Blocks kept aside for interrupts. The reserve count is the number of blocks on the reserve
+	// stack, and never exceeds the reserve size.
+	struct atomic_stack reserve;
+	
+	uint32_t reserve_block_size;
+	uint32_t reserve_size;
+	volatile uint32_t reserve_count;
+	
 } Dynamic_memory_section_s;
 
 
@@ -125,12 +187,24 @@ void dynamic_memory_config(void);
 
 void* dynamic_memory_new(Dynamic_memory_section memory_section, uint32_t size);
 
+void* dynamic_memory_new_extended(Dynamic_memory_section memory_section, uint32_t size, uint32_t alignment, uint32_t flags);
+
+void* dynamic_memory_realloc(void* memory_object, uint32_t size);
+
 void dynamic_memory_free(void* memory_object);
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
+uint8_t dynamic_memory_reserve(Dynamic_memory_section memory_section, uint32_t size, uint32_t count);
+
+void* dynamic_memory_new_from_isr(Dynamic_memory_section memory_section, uint32_t size);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
 uint32_t dynamic_memory_get_total_size(Dynamic_memory_section memory_section);
 
 uint32_t dynamic_memory_get_used_size(Dynamic_memory_section memory_section);
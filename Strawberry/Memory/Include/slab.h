@@ -0,0 +1,106 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#ifndef SLAB_H
+#define SLAB_H
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include "sam.h"
+#include "dynamic_memory.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Slab caches
+//
+// A slab cache hands out objects of one size. The objects are cut from slabs, which are larger
+// blocks taken from a dynamic memory section, and the free objects of every slab are kept in one
+// list linked through their first word. Allocating and freeing an object is a list pop and push,
+// with no descriptor in front of the object and no fragmentation of the section. The cache grows
+// by one slab when it runs out of objects, and the slabs are only given back when the cache is
+// deleted.
+//
+// slab_free may be called from interrupts. slab_new never grows the cache from an interrupt, so
+// objects used by interrupts must be reserved up front with slab_cache_reserve.
+
+struct slab_cache_stats
+{
+	uint32_t	object_size;
+	uint32_t	slab_count;
+	
+	uint32_t	total_objects;
+	uint32_t	used_objects;
+	uint32_t	peak_used_objects;
+	
+	uint32_t	allocations;
+	uint32_t	failures;
+};
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+struct slab_cache
+{
+	const char*					name;
+	
+	Dynamic_memory_section		section;
+	
+	uint32_t					object_size;
+	uint32_t					alignment;
+	uint32_t					objects_per_slab;
+	
+	// The free objects and the slabs are both linked through their first word
+	void*						free_list;
+	void*						slab_list;
+	
+	struct slab_cache_stats		stats;
+	
+	// Set if the cache structure itself was allocated by slab_cache_new
+	uint8_t						allocated;
+	
+	// All caches are linked for the runtime statistics
+	struct slab_cache*			next;
+};
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void slab_cache_init(struct slab_cache* cache, const char* name, Dynamic_memory_section section, uint32_t object_size, uint32_t alignment, uint32_t objects_per_slab);
+
+struct slab_cache* slab_cache_new(const char* name, Dynamic_memory_section section, uint32_t object_size, uint32_t alignment, uint32_t objects_per_slab);
+
+void slab_cache_delete(struct slab_cache* cache);
+
+uint8_t slab_cache_reserve(struct slab_cache* cache, uint32_t count);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void* slab_new(struct slab_cache* cache);
+
+void slab_free(struct slab_cache* cache, void* object);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void slab_cache_get_stats(struct slab_cache* cache, struct slab_cache_stats* stats);
+
+struct slab_cache* slab_cache_get_list(void);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#endif
\ No newline at end of file
@@ -0,0 +1,82 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#include "dma_memory.h"
+#include "cache.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Variables declared extern in the linker script
+// These mark the beginning and end of the non-cacheable DMA memory
+extern uint32_t _sdma_memory;
+extern uint32_t _edma_memory;
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Returns a cleared, cache line aligned buffer from the DMA memory
+
+void* dma_memory_new(uint32_t size)
+{
+	return dynamic_memory_new_extended(SRAM_DMA, size, DYNAMIC_MEMORY_CACHE_LINE_SIZE, DYNAMIC_MEMORY_FLAG_NONE);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void dma_memory_free(void* buffer)
+{
+	dynamic_memory_free(buffer);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+uint8_t dma_memory_is_coherent(const void* buffer, uint32_t size)
+{
+	uint32_t start = (uint32_t)buffer;
+	
+	return (start >= (uint32_t)&_sdma_memory) && ((start + size) <= (uint32_t)&_edma_memory);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Writes the buffer back to memory before the DMA reads it
+
+void dma_memory_clean(const void* buffer, uint32_t size)
+{
+	if (dma_memory_is_coherent(buffer, size) == 0)
+	{
+		cache_clean_addresses((uint32_t *)buffer, size);
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Drops the cached copy of the buffer after the DMA has written it. Any other data sharing the
+// first or the last cache line of the buffer is dropped as well, so buffers outside the DMA memory
+// should be cache line aligned.
+
+void dma_memory_invalidate(void* buffer, uint32_t size)
+{
+	if (dma_memory_is_coherent(buffer, size) == 0)
+	{
+		cache_invalidate_addresses((uint32_t *)buffer, size);
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
\ No newline at end of file
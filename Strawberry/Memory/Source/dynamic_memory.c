@@ -14,7 +14,6 @@
 
 #include <stddef.h>
 #include <string.h>
-#include <core_cm7.h>
 
 
 //--------------------------------------------------------------------------------------------------//
@@ -25,6 +24,10 @@
 extern uint32_t _sheap;
 extern uint32_t _eheap;
 
+// These mark the part of the non-cacheable DMA memory not used by static buffers
+extern uint32_t _sdma_heap;
+extern uint32_t _edma_memory;
+
 
 //--------------------------------------------------------------------------------------------------//
 
@@ -33,7 +36,8 @@ extern uint32_t _eheap;
 // internal SRAM and gets the addresses from the linker script. Thus a start
 // and end address of zero is added.
 //
-// The alignment can be MAX 8 bytes - this will not be fixed
+// The section alignment is the default alignment of every block. Larger alignments are asked for
+// with dynamic_memory_new_extended.
  
 Dynamic_memory_section_s dynamic_section_sram =
 {
@@ -65,11 +69,25 @@ Dynamic_memory_section_s dynamic_section_dram_bank_1 =
 };
 
 
+// The SRAM DMA section is mapped as non-cacheable by the MPU, and also gets the addresses from
+// the linker script. It is used through dma_memory_new.
+
+Dynamic_memory_section_s dynamic_section_sram_dma =
+{
+	.start_address		= 0,
+	.end_address		= 0,
+	.allignment			= 8,
+	.minimum_block_size = 8,
+	.name				= "SRAM DMA"
+};
+
+
 Dynamic_memory_section_s* dynamic_memory_sections[] = 
 {
 	&dynamic_section_sram,
 	&dynamic_section_dram_bank_0,
 	&dynamic_section_dram_bank_1,
+	&dynamic_section_sram_dma,
 	NULL
 };
 
@@ -89,18 +107,47 @@ Dynamic_memory_section_s* dynamic_memory_sections[] =
 #define MEMORY_SET_SECTION(size, sect)			(((sect) << 28) | (size))
 
 
+// The block right after a block in memory
+#define MEMORY_NEXT_PHYSICAL(block)				((dynamic_memory_descriptor *)((uint8_t *)(block) + MEMORY_GET_RAW_SIZE((block)->size)))
+
+
 //--------------------------------------------------------------------------------------------------//
 
 
-// Specifies the size of the dynamic memory descriptor
-const uint8_t memory_descriptor_size = ((sizeof(dynamic_memory_descriptor) + 8 - 1) & ~(8 - 1));
+// Specifies the size of the dynamic memory descriptor kept in an allocated block
+const uint8_t memory_descriptor_size = ((offsetof(dynamic_memory_descriptor, next_free) + 8 - 1) & ~(8 - 1));
+
+// A free block must have room for the free list pointers
+const uint8_t memory_minimum_block_size = ((sizeof(dynamic_memory_descriptor) + 8 - 1) & ~(8 - 1));
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
 // Private prototypes
-static void dynamic_memory_insert_block(Dynamic_memory_section memory_section, dynamic_memory_descriptor* block);
+static inline uint32_t dynamic_memory_find_last_set(uint32_t word);
+
+static inline uint32_t dynamic_memory_find_first_set(uint32_t word);
+
+static inline void dynamic_memory_mapping(uint32_t size, uint32_t* first_level, uint32_t* second_level);
+
+static dynamic_memory_descriptor* dynamic_memory_find_block(Dynamic_memory_section_s* current_section, uint32_t size);
+
+static void dynamic_memory_insert_block(Dynamic_memory_section_s* current_section, dynamic_memory_descriptor* block);
+
+static void dynamic_memory_remove_block(Dynamic_memory_section_s* current_section, dynamic_memory_descriptor* block);
+
+static inline uint32_t dynamic_memory_block_size(Dynamic_memory_section_s* current_section, uint32_t size);
+
+static dynamic_memory_descriptor* dynamic_memory_align_block(Dynamic_memory_section_s* current_section, dynamic_memory_descriptor* block, uint32_t alignment);
+
+static uint32_t dynamic_memory_split_block(Dynamic_memory_section_s* current_section, dynamic_memory_descriptor* block, uint32_t size);
+
+static inline void dynamic_memory_clear(void* memory, uint32_t size);
+
+static inline uint8_t dynamic_memory_is_reserve_size(Dynamic_memory_section_s* current_section, uint32_t size);
+
+static uint8_t dynamic_memory_reserve_push(Dynamic_memory_section_s* current_section, dynamic_memory_descriptor* block);
 
 
 //--------------------------------------------------------------------------------------------------//
@@ -115,6 +162,9 @@ void dynamic_memory_config(void)
 	it->start_address = (uint32_t)(&_sheap);
 	it->end_address = (uint32_t)(&_eheap);
 	
+	dynamic_section_sram_dma.start_address = (uint32_t)(&_sdma_heap);
+	dynamic_section_sram_dma.end_address = (uint32_t)(&_edma_memory);
+	
 	while (it != NULL)
 	{		
 		// Zero-initializes the memory sections
@@ -147,19 +197,44 @@ void dynamic_memory_config(void)
 		
 		// The total free memory is the total block size minus the descriptor
 		it->free_memory = it->total_memory;
+		
+		// The free lists can only hold blocks up to the configured size
+		check(it->total_memory < (1UL << DYNAMIC_MEMORY_FIRST_LEVEL_MAX));
+		
+		// Start with empty free lists
+		it->first_level_bitmap = 0;
+		
+		for (uint32_t i = 0; i < DYNAMIC_MEMORY_FIRST_LEVEL_COUNT; i++)
+		{
+			it->second_level_bitmap[i] = 0;
+			
+			for (uint32_t j = 0; j < DYNAMIC_MEMORY_SECOND_LEVEL_COUNT; j++)
+			{
+				it->free_lists[i][j] = NULL;
+			}
+		}
 
 		// Configure the memory section descriptors
-		it->start_descriptor = &it->start_descriptor_object;
+		it->start_descriptor = (dynamic_memory_descriptor *)it->start_address;
 		it->end_descriptor = (dynamic_memory_descriptor *)it->end_address;
-		it->start_descriptor->next = (dynamic_memory_descriptor *)it->start_address;
 		
-		it->start_descriptor->next->next = it->end_descriptor;
-		it->start_descriptor->next->size = it->total_memory;
-		it->start_descriptor->next->size = MEMORY_SET_BLOCK_FREE(it->start_descriptor->next->size);
+		it->start_descriptor->previous_physical = NULL;
+		it->start_descriptor->size = MEMORY_SET_SECTION(it->total_memory, section_counter);
+		
+		it->end_descriptor->previous_physical = it->start_descriptor;
+		it->end_descriptor->size = MEMORY_SET_SECTION(MEMORY_SET_BLOCK_USED(0), section_counter);
 		
-		it->end_descriptor->next = NULL;
-		it->end_descriptor->size = 0;
-		it->end_descriptor->size = MEMORY_SET_BLOCK_USED(it->end_descriptor->size);
+		// The whole section starts as one free block
+		dynamic_memory_insert_block(it, it->start_descriptor);
+		
+		spinlock_init(&it->lock, it->name);
+		
+		// No blocks are reserved for interrupts until dynamic_memory_reserve is called
+		atomic_stack_init(&it->reserve);
+		
+		it->reserve_block_size = 0;
+		it->reserve_size = 0;
+		it->reserve_count = 0;
 		
 		it = dynamic_memory_sections[++section_counter];
 	}
@@ -169,70 +244,154 @@ void dynamic_memory_config(void)
 //--------------------------------------------------------------------------------------------------//
 
 
-static void dynamic_memory_insert_block(Dynamic_memory_section memory_section, dynamic_memory_descriptor* block)
+static inline uint32_t dynamic_memory_find_last_set(uint32_t word)
 {
-	// Retrieve the right memory section
-	Dynamic_memory_section_s* current_section = dynamic_memory_sections[memory_section];
+	return 31 - __builtin_clz(word);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static inline uint32_t dynamic_memory_find_first_set(uint32_t word)
+{
+	return __builtin_ctz(word);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Finds the free list holding blocks of the given size. Blocks below the small block size are
+// kept in the first first level, one list for every 8 bytes. Above it the first level is the
+// most significant bit, and the second level is the next bits of the size.
+
+static inline void dynamic_memory_mapping(uint32_t size, uint32_t* first_level, uint32_t* second_level)
+{
+	if (size < DYNAMIC_MEMORY_SMALL_BLOCK_SIZE)
+	{
+		*first_level = 0;
+		*second_level = size >> DYNAMIC_MEMORY_ALIGN_LOG2;
+	}
+	else
+	{
+		uint32_t last_set = dynamic_memory_find_last_set(size);
+		
+		*second_level = (size >> (last_set - DYNAMIC_MEMORY_SECOND_LEVEL_LOG2)) ^ DYNAMIC_MEMORY_SECOND_LEVEL_COUNT;
+		*first_level = last_set - (DYNAMIC_MEMORY_FIRST_LEVEL_SHIFT - 1);
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Returns a free block of at least the given size, or NULL. The size is rounded up to the next
+// list, so that any block in the chosen list is large enough and the list is never searched.
+
+static dynamic_memory_descriptor* dynamic_memory_find_block(Dynamic_memory_section_s* current_section, uint32_t size)
+{
+	uint32_t first_level;
+	uint32_t second_level;
 	
-	// Check that the block is passed right
-	check((block < current_section->end_descriptor) && (block >= current_section->start_descriptor));
+	if (size >= DYNAMIC_MEMORY_SMALL_BLOCK_SIZE)
+	{
+		size += (1UL << (dynamic_memory_find_last_set(size) - DYNAMIC_MEMORY_SECOND_LEVEL_LOG2)) - 1;
+	}
 	
-	// Make a iterator
-	dynamic_memory_descriptor* block_iterator;
+	dynamic_memory_mapping(size, &first_level, &second_level);
 	
-	for (block_iterator = current_section->start_descriptor; block_iterator->next < block; block_iterator = block_iterator->next)
+	if (first_level >= DYNAMIC_MEMORY_FIRST_LEVEL_COUNT)
 	{
-		// Do nothing
+		return NULL;
+	}
+	
+	// Look for a list at or above the second level in the same first level
+	uint32_t second_level_map = current_section->second_level_bitmap[first_level] & (0xffffffff << second_level);
+	
+	if (second_level_map == 0)
+	{
+		// Take the smallest list in the next non-empty first level
+		uint32_t first_level_map = current_section->first_level_bitmap & (0xffffffff << (first_level + 1));
+		
+		if (first_level_map == 0)
+		{
+			return NULL;
+		}
+		
+		first_level = dynamic_memory_find_first_set(first_level_map);
+		second_level_map = current_section->second_level_bitmap[first_level];
 	}
 	
-	// Now the block iterator points to the memory block before the insertion
-	// block_iterator->next points to the memory block after the insertion
-	// Create a pointer to the inserted block address
-	uint8_t* addr = (uint8_t *) block_iterator;
+	second_level = dynamic_memory_find_first_set(second_level_map);
+	
+	return current_section->free_lists[first_level][second_level];
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void dynamic_memory_insert_block(Dynamic_memory_section_s* current_section, dynamic_memory_descriptor* block)
+{
+	uint32_t first_level;
+	uint32_t second_level;
+	
+	// Check that the block is passed right
+	check((block < current_section->end_descriptor) && (block >= current_section->start_descriptor));
+	
+	dynamic_memory_mapping(MEMORY_GET_RAW_SIZE(block->size), &first_level, &second_level);
+	
+	dynamic_memory_descriptor* first = current_section->free_lists[first_level][second_level];
 	
-	uint32_t acctual_block_size = MEMORY_GET_RAW_SIZE(block->size);
-	uint32_t acctual_block_iterator_size = MEMORY_GET_RAW_SIZE(block_iterator->size);
+	block->next_free = first;
+	block->previous_free = NULL;
 	
-	// The algorithm rely on the fact that every element in the list contains free memory
-	// We therefore have to check whether the previous free block overlaps with the new block
-	// In this case the block will be combined 
-	if ((addr + acctual_block_iterator_size) == ((uint8_t *)block))
+	if (first != NULL)
 	{
-		block_iterator->size += acctual_block_size;
-		block = block_iterator;
+		first->previous_free = block;
 	}
 	
-	// Now the current block is merged with the previous block. The current block has then the address of the previous block
-	// Check if the previous (maybe merged) block overlaps with the next memory block
+	current_section->free_lists[first_level][second_level] = block;
 	
-	addr = (uint8_t *) block;
+	current_section->first_level_bitmap |= (1UL << first_level);
+	current_section->second_level_bitmap[first_level] |= (1UL << second_level);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void dynamic_memory_remove_block(Dynamic_memory_section_s* current_section, dynamic_memory_descriptor* block)
+{
+	uint32_t first_level;
+	uint32_t second_level;
 	
-	acctual_block_size = MEMORY_GET_RAW_SIZE(block->size);
+	dynamic_memory_mapping(MEMORY_GET_RAW_SIZE(block->size), &first_level, &second_level);
 	
-	if ((addr + acctual_block_size) == ((uint8_t *)block_iterator->next))
+	if (block->previous_free != NULL)
 	{
-		// Check if the next block is the last block
-		// In this case do not merge blocks
-		if (block_iterator->next != current_section->end_descriptor)
-		{
-			block->size += MEMORY_GET_RAW_SIZE(block_iterator->next->size);
-			block->next = block_iterator->next->next;
-		}
-		else
-		{
-			block->next = current_section->end_descriptor;
-		}
+		block->previous_free->next_free = block->next_free;
 	}
 	else
 	{
-		block->next = block_iterator->next;
+		current_section->free_lists[first_level][second_level] = block->next_free;
 	}
 	
-	// Last, if the inserted memory was not merged with the previous block
-	// make the previous block point to the inserted block
-	if (block != block_iterator)
+	if (block->next_free != NULL)
 	{
-		block_iterator->next = block;
+		block->next_free->previous_free = block->previous_free;
+	}
+	
+	// Clear the bitmaps if the list is empty
+	if (current_section->free_lists[first_level][second_level] == NULL)
+	{
+		current_section->second_level_bitmap[first_level] &= ~(1UL << second_level);
+		
+		if (current_section->second_level_bitmap[first_level] == 0)
+		{
+			current_section->first_level_bitmap &= ~(1UL << first_level);
+		}
 	}
 }
 
@@ -242,10 +401,18 @@ static void dynamic_memory_insert_block(Dynamic_memory_section memory_section, d
 
 void* dynamic_memory_new(Dynamic_memory_section memory_section, uint32_t size)
 {
-	// Pointer to iterators
-	dynamic_memory_descriptor* block_iterator_previous;
-	dynamic_memory_descriptor* block_iterator_current;
-	
+	return dynamic_memory_new_extended(memory_section, size, 8, DYNAMIC_MEMORY_FLAG_NONE);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Allocates memory with the given alignment, which must be a power of two. The memory is cleared
+// unless DYNAMIC_MEMORY_FLAG_NO_ZERO is given.
+
+void* dynamic_memory_new_extended(Dynamic_memory_section memory_section, uint32_t size, uint32_t alignment, uint32_t flags)
+{
 	// Pointer to the memory section
 	Dynamic_memory_section_s* current_section = dynamic_memory_sections[memory_section];
 	
@@ -254,85 +421,57 @@ void* dynamic_memory_new(Dynamic_memory_section memory_section, uint32_t size)
 	
 	// Check that the size is greater than zero
 	check(size != 0);
+	check((alignment & (alignment - 1)) == 0);
 	
-	// Make sure the size requested is greater than the minimum value
-	if (size < current_section->minimum_block_size)
+	// Now the correct size of the block to be allocated is determined. This size
+	// includes the memory descriptor in the start
+	size = dynamic_memory_block_size(current_section, size);
+	
+	// A larger alignment may need a free block in front of the aligned block. The block found must
+	// have room for both.
+	uint32_t search_size = size;
+	
+	if (alignment > current_section->allignment)
 	{
-		size = current_section->minimum_block_size;
+		search_size += alignment + memory_minimum_block_size;
 	}
 	
-	// Allocate new memory
-	// First add the size of the descriptor and add alignment padding
-	size += memory_descriptor_size;
+	dynamic_memory_descriptor* block = NULL;
 	
+	uint32_t state = spinlock_aquire_irqsave(&current_section->lock);
 	
-	// Make sure the size has the required alignment
-	if (size & (current_section->allignment - 1))
+	if (search_size < current_section->free_memory)
 	{
-		size = ((size + current_section->allignment - 1) & ~(current_section->allignment - 1));
+		block = dynamic_memory_find_block(current_section, search_size);
 	}
 	
-	// Now the correct size of the block to be allocated is determined. This size
-	// includes the memory descriptor in the start
-	
-	// If there is enough bytes remaining in the heap section
-	// The free memory size holds the number of free bytes. That is not include
-	if (size < current_section->free_memory)
+	if (block != NULL)
 	{
-		// Iterate through list and try to find a match
-		block_iterator_previous = current_section->start_descriptor;
-		block_iterator_current = current_section->start_descriptor->next;
+		dynamic_memory_remove_block(current_section, block);
 		
-		while ((MEMORY_GET_RAW_SIZE(block_iterator_current->size) < size) && (block_iterator_current->next != NULL))
+		current_section->free_memory -= MEMORY_GET_RAW_SIZE(block->size);
+		
+		if (alignment > current_section->allignment)
 		{
-			block_iterator_previous = block_iterator_current;
-			block_iterator_current = block_iterator_current->next;
+			block = dynamic_memory_align_block(current_section, block, alignment);
 		}
-				
 		
-		// After the while loop the block_iterator_current points to the memory block
-		// that is large enough to hold the requested size.
+		// Give the rest of the block back to the free lists
+		size = dynamic_memory_split_block(current_section, block, size);
+		
+		block->size = MEMORY_SET_BLOCK_USED(block->size);
+	}
+	
+	spinlock_release_irqrestore(&current_section->lock, state);
+	
+	if (block != NULL)
+	{
+		// The return value should have an offset big enough to hold the memory descriptor
+		return_value = ((void *)(((uint8_t *)block) + memory_descriptor_size));
 		
-		// Check that the block is not the end block 
-		if (block_iterator_current != current_section->end_descriptor)
+		if ((flags & DYNAMIC_MEMORY_FLAG_NO_ZERO) == 0)
 		{
-			// The return value should have an offset big enough to hold the memory descriptor
-			return_value = ((void *)(((uint8_t *)block_iterator_current) + memory_descriptor_size));
-			
-			
-			// Take out the available block of the linked list
-			block_iterator_previous->next = block_iterator_current->next;
-			
-			if ((MEMORY_GET_RAW_SIZE(block_iterator_current->size) - size) >= (current_section->minimum_block_size + memory_descriptor_size))
-			{
-				// The block has bigger size than the requested size 
-				// AND the remained has also a bigger size than the minimum size
-				// This is to prevent very tiny blocks of available unused memory
-				// often called memory fragmentation
-				dynamic_memory_descriptor* block_to_insert = ((dynamic_memory_descriptor *)(((uint8_t *)block_iterator_current) + size));
-				
-				check((((uint32_t)block_to_insert) & (current_section->allignment - 1)) == 0);
-				
-				// Calculate the size of the two blocks
-				block_to_insert->size = block_iterator_current->size - size;
-				block_iterator_current->size = size;
-				
-				// Insert the free block into the list of free elements
-				dynamic_memory_insert_block(memory_section, block_to_insert);
-			}
-			
-			// Updated the free bytes remaining
-			current_section->free_memory -= size;
-
-			// The block is still there but we have to tell the kernel that
-			// it is not used anymore
-			block_iterator_current->next = NULL;
-			block_iterator_current->size = MEMORY_SET_BLOCK_USED(block_iterator_current->size);
-			
-			// In order to free the memory just by the pointer we need to
-			// add some information in order to know what memory section
-			// it belongs to
-			block_iterator_current->size = MEMORY_SET_SECTION(block_iterator_current->size, memory_section);
+			dynamic_memory_clear(return_value, size - memory_descriptor_size);
 		}
 	}
 	
@@ -344,21 +483,224 @@ void* dynamic_memory_new(Dynamic_memory_section memory_section, uint32_t size)
 		//check(0); // REMOVE
 	}
 	
-	uint8_t* tmp = (uint8_t *)return_value;
+	return return_value;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Changes the size of an allocated block. The block grows in place if the block after it is free
+// and large enough, and shrinks in place by giving the end back. Otherwise the content is moved to
+// a new block in the same section with the default alignment. Like realloc in the C library, the
+// memory added to the block is not cleared. Returns NULL and keeps the old block if there is not
+// enough memory.
+
+void* dynamic_memory_realloc(void* memory_object, uint32_t size)
+{
+	check(memory_object != NULL);
+	check(size != 0);
+	
+	dynamic_memory_descriptor* block = (dynamic_memory_descriptor *)((uint8_t *)memory_object - memory_descriptor_size);
 	
-	// Fill memory with zeros
-	for (uint32_t i = 0; i < (size - 8); i++)
+	if (!MEMORY_IS_BLOCK_USED(block->size) || (MEMORY_NEXT_PHYSICAL(block)->previous_physical != block))
 	{
-		*tmp++ = 0;
+		check(0);
+		return NULL;
 	}
 	
-	return return_value;
+	Dynamic_memory_section memory_section = MEMORY_GET_SECTION(block->size);
+	Dynamic_memory_section_s* current_section = dynamic_memory_sections[memory_section];
+	
+	uint32_t old_size = MEMORY_GET_RAW_SIZE(block->size);
+	uint32_t new_size = dynamic_memory_block_size(current_section, size);
+	
+	uint32_t state = spinlock_aquire_irqsave(&current_section->lock);
+	
+	dynamic_memory_descriptor* next = MEMORY_NEXT_PHYSICAL(block);
+	
+	if ((new_size > old_size) && !MEMORY_IS_BLOCK_USED(next->size) && ((old_size + MEMORY_GET_RAW_SIZE(next->size)) >= new_size))
+	{
+		// Take the whole next block, and give back what is not needed below
+		dynamic_memory_remove_block(current_section, next);
+		
+		current_section->free_memory -= MEMORY_GET_RAW_SIZE(next->size);
+		
+		block->size += MEMORY_GET_RAW_SIZE(next->size);
+		MEMORY_NEXT_PHYSICAL(block)->previous_physical = block;
+	}
+	
+	if (new_size <= MEMORY_GET_RAW_SIZE(block->size))
+	{
+		dynamic_memory_split_block(current_section, block, new_size);
+		
+		spinlock_release_irqrestore(&current_section->lock, state);
+		
+		return memory_object;
+	}
+	
+	spinlock_release_irqrestore(&current_section->lock, state);
+	
+	// Move the content to a new block
+	uint8_t* new_object = (uint8_t *)dynamic_memory_new_extended(memory_section, size, 8, DYNAMIC_MEMORY_FLAG_NO_ZERO);
+	
+	if (new_object == NULL)
+	{
+		return NULL;
+	}
+	
+	memcpy(new_object, memory_object, old_size - memory_descriptor_size);
+	
+	dynamic_memory_free(memory_object);
+	
+	return new_object;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Returns the block size needed for size bytes of user memory. This size includes the descriptor.
+
+static inline uint32_t dynamic_memory_block_size(Dynamic_memory_section_s* current_section, uint32_t size)
+{
+	// Make sure the size requested is greater than the minimum value
+	if (size < current_section->minimum_block_size)
+	{
+		size = current_section->minimum_block_size;
+	}
+	
+	// Allocate new memory
+	// First add the size of the descriptor and add alignment padding
+	size += memory_descriptor_size;
+	
+	// Make sure the size has the required alignment
+	if (size & (current_section->allignment - 1))
+	{
+		size = ((size + current_section->allignment - 1) & ~(current_section->allignment - 1));
+	}
+	
+	// The block must be able to hold the free list pointers when it is freed
+	if (size < memory_minimum_block_size)
+	{
+		size = memory_minimum_block_size;
+	}
+	
+	return size;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Moves the start of a block taken from the free lists forward, so that the user memory gets the
+// given alignment. The memory in front becomes a free block of its own, which must be large
+// enough to hold a free block. The block before it is always used, since free blocks are merged.
+
+static dynamic_memory_descriptor* dynamic_memory_align_block(Dynamic_memory_section_s* current_section, dynamic_memory_descriptor* block, uint32_t alignment)
+{
+	uint32_t user_address = (uint32_t)block + memory_descriptor_size;
+	uint32_t aligned_address = (user_address + alignment - 1) & ~(alignment - 1);
+	
+	if (aligned_address == user_address)
+	{
+		return block;
+	}
+	
+	while ((aligned_address - user_address) < memory_minimum_block_size)
+	{
+		aligned_address += alignment;
+	}
+	
+	uint32_t gap = aligned_address - user_address;
+	
+	dynamic_memory_descriptor* aligned_block = (dynamic_memory_descriptor *)((uint8_t *)block + gap);
+	
+	aligned_block->size = block->size - gap;
+	aligned_block->previous_physical = block;
+	
+	MEMORY_NEXT_PHYSICAL(aligned_block)->previous_physical = aligned_block;
+	
+	block->size = (block->size & ~0xfffffff) | gap;
+	
+	dynamic_memory_insert_block(current_section, block);
+	
+	current_section->free_memory += gap;
+	
+	return aligned_block;
 }
 
 
 //--------------------------------------------------------------------------------------------------//
 
 
+// Cuts the block down to size, and gives the rest back to the free lists merged with the next
+// block if that is free. The rest is kept in the block if it is too small to be a free block.
+// Returns the final size of the block.
+
+static uint32_t dynamic_memory_split_block(Dynamic_memory_section_s* current_section, dynamic_memory_descriptor* block, uint32_t size)
+{
+	uint32_t remainder = MEMORY_GET_RAW_SIZE(block->size) - size;
+	
+	if ((remainder < (current_section->minimum_block_size + memory_descriptor_size)) || (remainder < memory_minimum_block_size))
+	{
+		// This is to prevent very tiny blocks of available unused memory
+		// often called memory fragmentation
+		return MEMORY_GET_RAW_SIZE(block->size);
+	}
+	
+	dynamic_memory_descriptor* block_to_insert = ((dynamic_memory_descriptor *)(((uint8_t *)block) + size));
+	
+	check((((uint32_t)block_to_insert) & (current_section->allignment - 1)) == 0);
+	
+	// The rest has the same section bits, and is free
+	block_to_insert->size = MEMORY_SET_BLOCK_FREE((block->size & ~0xfffffff) | remainder);
+	block_to_insert->previous_physical = block;
+	
+	block->size = (block->size & ~0xfffffff) | size;
+	
+	dynamic_memory_descriptor* next = MEMORY_NEXT_PHYSICAL(block_to_insert);
+	
+	if (!MEMORY_IS_BLOCK_USED(next->size))
+	{
+		dynamic_memory_remove_block(current_section, next);
+		
+		block_to_insert->size += MEMORY_GET_RAW_SIZE(next->size);
+	}
+	
+	MEMORY_NEXT_PHYSICAL(block_to_insert)->previous_physical = block_to_insert;
+	
+	dynamic_memory_insert_block(current_section, block_to_insert);
+	
+	current_section->free_memory += remainder;
+	
+	return size;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The user memory and the block sizes are 8 byte aligned, so the memory is cleared one word at a
+// time. The SDRAM does not respond to halfword accesses.
+
+static inline void dynamic_memory_clear(void* memory, uint32_t size)
+{
+	uint32_t* word = (uint32_t *)memory;
+	
+	for (uint32_t i = 0; i < (size / sizeof(uint32_t)); i++)
+	{
+		word[i] = 0;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The descriptor of a used block and the link back to it from the next block only change while
+// the block itself is resized or freed, so they are checked before the lock is taken.
+
 void dynamic_memory_free(void* memory_object)
 {
 	dynamic_memory_descriptor* block;
@@ -367,42 +709,70 @@ void dynamic_memory_free(void* memory_object)
 	if (memory_object != NULL)
 	{
 		// Every object has a memory descriptor right behind it
-		// on an active memory block the next pointer should be zero
 		memory_object = (void *)((uint8_t *)memory_object - memory_descriptor_size);
 		
 		// Cast the address to a memory object
 		block = (dynamic_memory_descriptor *)memory_object;
 		
-		if (block->next == NULL)
+		// An active block is marked as used, and the next block in memory must point back to it
+		if (MEMORY_IS_BLOCK_USED(block->size) && (MEMORY_NEXT_PHYSICAL(block)->previous_physical == block))
 		{
-			if (MEMORY_IS_BLOCK_USED(block->size))
+			// Check which memory section it belongs to
+			Dynamic_memory_section sect = MEMORY_GET_SECTION(block->size);
+			Dynamic_memory_section_s* current_section = dynamic_memory_sections[sect];
+			
+			// Refill the interrupt reserve first. The block stays used while it is in the reserve.
+			if ((current_section->reserve_size != 0) && dynamic_memory_is_reserve_size(current_section, MEMORY_GET_RAW_SIZE(block->size)))
 			{
-				// Check which memory section it belongs to
-				Dynamic_memory_section sect = MEMORY_GET_SECTION(block->size);
-				
-				// Remove the memory free bit
-				block->size = MEMORY_SET_BLOCK_FREE(block->size);
-				
-				// Now updated the number of free bytes in the heap
-				dynamic_memory_sections[sect]->free_memory += MEMORY_GET_RAW_SIZE(block->size);
-				
-				// Insert the block in the linked list of free elements
-				dynamic_memory_insert_block(sect, block);
+				if (dynamic_memory_reserve_push(current_section, block))
+				{
+					return;
+				}
+			}
+			
+			uint32_t state = spinlock_aquire_irqsave(&current_section->lock);
+			
+			// Remove the memory free bit
+			block->size = MEMORY_SET_BLOCK_FREE(block->size);
+			
+			// Now updated the number of free bytes in the heap
+			current_section->free_memory += MEMORY_GET_RAW_SIZE(block->size);
+			
+			// Merge with the previous block if it is free
+			dynamic_memory_descriptor* neighbour = block->previous_physical;
+			
+			if ((neighbour != NULL) && !MEMORY_IS_BLOCK_USED(neighbour->size))
+			{
+				dynamic_memory_remove_block(current_section, neighbour);
 				
-				SCB_CleanDCache();
+				neighbour->size += MEMORY_GET_RAW_SIZE(block->size);
+				block = neighbour;
 			}
 			
-			// If any of the below checks are hit by the processor the memory is lost
-			// The user might have lost the memory pointer or changed the two 32-bit fields
-			// right behind the memory. 
-			//
-			// TODO: Memory callback, maybe reset, maybe terminate program
+			// Merge with the next block if it is free. The end descriptor is always used.
+			neighbour = MEMORY_NEXT_PHYSICAL(block);
 			
-			else
+			if (!MEMORY_IS_BLOCK_USED(neighbour->size))
 			{
-				check(0);
+				dynamic_memory_remove_block(current_section, neighbour);
+				
+				block->size += MEMORY_GET_RAW_SIZE(neighbour->size);
 			}
+			
+			MEMORY_NEXT_PHYSICAL(block)->previous_physical = block;
+			
+			// Insert the block in the free lists
+			dynamic_memory_insert_block(current_section, block);
+			
+			spinlock_release_irqrestore(&current_section->lock, state);
 		}
+		
+		// If the check below is hit by the processor the memory is lost
+		// The user might have lost the memory pointer or changed the two 32-bit fields
+		// right behind the memory. 
+		//
+		// TODO: Memory callback, maybe reset, maybe terminate program
+		
 		else
 		{
 			check(0);
@@ -418,6 +788,121 @@ void dynamic_memory_free(void* memory_object)
 //--------------------------------------------------------------------------------------------------//
 
 
+// Sets aside count blocks of at least size bytes for dynamic_memory_new_from_isr. This must be
+// called from a thread, and only once for each section. Returns zero if the section ran out of
+// memory, in which case the blocks already taken stay in the reserve.
+
+uint8_t dynamic_memory_reserve(Dynamic_memory_section memory_section, uint32_t size, uint32_t count)
+{
+	Dynamic_memory_section_s* current_section = dynamic_memory_sections[memory_section];
+	
+	check(current_section->reserve_size == 0);
+	check(count != 0);
+	
+	current_section->reserve_block_size = dynamic_memory_block_size(current_section, size);
+	current_section->reserve_size = count;
+	
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint8_t* memory_object = (uint8_t *)dynamic_memory_new_extended(memory_section, size, 8, DYNAMIC_MEMORY_FLAG_NO_ZERO);
+		
+		if (memory_object == NULL)
+		{
+			return 0;
+		}
+		
+		dynamic_memory_descriptor* block = (dynamic_memory_descriptor *)(memory_object - memory_descriptor_size);
+		
+		// Blocks freed by other threads in the meantime may already have filled the reserve
+		if (dynamic_memory_reserve_push(current_section, block) == 0)
+		{
+			dynamic_memory_free(memory_object);
+		}
+	}
+	
+	return 1;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Takes a cleared block from the reserve of the section. This never takes the section lock, and
+// may be called from any interrupt. Returns NULL if the reserve is empty or the size is larger
+// than the reserved blocks. The memory is given back with dynamic_memory_free.
+
+void* dynamic_memory_new_from_isr(Dynamic_memory_section memory_section, uint32_t size)
+{
+	Dynamic_memory_section_s* current_section = dynamic_memory_sections[memory_section];
+	
+	if (dynamic_memory_block_size(current_section, size) > current_section->reserve_block_size)
+	{
+		return NULL;
+	}
+	
+	struct atomic_stack_node* node = atomic_stack_pop(&current_section->reserve);
+	
+	if (node == NULL)
+	{
+		return NULL;
+	}
+	
+	atomic_decrement(&current_section->reserve_count);
+	
+	dynamic_memory_clear(node, current_section->reserve_block_size - memory_descriptor_size);
+	
+	return node;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The split leaves a small remainder in the block, so a reserved block may be a little larger
+// than the reserve block size
+
+static inline uint8_t dynamic_memory_is_reserve_size(Dynamic_memory_section_s* current_section, uint32_t size)
+{
+	if (size < current_section->reserve_block_size)
+	{
+		return 0;
+	}
+	
+	uint32_t remainder = size - current_section->reserve_block_size;
+	
+	return (remainder < (current_section->minimum_block_size + memory_descriptor_size)) || (remainder < memory_minimum_block_size);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Pushes a used block on the reserve stack if the reserve is not full. The stack node is kept in
+// the user memory of the block. Returns zero if the reserve is full.
+
+static uint8_t dynamic_memory_reserve_push(Dynamic_memory_section_s* current_section, dynamic_memory_descriptor* block)
+{
+	uint32_t count = atomic_read(&current_section->reserve_count);
+	
+	do
+	{
+		if (count >= current_section->reserve_size)
+		{
+			return 0;
+		}
+		
+	} while (atomic_compare_exchange(&current_section->reserve_count, &count, count + 1) == 0);
+	
+	atomic_stack_push(&current_section->reserve, (struct atomic_stack_node *)((uint8_t *)block + memory_descriptor_size));
+	
+	return 1;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+
 uint32_t dynamic_memory_get_total_size(Dynamic_memory_section memory_section)
 {
 	uint32_t tmp = dynamic_memory_sections[memory_section]->total_memory;
@@ -0,0 +1,318 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#include "slab.h"
+#include "critical_section.h"
+#include "check.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include <stddef.h>
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#define SLAB_NEXT(object)		(*(void **)(object))
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static struct slab_cache* slab_cache_list;
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static uint8_t slab_cache_grow(struct slab_cache* cache);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Initializes a statically allocated cache. The alignment must be a power of two, and the object
+// size is rounded up to it. No slab is allocated before the first object is asked for.
+
+void slab_cache_init(struct slab_cache* cache, const char* name, Dynamic_memory_section section, uint32_t object_size, uint32_t alignment, uint32_t objects_per_slab)
+{
+	check((alignment & (alignment - 1)) == 0);
+	check(objects_per_slab != 0);
+	
+	// A free object must hold the free list link
+	if (alignment < sizeof(void *))
+	{
+		alignment = sizeof(void *);
+	}
+	
+	if (object_size < sizeof(void *))
+	{
+		object_size = sizeof(void *);
+	}
+	
+	cache->name = name;
+	cache->section = section;
+	cache->object_size = (object_size + alignment - 1) & ~(alignment - 1);
+	cache->alignment = alignment;
+	cache->objects_per_slab = objects_per_slab;
+	
+	cache->free_list = NULL;
+	cache->slab_list = NULL;
+	cache->allocated = 0;
+	
+	cache->stats.object_size = cache->object_size;
+	cache->stats.slab_count = 0;
+	cache->stats.total_objects = 0;
+	cache->stats.used_objects = 0;
+	cache->stats.peak_used_objects = 0;
+	cache->stats.allocations = 0;
+	cache->stats.failures = 0;
+	
+	CRITICAL_SECTION_ENTER();
+	
+	cache->next = slab_cache_list;
+	slab_cache_list = cache;
+	
+	CRITICAL_SECTION_LEAVE();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Allocates and initializes a new cache. The cache structure is taken from the same section as
+// the slabs. This must not be called from interrupt context.
+
+struct slab_cache* slab_cache_new(const char* name, Dynamic_memory_section section, uint32_t object_size, uint32_t alignment, uint32_t objects_per_slab)
+{
+	struct slab_cache* cache = (struct slab_cache *)dynamic_memory_new(section, sizeof(struct slab_cache));
+	
+	if (cache == NULL)
+	{
+		check(0);
+		return NULL;
+	}
+	
+	slab_cache_init(cache, name, section, object_size, alignment, objects_per_slab);
+	
+	cache->allocated = 1;
+	
+	return cache;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Gives every slab back to the section. All objects must have been freed.
+
+void slab_cache_delete(struct slab_cache* cache)
+{
+	check(cache->stats.used_objects == 0);
+	
+	CRITICAL_SECTION_ENTER();
+	
+	struct slab_cache** it = &slab_cache_list;
+	
+	while ((*it != NULL) && (*it != cache))
+	{
+		it = &((*it)->next);
+	}
+	
+	if (*it != NULL)
+	{
+		*it = cache->next;
+	}
+	
+	CRITICAL_SECTION_LEAVE();
+	
+	void* slab = cache->slab_list;
+	
+	while (slab != NULL)
+	{
+		void* next = SLAB_NEXT(slab);
+		
+		dynamic_memory_free(slab);
+		
+		slab = next;
+	}
+	
+	cache->free_list = NULL;
+	cache->slab_list = NULL;
+	
+	if (cache->allocated)
+	{
+		dynamic_memory_free(cache);
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Grows the cache until at least count objects are free. Returns 0 if the section is full.
+
+uint8_t slab_cache_reserve(struct slab_cache* cache, uint32_t count)
+{
+	while ((cache->stats.total_objects - cache->stats.used_objects) < count)
+	{
+		if (slab_cache_grow(cache) == 0)
+		{
+			return 0;
+		}
+	}
+	
+	return 1;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Returns a cleared object, or NULL if the cache is empty and can not grow
+
+void* slab_new(struct slab_cache* cache)
+{
+	void* object = NULL;
+	
+	while (1)
+	{
+		CRITICAL_SECTION_ENTER();
+		
+		object = cache->free_list;
+		
+		if (object != NULL)
+		{
+			cache->free_list = SLAB_NEXT(object);
+			
+			cache->stats.allocations++;
+			cache->stats.used_objects++;
+			
+			if (cache->stats.used_objects > cache->stats.peak_used_objects)
+			{
+				cache->stats.peak_used_objects = cache->stats.used_objects;
+			}
+		}
+		
+		CRITICAL_SECTION_LEAVE();
+		
+		// The dynamic memory can not be used from interrupts, so only a thread may grow the cache
+		if ((object != NULL) || (__get_IPSR() != 0) || (slab_cache_grow(cache) == 0))
+		{
+			break;
+		}
+	}
+	
+	if (object == NULL)
+	{
+		CRITICAL_SECTION_ENTER();
+		
+		cache->stats.failures++;
+		
+		CRITICAL_SECTION_LEAVE();
+		
+		return NULL;
+	}
+	
+	// Clear the object one word at a time
+	uint32_t* word = (uint32_t *)object;
+	
+	for (uint32_t i = 0; i < (cache->object_size / sizeof(uint32_t)); i++)
+	{
+		word[i] = 0;
+	}
+	
+	return object;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void slab_free(struct slab_cache* cache, void* object)
+{
+	check(object != NULL);
+	
+	CRITICAL_SECTION_ENTER();
+	
+	SLAB_NEXT(object) = cache->free_list;
+	cache->free_list = object;
+	
+	cache->stats.used_objects--;
+	
+	CRITICAL_SECTION_LEAVE();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void slab_cache_get_stats(struct slab_cache* cache, struct slab_cache_stats* stats)
+{
+	CRITICAL_SECTION_ENTER();
+	
+	*stats = cache->stats;
+	
+	CRITICAL_SECTION_LEAVE();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+struct slab_cache* slab_cache_get_list(void)
+{
+	return slab_cache_list;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Takes a new slab from the section. The slab starts with the link to the next slab, and the
+// objects start at the first aligned address after it. The objects are linked to each other
+// before the critical section, so that only the splice is done with the interrupts masked.
+
+static uint8_t slab_cache_grow(struct slab_cache* cache)
+{
+	uint32_t size = sizeof(void *) + cache->alignment - 1 + cache->objects_per_slab * cache->object_size;
+	
+	uint8_t* slab = (uint8_t *)dynamic_memory_new(cache->section, size);
+	
+	if (slab == NULL)
+	{
+		return 0;
+	}
+	
+	uint8_t* first = (uint8_t *)(((uint32_t)slab + sizeof(void *) + cache->alignment - 1) & ~(cache->alignment - 1));
+	uint8_t* last = first + (cache->objects_per_slab - 1) * cache->object_size;
+	
+	for (uint8_t* object = first; object < last; object += cache->object_size)
+	{
+		SLAB_NEXT(object) = object + cache->object_size;
+	}
+	
+	CRITICAL_SECTION_ENTER();
+	
+	SLAB_NEXT(slab) = cache->slab_list;
+	cache->slab_list = slab;
+	
+	SLAB_NEXT(last) = cache->free_list;
+	cache->free_list = first;
+	
+	cache->stats.slab_count++;
+	cache->stats.total_objects += cache->objects_per_slab;
+	
+	CRITICAL_SECTION_LEAVE();
+	
+	return 1;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
\ No newline at end of file
@@ -9,6 +9,7 @@
 #include "board_sd_card.h"
 #include "board_serial.h"
 #include "dma.h"
+#include "dma_memory.h"
 
 
 //--------------------------------------------------------------------------------------------------//
@@ -999,7 +1000,8 @@ uint8_t sd_protocol_dma_read(sd_card* card, uint8_t *data, uint32_t sector, uint
 	
 	hsmci_send_command(HSMCI, 12 | SD_PROTOCOL_RESPONSE_1b, 0, CHECK_CRC);
 	
-	SCB_InvalidateDCache_by_Addr((uint32_t *)((uint32_t)data & ~32), count * 512 + 32);
+	// Drop any cached copy of the data written by the DMA
+	dma_memory_invalidate(data, count * 512);
 	
 	return 1;
 }
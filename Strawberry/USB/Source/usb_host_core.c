@@ -11,8 +11,16 @@
 #include "clock.h"
 #include "config.h"
 #include "usbhs.h"
-#include "systick.h"
 #include "usb_descriptors.h"
+#include "work_queue.h"
+#include "critical_section.h"
+#include "scheduler.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include <stddef.h>
 
 
 //--------------------------------------------------------------------------------------------------//
@@ -20,6 +28,21 @@
 
 void usb_host_defaut_pipe_enable(void);
 
+static void usb_host_work_handler(void* argument);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The USB interrupt only collects the interrupt status. The handlers run from the USB work queue,
+// where they may print and wait without blocking other interrupts.
+
+static struct work_queue* usb_host_work_queue;
+
+static struct work usb_host_work = WORK_INITIALIZER(usb_host_work, usb_host_work_handler, NULL);
+
+static volatile uint32_t usb_host_pending_status;
+
 
 //--------------------------------------------------------------------------------------------------//
 
@@ -35,6 +58,12 @@ void usb_host_init(void)
 	usbhs_global_unfreeze_clock();
 	usbhs_global_enable();
 	
+	// The USB handlers run in this work queue
+	if (usb_host_work_queue == NULL)
+	{
+		usb_host_work_queue = work_queue_new("USB", USB_HOST_WORK_QUEUE_PRIORITY, USB_HOST_WORK_QUEUE_STACK_SIZE);
+	}
+	
 	// Enable the USB PLL and the USB full speed clock
 	clock_usb_pll_config(CLOCK_SOURCE_FREQUENCY_12_MHZ, CLOCK_USB_PLL_STARTUP_TIME, 1);
 	clock_usb_config(CLOCK_USB_SOURCE_USB_PLL, CLOCK_USB_FULL_SPEED_DIVIDER);
@@ -117,7 +146,7 @@ void usb_host_root_hub_handler(uint32_t status)
 		
 		// According to specification wait 100ms before attempting reset
 		// this is due to the mechanical insertion and power distribution
-		systick_delay_milliseconds(100);
+		thread_delay(100);
 		
 		// Issue a reset
 		usbhs_host_send_reset();
@@ -263,17 +292,42 @@ void usb_host_get_device_descriptor(void)
 
 void USBHS_Handler()
 {
-	board_serial_print("\n--------------------------- IRQ ---------------------------\n");
+	scheduler_interrupt_enter();
 	
 	// Read the interrupt status register
 	// This will NOT clear interrupt bits, and this must be done manually
 	uint32_t status = usbhs_host_get_interrupt_status_register();
 	
-	board_serial_print_register("Host interrupt register", status);
-	
 	// Clear all interrupt just for DEBUG purpose
 	usbhs_host_interrupt_clear(0xffffffff);
+	
+	// Collect the status until the work handler runs
+	usb_host_pending_status |= status;
+	
+	work_queue_submit(usb_host_work_queue, &usb_host_work);
+	
+	scheduler_interrupt_leave();
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
 
+static void usb_host_work_handler(void* argument)
+{
+	uint32_t status;
+	
+	CRITICAL_SECTION_ENTER();
+	
+	status = usb_host_pending_status;
+	usb_host_pending_status = 0;
+	
+	CRITICAL_SECTION_LEAVE();
+	
+	board_serial_print("\n--------------------------- IRQ ---------------------------\n");
+	
+	board_serial_print_register("Host interrupt register", status);
+	
 	
 	// Start of frame interrupt detected
 	// Something
@@ -304,9 +358,10 @@ void USBHS_Handler()
 
 	board_serial_print("-----------------------------------------------------------\n\n\n");
 	
+	// Slow down the start of frame debug prints
 	if (status & USBHS_HSTISR_HSOFI_Msk)
 	{
-		systick_delay_milliseconds(800);
+		thread_delay(800);
 	}
 }
 
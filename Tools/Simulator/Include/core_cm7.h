@@ -0,0 +1,23 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#ifndef CORE_CM7_H
+#define CORE_CM7_H
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The core definitions are all in the simulator sam.h
+
+#include "sam.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#endif
\ No newline at end of file
@@ -0,0 +1,115 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+#ifndef SAM_H
+#define SAM_H
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Host replacement for the device header. The kernel sources only touch a handful of core
+// registers. These are plain structures in host memory, and the simulator reads and writes them
+// the way the hardware would.
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include <stdint.h>
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#define __IO	volatile
+#define __I		volatile const
+#define __O		volatile
+
+
+typedef enum
+{
+	PendSV_IRQn		= -2,
+	SysTick_IRQn	= -1
+} IRQn_Type;
+
+
+typedef struct
+{
+	__IO uint32_t	ICSR;
+} SCB_Type;
+
+
+typedef struct
+{
+	__IO uint32_t	CTRL;
+	__IO uint32_t	CYCCNT;
+	__O uint32_t	LAR;
+} DWT_Type;
+
+
+typedef struct
+{
+	__IO uint32_t	DEMCR;
+} CoreDebug_Type;
+
+
+typedef struct
+{
+	__IO uint32_t	PIO_SODR;
+	__IO uint32_t	PIO_CODR;
+} Pio;
+
+
+extern SCB_Type*		SCB;
+extern DWT_Type*		DWT;
+extern CoreDebug_Type*	CoreDebug;
+extern Pio*				PIOC;
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#define SCB_ICSR_PENDSVSET_Pos			28
+#define SCB_ICSR_PENDSVSET_Msk			(1UL << SCB_ICSR_PENDSVSET_Pos)
+#define SCB_ICSR_PENDSTSET_Pos			26
+#define SCB_ICSR_PENDSTSET_Msk			(1UL << SCB_ICSR_PENDSTSET_Pos)
+
+#define SysTick_LOAD_RELOAD_Msk			0x00ffffffUL
+
+#define DWT_CTRL_CYCCNTENA_Msk			1UL
+#define CoreDebug_DEMCR_TRCENA_Msk		(1UL << 24)
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Core intrinsics. The simulator runs the kernel on a single host thread, so the barriers and
+// exclusive accesses have nothing to order.
+
+#define __CLZ(value)					((value) ? (uint32_t)__builtin_clz(value) : 32U)
+#define __DSB()
+#define __ISB()
+#define __DMB()
+#define __WFI()
+#define __NOP()
+
+// Always thread mode
+#define __get_IPSR()					0U
+
+#define __LDREXW(address)				(*(address))
+#define __STREXW(value, address)		(*(address) = (value), 0U)
+
+#define SCB_CleanDCache()
+#define SCB_CleanDCache_by_Addr(address, size)
+#define SCB_InvalidateDCache_by_Addr(address, size)
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#endif
\ No newline at end of file
@@ -0,0 +1,347 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+// Host test of the atomic operations
+//
+// The kernel source atomic.c is compiled unchanged for the host, where it is built on the GCC
+// atomic builtins. The test first checks the result of every operation from a single thread.
+// Then a few host threads run the operations at the same time. They add to a shared counter with
+// the fetch operations and a compare and exchange loop, push their own nodes on a shared stack,
+// and push numbered nodes into a queue drained by one consumer. The consumer checks that no node
+// is lost or duplicated, and that the nodes of each producer arrive in order. Build with make
+// atomic_test and run
+//
+//     ./atomic_test -p 4 -n 1000000
+//
+// The stack is only popped from one thread. The host pop is a plain compare and exchange, and a
+// node popped and pushed again by another thread in between would not be detected.
+
+#include "atomic.h"
+#include "check.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <pthread.h>
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#define TEST_MAX_PRODUCERS			16
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+struct test_node
+{
+	struct atomic_queue_node	queue_node;
+	struct atomic_stack_node	stack_node;
+	
+	uint32_t					producer;
+	uint32_t					sequence;
+};
+
+
+struct test_producer
+{
+	pthread_t			thread;
+	uint32_t			index;
+	
+	struct test_node*	nodes;
+};
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static uint32_t producer_count = 4;
+static uint32_t node_count = 1000000;
+
+static struct atomic_queue test_queue;
+static struct atomic_stack test_stack;
+
+static volatile uint32_t test_counter;
+static volatile uint32_t test_cas_counter;
+static volatile uint64_t test_counter_64;
+
+static volatile uint32_t test_start;
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void check_handler(uint8_t condition, const char* filename, uint32_t line_number)
+{
+	if (condition == 0)
+	{
+		fprintf(stderr, "Check failed in %s line %u\n", filename, line_number);
+		abort();
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void test_single_thread(void)
+{
+	volatile uint32_t value = 10;
+	uint32_t expected;
+	
+	atomic_increment(&value);
+	check(atomic_read(&value) == 11);
+	
+	atomic_decrement(&value);
+	atomic_write(&value, atomic_read(&value) + 1);
+	check(value == 11);
+	
+	check(atomic_exchange(&value, 5) == 11);
+	check(value == 5);
+	
+	// A failed compare and exchange returns the current value in expected
+	expected = 4;
+	check(atomic_compare_exchange(&value, &expected, 9) == 0);
+	check((expected == 5) && (value == 5));
+	
+	check(atomic_compare_exchange(&value, &expected, 9) == 1);
+	check(value == 9);
+	
+	check(atomic_fetch_add(&value, 3) == 9);
+	check(atomic_fetch_sub(&value, 2) == 12);
+	check(atomic_fetch_and(&value, 0x6) == 10);
+	check(atomic_fetch_or(&value, 0x9) == 2);
+	check(atomic_fetch_xor(&value, 0xf) == 11);
+	check(value == 4);
+	
+	// The fetch operations wrap around
+	value = 0;
+	check(atomic_fetch_sub(&value, 1) == 0);
+	check(value == 0xffffffff);
+	
+	int object;
+	void* volatile pointer = NULL;
+	void* expected_pointer = &object;
+	
+	check(atomic_compare_exchange_pointer(&pointer, &expected_pointer, &expected) == 0);
+	check(expected_pointer == NULL);
+	check(atomic_compare_exchange_pointer(&pointer, &expected_pointer, &object) == 1);
+	check(atomic_exchange_pointer(&pointer, NULL) == &object);
+	check(pointer == NULL);
+	
+	volatile uint64_t value_64 = 0xffffffff;
+	uint64_t expected_64 = 0;
+	
+	check(atomic_fetch_add_64(&value_64, 1) == 0xffffffff);
+	check(atomic_read_64(&value_64) == 0x100000000);
+	check(atomic_compare_exchange_64(&value_64, &expected_64, 1) == 0);
+	check(expected_64 == 0x100000000);
+	check(atomic_compare_exchange_64(&value_64, &expected_64, 0x123456789) == 1);
+	check(atomic_exchange_64(&value_64, 7) == 0x123456789);
+	atomic_write_64(&value_64, 8);
+	check(value_64 == 8);
+	
+	// The stack returns the nodes in the reverse order
+	struct test_node nodes[3];
+	
+	atomic_stack_init(&test_stack);
+	check(atomic_stack_pop(&test_stack) == NULL);
+	
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		atomic_stack_push(&test_stack, &nodes[i].stack_node);
+	}
+	
+	for (uint32_t i = 3; i > 0; i--)
+	{
+		check(atomic_stack_pop(&test_stack) == &nodes[i - 1].stack_node);
+	}
+	
+	check(atomic_stack_pop(&test_stack) == NULL);
+	
+	// The queue returns the nodes in order, also when it is emptied and filled again
+	atomic_queue_init(&test_queue);
+	check(atomic_queue_pop(&test_queue) == NULL);
+	
+	for (uint32_t round = 0; round < 3; round++)
+	{
+		for (uint32_t i = 0; i <= round; i++)
+		{
+			atomic_queue_push(&test_queue, &nodes[i].queue_node);
+		}
+		
+		for (uint32_t i = 0; i <= round; i++)
+		{
+			check(atomic_queue_pop(&test_queue) == &nodes[i].queue_node);
+		}
+		
+		check(atomic_queue_pop(&test_queue) == NULL);
+	}
+	
+	printf("Single thread            passed\n");
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void* test_producer_thread(void* parameter)
+{
+	struct test_producer* producer = (struct test_producer *)parameter;
+	
+	while (atomic_read(&test_start) == 0)
+	{
+		
+	}
+	
+	for (uint32_t i = 0; i < node_count; i++)
+	{
+		struct test_node* node = &producer->nodes[i];
+		
+		node->producer = producer->index;
+		node->sequence = i;
+		
+		atomic_queue_push(&test_queue, &node->queue_node);
+		atomic_stack_push(&test_stack, &node->stack_node);
+		
+		atomic_fetch_add(&test_counter, 1);
+		atomic_fetch_add_64(&test_counter_64, 1);
+		
+		uint32_t expected = atomic_read(&test_cas_counter);
+		
+		while (atomic_compare_exchange(&test_cas_counter, &expected, expected + 1) == 0)
+		{
+			
+		}
+	}
+	
+	return NULL;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void test_threads(void)
+{
+	struct test_producer producers[TEST_MAX_PRODUCERS];
+	uint32_t next_sequence[TEST_MAX_PRODUCERS] = { 0 };
+	
+	atomic_queue_init(&test_queue);
+	atomic_stack_init(&test_stack);
+	
+	for (uint32_t i = 0; i < producer_count; i++)
+	{
+		producers[i].index = i;
+		producers[i].nodes = (struct test_node *)calloc(node_count, sizeof(struct test_node));
+		
+		pthread_create(&producers[i].thread, NULL, test_producer_thread, &producers[i]);
+	}
+	
+	atomic_write(&test_start, 1);
+	
+	// The main thread is the consumer of the queue. A pop can fail while a push is in progress.
+	uint64_t total = (uint64_t)producer_count * node_count;
+	uint64_t received = 0;
+	uint64_t empty_pops = 0;
+	
+	while (received < total)
+	{
+		struct atomic_queue_node* queue_node = atomic_queue_pop(&test_queue);
+		
+		if (queue_node == NULL)
+		{
+			empty_pops++;
+			continue;
+		}
+		
+		struct test_node* node = (struct test_node *)queue_node;
+		
+		check(node->producer < producer_count);
+		check(node->sequence == next_sequence[node->producer]);
+		
+		next_sequence[node->producer]++;
+		received++;
+	}
+	
+	for (uint32_t i = 0; i < producer_count; i++)
+	{
+		pthread_join(producers[i].thread, NULL);
+	}
+	
+	check(atomic_queue_pop(&test_queue) == NULL);
+	
+	check(test_counter == (uint32_t)total);
+	check(test_cas_counter == (uint32_t)total);
+	check(test_counter_64 == total);
+	
+	// Every node must be on the stack once
+	uint64_t popped = 0;
+	struct atomic_stack_node* stack_node;
+	
+	while ((stack_node = atomic_stack_pop(&test_stack)) != NULL)
+	{
+		struct test_node* node = (struct test_node *)((uint8_t *)stack_node - offsetof(struct test_node, stack_node));
+		
+		// Mark the node, so that a node popped twice is caught
+		check(node->sequence != 0xffffffff);
+		node->sequence = 0xffffffff;
+		
+		popped++;
+	}
+	
+	check(popped == total);
+	
+	printf("Threads                  %u producers, %llu nodes, %llu empty pops, passed\n", producer_count, (unsigned long long)total, (unsigned long long)empty_pops);
+	
+	for (uint32_t i = 0; i < producer_count; i++)
+	{
+		free(producers[i].nodes);
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+int main(int argc, char** argv)
+{
+	int option;
+	
+	while ((option = getopt(argc, argv, "p:n:")) != -1)
+	{
+		switch (option)
+		{
+			case 'p' : producer_count = strtoul(optarg, NULL, 0); break;
+			case 'n' : node_count = strtoul(optarg, NULL, 0); break;
+			default :
+				fprintf(stderr, "usage: %s [-p producers] [-n nodes per producer]\n", argv[0]);
+				return 1;
+		}
+	}
+	
+	if ((producer_count == 0) || (producer_count > TEST_MAX_PRODUCERS))
+	{
+		fprintf(stderr, "The number of producers must be 1 to %u\n", TEST_MAX_PRODUCERS);
+		return 1;
+	}
+	
+	test_single_thread();
+	test_threads();
+	
+	return 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
\ No newline at end of file
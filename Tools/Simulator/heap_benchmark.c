@@ -0,0 +1,1170 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+// Host benchmark of the dynamic memory allocator
+//
+// Replays an allocation trace against the kernel TLSF allocator in dynamic_memory.c, compiled
+// unchanged for the host, and against a copy of the first fit allocator it replaced. Both start
+// with an empty 512 kB heap. Build with make heap_benchmark and run
+//
+//     ./heap_benchmark -n 200000 -s 1
+//     ./heap_benchmark trace.txt
+//
+// Without a trace file a random trace is generated. A trace file has one operation per line,
+// "a <slot> <size>" allocates size bytes into the slot, and "f <slot>" frees the slot. The
+// benchmark reports the average and the worst host time of the allocations and the frees. The
+// allocation time includes zeroing the memory, and the worst times include any host scheduling
+// noise, so compare them over a few runs.
+//
+// With -T the benchmark instead measures the memory side of making and deleting short lived
+// threads, using thread_pool.c and slab.c compiled unchanged. A few threads are kept alive, and
+// the oldest is deleted every time a new thread is made. Making a thread takes the thread
+// structure and the stack, paints the stack and writes the initial stack frame, the way
+// thread_new does. The pooled path is compared with the path it replaced, which allocated the
+// thread structure and the stack together from the zeroing first fit heap. The clean of the whole
+// data cache done by the old path has no host equivalent and is not counted.
+//
+// With -C the benchmark instead checks the kernel allocator. It makes random allocations with
+// random alignments, reallocations and frees in DRAM bank 0. Every object is filled with its own
+// pattern, which must survive until the object is freed, also when it is moved by a
+// reallocation. An allocation without DYNAMIC_MEMORY_FLAG_NO_ZERO must read as zero. After every operation the blocks of the section are walked through the physical
+// links, and the sizes, the links back, the merging of free blocks, the free lists and the
+// free memory accounting are checked. The first failed check aborts the benchmark. The interrupt
+// reserve is then checked on a fresh section. It is drained with dynamic_memory_new_from_isr and
+// refilled by frees, a free with the reserve full must go back to the free lists, and a request
+// larger than the reserved blocks must fail.
+
+#include "dynamic_memory.h"
+#include "thread_pool.h"
+#include "check.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#define BENCHMARK_SLOTS				1024
+#define BENCHMARK_HEAP_SIZE			0x80000
+
+// Threads alive at a time in the thread benchmark
+#define BENCHMARK_LIVE_THREADS		8
+
+// Objects alive at a time in the allocator check
+#define BENCHMARK_CHECK_SLOTS		256
+
+// Interrupt reserve used by the allocator check
+#define BENCHMARK_RESERVE_SIZE		100
+#define BENCHMARK_RESERVE_COUNT		8
+
+// The block descriptor bits in dynamic_memory.c
+#define BENCHMARK_BLOCK_USED		0x80000000
+#define BENCHMARK_BLOCK_SIZE(size)	((size) & 0xfffffff)
+
+// The DRAM sections in dynamic_memory.c have fixed addresses, which are mapped on the host
+#define BENCHMARK_DRAM_ADDRESS		0x70000000
+#define BENCHMARK_DRAM_SIZE			0x100000
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The SRAM sections get their addresses from the linker script on the target. The benchmark is
+// linked without PIE, so these symbols stay below 4 GB like every section address.
+
+__asm__(".pushsection .bss\n"
+		".balign 8\n"
+		".globl _sheap\n"
+		"_sheap:\n"
+		".space 0x10000\n"
+		".globl _eheap\n"
+		"_eheap:\n"
+		".globl _sdma_heap\n"
+		"_sdma_heap:\n"
+		".space 0x1000\n"
+		".globl _edma_memory\n"
+		"_edma_memory:\n"
+		".popsection\n");
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+struct trace_operation
+{
+	uint32_t	slot;
+	
+	// Zero frees the slot
+	uint32_t	size;
+};
+
+
+struct trace
+{
+	struct trace_operation*	operations;
+	uint32_t				count;
+};
+
+
+struct benchmark_result
+{
+	uint64_t	allocation_ns;
+	uint64_t	allocation_max_ns;
+	uint32_t	allocations;
+	uint32_t	failures;
+	
+	uint64_t	free_ns;
+	uint64_t	free_max_ns;
+	uint32_t	frees;
+};
+
+
+struct benchmark_allocator
+{
+	const char*	name;
+	
+	void		(*reset)(void);
+	void*		(*allocate)(uint32_t size);
+	void		(*free)(void* memory);
+};
+
+
+struct benchmark_thread_path
+{
+	const char*					name;
+	
+	struct thread_structure*	(*new)(uint32_t stack_size);
+	void						(*delete)(struct thread_structure* thread);
+};
+
+
+// Stack sizes in words of the threads made by the thread benchmark
+static const uint32_t benchmark_stack_sizes[] = { 100, 200, 400, 1000 };
+
+
+struct benchmark_check_slot
+{
+	uint8_t*	memory;
+	uint32_t	size;
+	uint8_t		pattern;
+};
+
+
+struct benchmark_check_result
+{
+	uint32_t	allocations;
+	uint32_t	aligned_allocations;
+	uint32_t	reallocations;
+	uint32_t	moved;
+	uint32_t	frees;
+	uint32_t	failures;
+};
+
+
+// Internals of the kernel allocator used by the check
+
+extern Dynamic_memory_section_s* dynamic_memory_sections[];
+extern const uint8_t memory_descriptor_size;
+extern const uint8_t memory_minimum_block_size;
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The first fit allocator used before the TLSF allocator. It keeps one address ordered list of
+// the free blocks, and walks it on both allocation and free.
+
+struct first_fit_descriptor
+{
+	struct first_fit_descriptor*	next;
+	uint32_t						size;
+};
+
+
+struct first_fit_heap
+{
+	uint8_t*						memory;
+	uint32_t						free_memory;
+	
+	struct first_fit_descriptor		start_descriptor_object;
+	struct first_fit_descriptor*	start_descriptor;
+	struct first_fit_descriptor*	end_descriptor;
+};
+
+
+#define FIRST_FIT_DESCRIPTOR_SIZE		((sizeof(struct first_fit_descriptor) + 8 - 1) & ~(8 - 1))
+#define FIRST_FIT_MINIMUM_BLOCK_SIZE	8
+#define FIRST_FIT_USED					0x80000000
+#define FIRST_FIT_RAW_SIZE(size)		((size) & 0xfffffff)
+
+
+static struct first_fit_heap first_fit;
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void first_fit_reset(void)
+{
+	uint32_t total = BENCHMARK_HEAP_SIZE - FIRST_FIT_DESCRIPTOR_SIZE;
+	
+	if (first_fit.memory == NULL)
+	{
+		first_fit.memory = malloc(BENCHMARK_HEAP_SIZE);
+	}
+	
+	memset(first_fit.memory, 0, BENCHMARK_HEAP_SIZE);
+	
+	first_fit.free_memory = total;
+	first_fit.start_descriptor = &first_fit.start_descriptor_object;
+	first_fit.end_descriptor = (struct first_fit_descriptor *)(first_fit.memory + total);
+	
+	first_fit.start_descriptor->next = (struct first_fit_descriptor *)first_fit.memory;
+	first_fit.start_descriptor->next->next = first_fit.end_descriptor;
+	first_fit.start_descriptor->next->size = total;
+	
+	first_fit.end_descriptor->next = NULL;
+	first_fit.end_descriptor->size = FIRST_FIT_USED;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void first_fit_insert_block(struct first_fit_descriptor* block)
+{
+	struct first_fit_descriptor* iterator;
+	
+	for (iterator = first_fit.start_descriptor; iterator->next < block; iterator = iterator->next)
+	{
+	}
+	
+	if (((uint8_t *)iterator + FIRST_FIT_RAW_SIZE(iterator->size)) == (uint8_t *)block)
+	{
+		iterator->size += FIRST_FIT_RAW_SIZE(block->size);
+		block = iterator;
+	}
+	
+	if (((uint8_t *)block + FIRST_FIT_RAW_SIZE(block->size)) == (uint8_t *)iterator->next)
+	{
+		if (iterator->next != first_fit.end_descriptor)
+		{
+			block->size += FIRST_FIT_RAW_SIZE(iterator->next->size);
+			block->next = iterator->next->next;
+		}
+		else
+		{
+			block->next = first_fit.end_descriptor;
+		}
+	}
+	else
+	{
+		block->next = iterator->next;
+	}
+	
+	if (block != iterator)
+	{
+		iterator->next = block;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void* first_fit_allocate(uint32_t size)
+{
+	void* return_value = NULL;
+	
+	if (size < FIRST_FIT_MINIMUM_BLOCK_SIZE)
+	{
+		size = FIRST_FIT_MINIMUM_BLOCK_SIZE;
+	}
+	
+	size = (size + FIRST_FIT_DESCRIPTOR_SIZE + 8 - 1) & ~(8 - 1);
+	
+	if (size < first_fit.free_memory)
+	{
+		struct first_fit_descriptor* previous = first_fit.start_descriptor;
+		struct first_fit_descriptor* current = first_fit.start_descriptor->next;
+		
+		while ((FIRST_FIT_RAW_SIZE(current->size) < size) && (current->next != NULL))
+		{
+			previous = current;
+			current = current->next;
+		}
+		
+		if (current != first_fit.end_descriptor)
+		{
+			return_value = (uint8_t *)current + FIRST_FIT_DESCRIPTOR_SIZE;
+			
+			previous->next = current->next;
+			
+			if ((FIRST_FIT_RAW_SIZE(current->size) - size) >= (FIRST_FIT_MINIMUM_BLOCK_SIZE + FIRST_FIT_DESCRIPTOR_SIZE))
+			{
+				struct first_fit_descriptor* block_to_insert = (struct first_fit_descriptor *)((uint8_t *)current + size);
+				
+				block_to_insert->size = current->size - size;
+				current->size = size;
+				
+				first_fit_insert_block(block_to_insert);
+			}
+			
+			first_fit.free_memory -= FIRST_FIT_RAW_SIZE(current->size);
+			
+			current->next = NULL;
+			current->size |= FIRST_FIT_USED;
+			
+			uint8_t* tmp = (uint8_t *)return_value;
+			
+			for (uint32_t i = 0; i < (FIRST_FIT_RAW_SIZE(current->size) - FIRST_FIT_DESCRIPTOR_SIZE); i++)
+			{
+				*tmp++ = 0;
+			}
+		}
+	}
+	
+	return return_value;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void first_fit_free(void* memory)
+{
+	struct first_fit_descriptor* block = (struct first_fit_descriptor *)((uint8_t *)memory - FIRST_FIT_DESCRIPTOR_SIZE);
+	
+	check((block->next == NULL) && (block->size & FIRST_FIT_USED));
+	
+	block->size &= ~FIRST_FIT_USED;
+	first_fit.free_memory += FIRST_FIT_RAW_SIZE(block->size);
+	
+	first_fit_insert_block(block);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The kernel allocator works on DRAM bank 0, which has the same size as the first fit heap
+
+static void tlsf_reset(void)
+{
+	dynamic_memory_config();
+}
+
+
+static void* tlsf_allocate(uint32_t size)
+{
+	return dynamic_memory_new(DRAM_BANK_0, size);
+}
+
+
+static void tlsf_free(void* memory)
+{
+	dynamic_memory_free(memory);
+}
+
+
+static const struct benchmark_allocator allocators[] =
+{
+	{ "First fit", first_fit_reset, first_fit_allocate, first_fit_free },
+	{ "TLSF", tlsf_reset, tlsf_allocate, tlsf_free }
+};
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Paints the stack and writes the initial stack frame and the name, like thread_new
+
+static void benchmark_thread_init(struct thread_structure* thread)
+{
+	uint32_t stack_size = thread->stack_size / sizeof(uint32_t);
+	
+	for (uint32_t i = 0; i < stack_size; i++)
+	{
+		thread->stack_base[i] = KERNEL_STACK_PAINT_PATTERN;
+	}
+	
+	thread->stack_pointer = thread->stack_base + stack_size - 17;
+	thread->stack_watermark = thread->stack_pointer;
+	
+	for (uint32_t i = 0; i < 16; i++)
+	{
+		thread->stack_pointer[i] = 0;
+	}
+	
+	strcpy(thread->name, "Worker");
+	
+	thread->priority = THREAD_PRIORITY_NORMAL;
+	thread->base_priority = THREAD_PRIORITY_NORMAL;
+}
+
+
+static struct thread_structure* first_fit_thread_new(uint32_t stack_size)
+{
+	struct thread_structure* thread = (struct thread_structure *)first_fit_allocate(sizeof(struct thread_structure) + stack_size * sizeof(uint32_t));
+	
+	if (thread != NULL)
+	{
+		thread->stack_base = (uint32_t *)(thread + 1);
+		thread->stack_size = stack_size * sizeof(uint32_t);
+		
+		benchmark_thread_init(thread);
+	}
+	
+	return thread;
+}
+
+
+static void first_fit_thread_delete(struct thread_structure* thread)
+{
+	first_fit_free(thread);
+}
+
+
+static struct thread_structure* pool_thread_new(uint32_t stack_size)
+{
+	struct thread_structure* thread = thread_pool_new(stack_size);
+	
+	if (thread != NULL)
+	{
+		benchmark_thread_init(thread);
+	}
+	
+	return thread;
+}
+
+
+static const struct benchmark_thread_path thread_paths[] =
+{
+	{ "First fit", first_fit_thread_new, first_fit_thread_delete },
+	{ "Pools", pool_thread_new, thread_pool_free }
+};
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void check_handler(uint8_t condition, const char* filename, uint32_t line_number)
+{
+	if (condition == 0)
+	{
+		fprintf(stderr, "Check failed in %s line %u\n", filename, line_number);
+		abort();
+	}
+}
+
+
+// The section locks mask the kernel interrupts on the target. The benchmark has a single thread.
+
+void core_enter_critical_section(uint32_t volatile *atomic)
+{
+	
+}
+
+
+void core_leave_critical_section(uint32_t volatile *atomic)
+{
+	
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static uint32_t benchmark_random_state;
+
+
+static uint32_t benchmark_random(void)
+{
+	benchmark_random_state ^= benchmark_random_state << 13;
+	benchmark_random_state ^= benchmark_random_state >> 17;
+	benchmark_random_state ^= benchmark_random_state << 5;
+	
+	return benchmark_random_state;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Makes a trace of mostly small objects with some buffers in between. A random slot is picked for
+// every operation. An empty slot is allocated and a used slot is freed, so the heap settles
+// around half the slots in use.
+
+static void benchmark_generate_trace(struct trace* trace, uint32_t count, uint32_t seed)
+{
+	uint8_t used[BENCHMARK_SLOTS] = { 0 };
+	
+	benchmark_random_state = (seed != 0) ? seed : 1;
+	
+	trace->operations = malloc(count * sizeof(struct trace_operation));
+	trace->count = count;
+	
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t slot = benchmark_random() % BENCHMARK_SLOTS;
+		uint32_t size = 0;
+		
+		if (used[slot] == 0)
+		{
+			uint32_t kind = benchmark_random() % 100;
+			
+			if (kind < 70)
+			{
+				size = 8 + benchmark_random() % 120;
+			}
+			else if (kind < 95)
+			{
+				size = 128 + benchmark_random() % 896;
+			}
+			else
+			{
+				size = 1024 + benchmark_random() % 3072;
+			}
+		}
+		
+		used[slot] = !used[slot];
+		
+		trace->operations[i].slot = slot;
+		trace->operations[i].size = size;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static int benchmark_read_trace(struct trace* trace, const char* filename)
+{
+	FILE* file = fopen(filename, "r");
+	uint32_t capacity = 1024;
+	char operation;
+	uint32_t slot;
+	
+	if (file == NULL)
+	{
+		return -1;
+	}
+	
+	trace->operations = malloc(capacity * sizeof(struct trace_operation));
+	trace->count = 0;
+	
+	while (fscanf(file, " %c %u", &operation, &slot) == 2)
+	{
+		uint32_t size = 0;
+		
+		if ((operation == 'a') && (fscanf(file, "%u", &size) != 1))
+		{
+			break;
+		}
+		
+		if (slot >= BENCHMARK_SLOTS)
+		{
+			fprintf(stderr, "Slot %u is out of range\n", slot);
+			fclose(file);
+			return -1;
+		}
+		
+		if (trace->count == capacity)
+		{
+			capacity *= 2;
+			trace->operations = realloc(trace->operations, capacity * sizeof(struct trace_operation));
+		}
+		
+		trace->operations[trace->count].slot = slot;
+		trace->operations[trace->count].size = size;
+		trace->count++;
+	}
+	
+	fclose(file);
+	
+	return 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static uint64_t benchmark_now_ns(void)
+{
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void benchmark_run(const struct benchmark_allocator* allocator, const struct trace* trace, struct benchmark_result* result)
+{
+	void* slots[BENCHMARK_SLOTS] = { NULL };
+	
+	memset(result, 0, sizeof(struct benchmark_result));
+	
+	allocator->reset();
+	
+	for (uint32_t i = 0; i < trace->count; i++)
+	{
+		const struct trace_operation* operation = &trace->operations[i];
+		void** slot = &slots[operation->slot];
+		
+		// A failed allocation leaves the slot empty, and the matching free is skipped
+		if ((operation->size == 0) && (*slot == NULL))
+		{
+			continue;
+		}
+		
+		if ((operation->size != 0) && (*slot != NULL))
+		{
+			allocator->free(*slot);
+			*slot = NULL;
+		}
+		
+		uint64_t start = benchmark_now_ns();
+		
+		if (operation->size != 0)
+		{
+			*slot = allocator->allocate(operation->size);
+		}
+		else
+		{
+			allocator->free(*slot);
+			*slot = NULL;
+		}
+		
+		uint64_t time = benchmark_now_ns() - start;
+		
+		if (operation->size != 0)
+		{
+			result->allocations++;
+			result->allocation_ns += time;
+			
+			if (time > result->allocation_max_ns)
+			{
+				result->allocation_max_ns = time;
+			}
+			
+			if (*slot == NULL)
+			{
+				result->failures++;
+			}
+		}
+		else
+		{
+			result->frees++;
+			result->free_ns += time;
+			
+			if (time > result->free_max_ns)
+			{
+				result->free_max_ns = time;
+			}
+		}
+	}
+	
+	for (uint32_t i = 0; i < BENCHMARK_SLOTS; i++)
+	{
+		if (slots[i] != NULL)
+		{
+			allocator->free(slots[i]);
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Makes count threads and deletes them again. The allocation fields of the result hold the time
+// to make a thread, and the free fields the time to delete one.
+
+static void benchmark_run_threads(const struct benchmark_thread_path* path, uint32_t count, uint32_t seed, struct benchmark_result* result)
+{
+	struct thread_structure* threads[BENCHMARK_LIVE_THREADS] = { NULL };
+	
+	memset(result, 0, sizeof(struct benchmark_result));
+	
+	benchmark_random_state = (seed != 0) ? seed : 1;
+	
+	for (uint32_t i = 0; i < count; i++)
+	{
+		struct thread_structure** slot = &threads[i % BENCHMARK_LIVE_THREADS];
+		uint32_t stack_size = benchmark_stack_sizes[benchmark_random() % (sizeof(benchmark_stack_sizes) / sizeof(uint32_t))];
+		
+		uint64_t start = benchmark_now_ns();
+		
+		if (*slot != NULL)
+		{
+			path->delete(*slot);
+		}
+		
+		uint64_t middle = benchmark_now_ns();
+		
+		*slot = path->new(stack_size);
+		
+		uint64_t end = benchmark_now_ns();
+		
+		if (middle - start > result->free_max_ns)
+		{
+			result->free_max_ns = middle - start;
+		}
+		
+		if (end - middle > result->allocation_max_ns)
+		{
+			result->allocation_max_ns = end - middle;
+		}
+		
+		result->free_ns += middle - start;
+		result->frees += (i >= BENCHMARK_LIVE_THREADS);
+		
+		result->allocation_ns += end - middle;
+		result->allocations++;
+		
+		if (*slot == NULL)
+		{
+			result->failures++;
+		}
+	}
+	
+	for (uint32_t i = 0; i < BENCHMARK_LIVE_THREADS; i++)
+	{
+		if (threads[i] != NULL)
+		{
+			path->delete(threads[i]);
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void benchmark_threads(uint32_t count, uint32_t seed)
+{
+	// The pools are taken from DRAM bank 0 once, and the first fit heap is separate
+	dynamic_memory_config();
+	thread_pool_config();
+	first_fit_reset();
+	
+	printf("%u threads, %u alive at a time\n\n", count, BENCHMARK_LIVE_THREADS);
+	printf("%-12s %12s %12s %10s %12s %12s %12s\n", "Path", "Make avg", "Make max", "Failed", "Delete avg", "Delete max", "Threads/s");
+	
+	for (uint32_t i = 0; i < sizeof(thread_paths) / sizeof(thread_paths[0]); i++)
+	{
+		struct benchmark_result result;
+		
+		benchmark_run_threads(&thread_paths[i], count, seed, &result);
+		benchmark_run_threads(&thread_paths[i], count, seed, &result);
+		
+		uint64_t total_ns = result.allocation_ns + result.free_ns;
+		
+		printf("%-12s %9llu ns %9llu ns %10u %9llu ns %9llu ns %12.0f\n", thread_paths[i].name,
+			(unsigned long long)(result.allocation_ns / result.allocations), (unsigned long long)result.allocation_max_ns, result.failures,
+			(unsigned long long)(result.frees ? result.free_ns / result.frees : 0), (unsigned long long)result.free_max_ns,
+			total_ns ? 1e9 * result.allocations / total_ns : 0.0);
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Walks the blocks of a section from the first block to the end descriptor, and checks them
+// against the section accounting and the free lists
+
+static void benchmark_check_section(Dynamic_memory_section memory_section, uint32_t used_blocks)
+{
+	Dynamic_memory_section_s* section = dynamic_memory_sections[memory_section];
+	
+	dynamic_memory_descriptor* block = section->start_descriptor;
+	dynamic_memory_descriptor* previous = NULL;
+	
+	uint32_t total_memory = 0;
+	uint32_t free_memory = 0;
+	uint32_t free_blocks = 0;
+	uint32_t used = 0;
+	
+	while (block != section->end_descriptor)
+	{
+		uint32_t size = BENCHMARK_BLOCK_SIZE(block->size);
+		
+		check(block->previous_physical == previous);
+		check(((block->size >> 28) & 0b111) == memory_section);
+		check((size >= memory_minimum_block_size) && ((size & (section->allignment - 1)) == 0));
+		
+		if (block->size & BENCHMARK_BLOCK_USED)
+		{
+			used++;
+		}
+		else
+		{
+			// Free blocks are always merged with their neighbours
+			check((previous == NULL) || ((previous->size & BENCHMARK_BLOCK_USED) != 0));
+			
+			free_memory += size;
+			free_blocks++;
+		}
+		
+		total_memory += size;
+		previous = block;
+		block = (dynamic_memory_descriptor *)((uint8_t *)block + size);
+		
+		check(block <= section->end_descriptor);
+	}
+	
+	check(section->end_descriptor->previous_physical == previous);
+	check((section->end_descriptor->size & BENCHMARK_BLOCK_USED) != 0);
+	
+	check(total_memory == section->total_memory);
+	check(free_memory == section->free_memory);
+	check(used == used_blocks);
+	
+	// The free lists must hold exactly the free blocks, and the bitmaps must match the lists
+	uint32_t listed = 0;
+	
+	for (uint32_t i = 0; i < DYNAMIC_MEMORY_FIRST_LEVEL_COUNT; i++)
+	{
+		check(((section->first_level_bitmap >> i) & 1) == (section->second_level_bitmap[i] != 0));
+		
+		for (uint32_t j = 0; j < DYNAMIC_MEMORY_SECOND_LEVEL_COUNT; j++)
+		{
+			dynamic_memory_descriptor* free_block = section->free_lists[i][j];
+			
+			check(((section->second_level_bitmap[i] >> j) & 1) == (free_block != NULL));
+			
+			while (free_block != NULL)
+			{
+				check((free_block->size & BENCHMARK_BLOCK_USED) == 0);
+				
+				listed++;
+				free_block = free_block->next_free;
+			}
+		}
+	}
+	
+	check(listed == free_blocks);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Checks that the object still holds its pattern, and fills it with a new one
+
+static void benchmark_check_pattern(struct benchmark_check_slot* slot, uint32_t size, uint8_t pattern)
+{
+	for (uint32_t i = 0; i < size; i++)
+	{
+		check(slot->memory[i] == slot->pattern);
+	}
+	
+	slot->pattern = pattern;
+	
+	memset(slot->memory, pattern, slot->size);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void benchmark_check(uint32_t count, uint32_t seed)
+{
+	struct benchmark_check_slot slots[BENCHMARK_CHECK_SLOTS] = { { NULL } };
+	struct benchmark_check_result result = { 0 };
+	
+	uint32_t used_blocks = 0;
+	
+	benchmark_random_state = (seed != 0) ? seed : 1;
+	
+	dynamic_memory_config();
+	
+	for (uint32_t i = 0; i < count; i++)
+	{
+		struct benchmark_check_slot* slot = &slots[benchmark_random() % BENCHMARK_CHECK_SLOTS];
+		uint32_t size = 1 + benchmark_random() % ((benchmark_random() % 8 == 0) ? 4096 : 256);
+		uint8_t pattern = (uint8_t)(1 + benchmark_random() % 255);
+		
+		if (slot->memory == NULL)
+		{
+			uint32_t alignment = 8 << (benchmark_random() % 6);
+			uint32_t flags = (benchmark_random() % 2) ? DYNAMIC_MEMORY_FLAG_NO_ZERO : DYNAMIC_MEMORY_FLAG_NONE;
+			
+			slot->memory = (uint8_t *)dynamic_memory_new_extended(DRAM_BANK_0, size, alignment, flags);
+			
+			result.allocations++;
+			result.aligned_allocations += (alignment > 8);
+			
+			if (slot->memory == NULL)
+			{
+				result.failures++;
+				continue;
+			}
+			
+			check(((uintptr_t)slot->memory & (alignment - 1)) == 0);
+			
+			// A cleared object reads as pattern zero
+			slot->size = size;
+			slot->pattern = 0;
+			
+			benchmark_check_pattern(slot, (flags & DYNAMIC_MEMORY_FLAG_NO_ZERO) ? 0 : size, pattern);
+			
+			used_blocks++;
+		}
+		else if (benchmark_random() % 2)
+		{
+			uint8_t* memory = (uint8_t *)dynamic_memory_realloc(slot->memory, size);
+			
+			result.reallocations++;
+			
+			if (memory == NULL)
+			{
+				result.failures++;
+				continue;
+			}
+			
+			result.moved += (memory != slot->memory);
+			
+			uint32_t kept = (size < slot->size) ? size : slot->size;
+			
+			slot->memory = memory;
+			slot->size = size;
+			
+			benchmark_check_pattern(slot, kept, pattern);
+		}
+		else
+		{
+			benchmark_check_pattern(slot, slot->size, 0);
+			
+			dynamic_memory_free(slot->memory);
+			
+			slot->memory = NULL;
+			used_blocks--;
+			result.frees++;
+		}
+		
+		benchmark_check_section(DRAM_BANK_0, used_blocks);
+	}
+	
+	for (uint32_t i = 0; i < BENCHMARK_CHECK_SLOTS; i++)
+	{
+		if (slots[i].memory != NULL)
+		{
+			benchmark_check_pattern(&slots[i], slots[i].size, 0);
+			
+			dynamic_memory_free(slots[i].memory);
+		}
+	}
+	
+	// Everything is merged back into one free block
+	benchmark_check_section(DRAM_BANK_0, 0);
+	
+	check(dynamic_memory_get_free_size(DRAM_BANK_0) == dynamic_memory_get_total_size(DRAM_BANK_0));
+	
+	printf("Allocator check          %u operations passed\n", count);
+	printf("Allocations              %u, %u aligned, %u failed\n", result.allocations, result.aligned_allocations, result.failures);
+	printf("Reallocations            %u, %u moved\n", result.reallocations, result.moved);
+	printf("Frees                    %u\n", result.frees);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Checks the interrupt reserve of a fresh section. The blocks on the reserve stay used, so the
+// walk counts them with the live objects.
+
+static void benchmark_check_reserve(void)
+{
+	uint8_t* objects[BENCHMARK_RESERVE_COUNT];
+	
+	dynamic_memory_config();
+	
+	Dynamic_memory_section_s* section = dynamic_memory_sections[DRAM_BANK_0];
+	
+	check(dynamic_memory_reserve(DRAM_BANK_0, BENCHMARK_RESERVE_SIZE, BENCHMARK_RESERVE_COUNT) == 1);
+	check(section->reserve_count == BENCHMARK_RESERVE_COUNT);
+	
+	benchmark_check_section(DRAM_BANK_0, BENCHMARK_RESERVE_COUNT);
+	
+	uint32_t object_size = section->reserve_block_size - memory_descriptor_size;
+	uint32_t free_memory = section->free_memory;
+	
+	// A request larger than the reserved blocks fails without touching the reserve
+	check(dynamic_memory_new_from_isr(DRAM_BANK_0, object_size + 1) == NULL);
+	check(section->reserve_count == BENCHMARK_RESERVE_COUNT);
+	
+	// Drain the reserve. The blocks were taken without zeroing, and must be cleared when popped.
+	for (uint32_t i = 0; i < BENCHMARK_RESERVE_COUNT; i++)
+	{
+		objects[i] = (uint8_t *)dynamic_memory_new_from_isr(DRAM_BANK_0, (i == 0) ? 1 : BENCHMARK_RESERVE_SIZE);
+		
+		check(objects[i] != NULL);
+		check(((uintptr_t)objects[i] & (section->allignment - 1)) == 0);
+		check(section->reserve_count == BENCHMARK_RESERVE_COUNT - i - 1);
+		
+		for (uint32_t j = 0; j < object_size; j++)
+		{
+			check(objects[i][j] == 0);
+		}
+		
+		memset(objects[i], 0xa5, object_size);
+	}
+	
+	check(dynamic_memory_new_from_isr(DRAM_BANK_0, BENCHMARK_RESERVE_SIZE) == NULL);
+	check(section->free_memory == free_memory);
+	
+	benchmark_check_section(DRAM_BANK_0, BENCHMARK_RESERVE_COUNT);
+	
+	// Refill the reserve. The blocks stay used, and the free memory is unchanged.
+	for (uint32_t i = 0; i < BENCHMARK_RESERVE_COUNT; i++)
+	{
+		dynamic_memory_free(objects[i]);
+		
+		check(section->reserve_count == i + 1);
+	}
+	
+	check(section->free_memory == free_memory);
+	
+	benchmark_check_section(DRAM_BANK_0, BENCHMARK_RESERVE_COUNT);
+	
+	// A block taken from the free lists refills the reserve when it is freed
+	uint8_t* isr_object = (uint8_t *)dynamic_memory_new_from_isr(DRAM_BANK_0, BENCHMARK_RESERVE_SIZE);
+	uint8_t* object = (uint8_t *)dynamic_memory_new(DRAM_BANK_0, BENCHMARK_RESERVE_SIZE);
+	
+	check((isr_object != NULL) && (object != NULL));
+	
+	for (uint32_t j = 0; j < object_size; j++)
+	{
+		check(isr_object[j] == 0);
+	}
+	
+	free_memory = section->free_memory;
+	
+	dynamic_memory_free(object);
+	
+	check(section->reserve_count == BENCHMARK_RESERVE_COUNT);
+	check(section->free_memory == free_memory);
+	
+	benchmark_check_section(DRAM_BANK_0, BENCHMARK_RESERVE_COUNT + 1);
+	
+	// With the reserve full the block goes back to the free lists
+	uint32_t block_size = BENCHMARK_BLOCK_SIZE(((dynamic_memory_descriptor *)(isr_object - memory_descriptor_size))->size);
+	
+	dynamic_memory_free(isr_object);
+	
+	check(section->reserve_count == BENCHMARK_RESERVE_COUNT);
+	check(section->free_memory == free_memory + block_size);
+	
+	benchmark_check_section(DRAM_BANK_0, BENCHMARK_RESERVE_COUNT);
+	
+	printf("Reserve check            %u blocks of %u bytes passed\n", BENCHMARK_RESERVE_COUNT, object_size);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+int main(int argc, char** argv)
+{
+	uint32_t count = 200000;
+	uint32_t seed = 1;
+	uint8_t threads = 0;
+	uint8_t check_allocator = 0;
+	int option;
+	
+	while ((option = getopt(argc, argv, "n:s:TC")) != -1)
+	{
+		switch (option)
+		{
+			case 'n' : count = strtoul(optarg, NULL, 0); break;
+			case 's' : seed = strtoul(optarg, NULL, 0); break;
+			case 'T' : threads = 1; break;
+			case 'C' : check_allocator = 1; break;
+			default :
+				fprintf(stderr, "usage: %s [-n operations] [-s seed] [-T] [-C] [trace file]\n", argv[0]);
+				return 1;
+		}
+	}
+	
+	void* dram = mmap((void *)BENCHMARK_DRAM_ADDRESS, BENCHMARK_DRAM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	
+	if (dram != (void *)BENCHMARK_DRAM_ADDRESS)
+	{
+		fprintf(stderr, "Could not map the DRAM sections at 0x%08x\n", BENCHMARK_DRAM_ADDRESS);
+		return 1;
+	}
+	
+	if (threads)
+	{
+		benchmark_threads(count, seed);
+		
+		return 0;
+	}
+	
+	if (check_allocator)
+	{
+		benchmark_check(count, seed);
+		benchmark_check_reserve();
+		
+		return 0;
+	}
+	
+	struct trace trace;
+	
+	if (optind < argc)
+	{
+		if (benchmark_read_trace(&trace, argv[optind]) != 0)
+		{
+			fprintf(stderr, "Could not read the trace %s\n", argv[optind]);
+			return 1;
+		}
+	}
+	else
+	{
+		benchmark_generate_trace(&trace, count, seed);
+	}
+	
+	printf("%u operations\n\n", trace.count);
+	printf("%-12s %12s %12s %10s %12s %12s\n", "Allocator", "Alloc avg", "Alloc max", "Failed", "Free avg", "Free max");
+	
+	for (uint32_t i = 0; i < sizeof(allocators) / sizeof(allocators[0]); i++)
+	{
+		struct benchmark_result result;
+		
+		// The first run warms up the caches and the host memory mappings
+		benchmark_run(&allocators[i], &trace, &result);
+		benchmark_run(&allocators[i], &trace, &result);
+		
+		printf("%-12s %9llu ns %9llu ns %10u %9llu ns %9llu ns\n", allocators[i].name,
+			(unsigned long long)(result.allocations ? result.allocation_ns / result.allocations : 0),
+			(unsigned long long)result.allocation_max_ns, result.failures,
+			(unsigned long long)(result.frees ? result.free_ns / result.frees : 0),
+			(unsigned long long)result.free_max_ns);
+	}
+	
+	free(trace.operations);
+	
+	return 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
\ No newline at end of file
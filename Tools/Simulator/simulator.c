@@ -0,0 +1,1078 @@
+// Copyright (c) 2020 Bjrn Brodtkorb
+//
+// This software is provided without warranty of any kind.
+// Permission is granted, free of charge, to copy and modify this
+// software, if this copyright notice is included in all copies of
+// the software.
+
+// Host simulation of the kernel scheduler
+//
+// The kernel sources scheduler.c, list.c and mutex.c are compiled unchanged for the host, together
+// with this file. The simulator plays the role of the hardware. It keeps a virtual cycle counter, runs
+// the SysTick counter against it, and emulates the SysTick and PendSV exceptions by calling the
+// kernel handlers. The threads have no code or context. Each simulated thread follows a synthetic
+// load pattern, computing for a while and then sleeping with thread_delay, or waiting for its next
+// period if it is a periodic real time thread. Build with make and run
+//
+//     ./simulator -n 2000 -c 10 -r 8 -t 20
+//
+// The simulator reports the number of scheduling decisions and context switches, the CPU share of
+// each priority level, and the host time spent in the SysTick handler for every decision. The
+// virtual time does not advance inside the kernel handlers, so the cost of the scheduler never
+// shows up as lost thread time. With -k the SysTick handler and the interrupts are charged the
+// given number of cycles before they run, so that the kernel finds time already counted in the
+// SysTick period when it changes the period, and an interrupt may call reschedule while the
+// SysTick exception is pending.
+//
+// The wake latency of a sleeping thread is the virtual time from its tick to wake until it is
+// switched in. With -L the simulator exits with an error if the worst wake latency of the real
+// time priority level is above the given number of microseconds.
+//
+// The kernel tick is checked against the virtual time after every SysTick interrupt. It must not
+// drift more than one microsecond, whether the SysTick period is stretched in tickless idle,
+// shortened for a real time budget, or cut short by a reschedule. With -i the simulator raises
+// interrupts at random intervals that call reschedule, like an interrupt that wakes a thread.
+//
+// With -m the simulator adds threads of normal priority that compute outside a shared mutex and
+// then hold it for a while. By default they block on the kernel mutex, which hands the mutex over
+// to the first waiter on unlock. With -y they instead spin on mutex_try_lock and yield between
+// the attempts, as the spinning mutex did. Since the threads have no context, a blocking call
+// returns as soon as the thread is placed in the wait list. mutex_lock_timeout then goes through
+// its timeout path, which leaves the owner priorities unchanged since the thread is still
+// waiting, and the thread is given the mutex when it is switched in again.
+
+#include "scheduler.h"
+#include "list.h"
+#include "mutex.h"
+#include "systick.h"
+#include "critical_section.h"
+#include "check.h"
+#include "config.h"
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+#define SIMULATOR_STACK_SIZE		64
+
+// The decision cost histogram has 10 ns buckets
+#define SIMULATOR_COST_BUCKETS		10000
+#define SIMULATOR_COST_BUCKET_NS	10
+
+#define CYCLES_PER_MICROSECOND		(CPU_FREQUENCY / 1000000)
+
+// Cycles a spinning thread tries the mutex before it yields
+#define SIMULATOR_SPIN_CYCLES		100
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+enum simulator_load
+{
+	SIMULATOR_LOAD_IDLE,
+	SIMULATOR_LOAD_SLEEPING,
+	SIMULATOR_LOAD_CPU_BOUND,
+	SIMULATOR_LOAD_PERIODIC,
+	SIMULATOR_LOAD_MUTEX
+};
+
+
+enum simulator_mutex_state
+{
+	SIMULATOR_MUTEX_OUTSIDE,
+	SIMULATOR_MUTEX_WAITING,
+	SIMULATOR_MUTEX_SPINNING,
+	SIMULATOR_MUTEX_HOLDING
+};
+
+
+// A simulated thread computes for a burst of cycles, and then does its action. The burst and
+// the action are drawn at random from the limits given on the command line.
+
+struct simulator_thread
+{
+	struct thread_structure*	thread;
+	enum simulator_load			load;
+	
+	uint64_t					remaining;
+	uint64_t					bursts;
+	
+	// Set from thread_delay until the thread is switched in again
+	uint8_t						waking;
+	
+	enum simulator_mutex_state	mutex_state;
+	uint64_t					lock_time;
+	
+	uint32_t					stack[SIMULATOR_STACK_SIZE];
+};
+
+
+struct simulator_options
+{
+	uint32_t	threads;
+	uint32_t	cpu_bound_percent;
+	uint32_t	real_time_threads;
+	uint32_t	seconds;
+	uint32_t	burst_max;
+	uint32_t	sleep_max;
+	uint32_t	seed;
+	uint32_t	latency_limit;
+	uint32_t	interrupt_max;
+	uint32_t	mutex_threads;
+	uint32_t	hold_max;
+	uint32_t	handler_cycles;
+	uint8_t		spin_yield;
+	uint8_t		verbose;
+	FILE*		log;
+};
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Hardware registers used by the kernel
+
+static SCB_Type scb;
+static DWT_Type dwt;
+static CoreDebug_Type core_debug;
+static Pio pioc;
+
+SCB_Type* SCB = &scb;
+DWT_Type* DWT = &dwt;
+CoreDebug_Type* CoreDebug = &core_debug;
+Pio* PIOC = &pioc;
+
+
+// Virtual time in CPU cycles, and the cycle at which the SysTick counter reaches zero
+
+static uint64_t now;
+static uint64_t systick_expiry;
+static uint32_t systick_reload;
+
+
+// Cycle of the next simulated interrupt
+
+static uint64_t interrupt_time;
+static uint64_t interrupts;
+
+
+static struct simulator_thread* simulator_threads;
+static struct simulator_options options;
+
+
+static uint64_t decisions;
+static uint64_t context_switches;
+static uint64_t cost_total;
+static uint64_t cost_max;
+static uint64_t cost_histogram[SIMULATOR_COST_BUCKETS];
+
+
+// Wake latency in microseconds for each priority level
+
+static uint64_t latency_count[THREAD_PRIORITY_LEVELS];
+static uint64_t latency_total[THREAD_PRIORITY_LEVELS];
+static uint64_t latency_max[THREAD_PRIORITY_LEVELS];
+
+
+// Largest difference in cycles between the kernel tick and the virtual time
+
+static uint64_t tick_drift_max;
+
+
+// Mutex contention. The wait is the virtual time from the lock attempt until the mutex is taken.
+
+static struct mutex simulator_mutex;
+
+static uint64_t mutex_acquisitions;
+static uint64_t mutex_wait_total;
+static uint64_t mutex_wait_max;
+static uint64_t mutex_spin_cycles;
+
+
+extern struct scheduler_info scheduler;
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+void SysTick_Handler(void);
+
+void scheduler_context_switch_accounting(void);
+
+static struct simulator_thread* simulator_thread_new(uint32_t index, enum simulator_load load, enum thread_priority priority);
+
+static void simulator_run(void);
+
+static void simulator_thread_action(struct simulator_thread* simulator_thread);
+
+static uint64_t simulator_mutex_burst(struct simulator_thread* simulator_thread);
+
+static void simulator_mutex_action(struct simulator_thread* simulator_thread);
+
+static void simulator_mutex_acquired(struct simulator_thread* simulator_thread);
+
+static void simulator_interrupt(void);
+
+static void simulator_systick(void);
+
+static void simulator_pendsv(void);
+
+static void simulator_report(void);
+
+static uint32_t simulator_random(uint32_t min, uint32_t max);
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+int main(int argc, char** argv)
+{
+	options.threads = 100;
+	options.cpu_bound_percent = 10;
+	options.real_time_threads = 0;
+	options.seconds = 10;
+	options.burst_max = 200;
+	options.sleep_max = 100;
+	options.seed = 1;
+	options.hold_max = 50;
+	
+	int option;
+	
+	while ((option = getopt(argc, argv, "n:c:r:t:b:s:S:L:i:m:H:k:yl:v")) != -1)
+	{
+		switch (option)
+		{
+			case 'n': options.threads = atoi(optarg); break;
+			case 'c': options.cpu_bound_percent = atoi(optarg); break;
+			case 'r': options.real_time_threads = atoi(optarg); break;
+			case 't': options.seconds = atoi(optarg); break;
+			case 'b': options.burst_max = atoi(optarg); break;
+			case 's': options.sleep_max = atoi(optarg); break;
+			case 'S': options.seed = atoi(optarg); break;
+			case 'L': options.latency_limit = atoi(optarg); break;
+			case 'i': options.interrupt_max = atoi(optarg); break;
+			case 'm': options.mutex_threads = atoi(optarg); break;
+			case 'H': options.hold_max = atoi(optarg); break;
+			case 'k': options.handler_cycles = atoi(optarg); break;
+			case 'y': options.spin_yield = 1; break;
+			case 'v': options.verbose = 1; break;
+			
+			case 'l':
+				options.log = fopen(optarg, "w");
+			
+				if (options.log == NULL)
+				{
+					perror(optarg);
+					return 1;
+				}
+				break;
+			
+			default:
+				fprintf(stderr, "usage: simulator [-n threads] [-c cpu bound %%] [-r real time threads] [-t seconds]\n");
+				fprintf(stderr, "                 [-b max burst us] [-s max sleep ms] [-S seed] [-L max latency us]\n");
+				fprintf(stderr, "                 [-i max interrupt interval us] [-m mutex threads] [-H max hold us] [-y]\n");
+				fprintf(stderr, "                 [-k handler cycles] [-l decision log] [-v]\n");
+				return 1;
+		}
+	}
+	
+	srand(options.seed);
+	
+	mutex_init(&simulator_mutex);
+	
+	uint32_t count = 1 + options.real_time_threads + options.threads + options.mutex_threads;
+	
+	simulator_threads = (struct simulator_thread *)calloc(count, sizeof(struct simulator_thread));
+	
+	// The first thread is the idle thread
+	simulator_thread_new(0, SIMULATOR_LOAD_IDLE, THREAD_PRIORITY_NORMAL);
+	
+	for (uint32_t i = 1; i < count; i++)
+	{
+		if (i <= options.real_time_threads)
+		{
+			simulator_thread_new(i, SIMULATOR_LOAD_PERIODIC, THREAD_PRIORITY_REAL_TIME);
+		}
+		else if (i > options.real_time_threads + options.threads)
+		{
+			simulator_thread_new(i, SIMULATOR_LOAD_MUTEX, THREAD_PRIORITY_NORMAL);
+		}
+		else if ((uint32_t)simulator_random(0, 99) < options.cpu_bound_percent)
+		{
+			// CPU bound threads would starve every level below them
+			simulator_thread_new(i, SIMULATOR_LOAD_CPU_BOUND, THREAD_PRIORITY_BULK);
+		}
+		else
+		{
+			simulator_thread_new(i, SIMULATOR_LOAD_SLEEPING, (enum thread_priority)(i % THREAD_PRIORITY_LEVELS));
+		}
+	}
+	
+	kernel_launch();
+	
+	// The SysTick counter starts from the reload value
+	systick_expiry = systick_reload;
+	interrupt_time = 0xffffffffffffffff;
+	
+	if (options.interrupt_max != 0)
+	{
+		interrupt_time = (uint64_t)simulator_random(1, options.interrupt_max) * CYCLES_PER_MICROSECOND;
+	}
+	
+	simulator_run();
+	
+	simulator_report();
+	
+	if (options.log != NULL)
+	{
+		fclose(options.log);
+	}
+	
+	if ((options.latency_limit != 0) && (latency_max[THREAD_PRIORITY_REAL_TIME] > options.latency_limit))
+	{
+		printf("Wake latency of priority %u is above %u us\n", THREAD_PRIORITY_REAL_TIME, options.latency_limit);
+		
+		return 1;
+	}
+	
+	if (tick_drift_max >= CYCLES_PER_MICROSECOND)
+	{
+		printf("Kernel tick drifted %llu cycles from the virtual time\n", (unsigned long long)tick_drift_max);
+		
+		return 1;
+	}
+	
+	return 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Makes a thread the same way as thread_new, except that the stack only has to pass the stack
+// overflow check of the scheduler
+
+static struct simulator_thread* simulator_thread_new(uint32_t index, enum simulator_load load, enum thread_priority priority)
+{
+	struct simulator_thread* simulator_thread = &simulator_threads[index];
+	struct thread_structure* thread = (struct thread_structure *)calloc(1, sizeof(struct thread_structure));
+	
+	simulator_thread->thread = thread;
+	simulator_thread->load = load;
+	
+	for (uint32_t i = 0; i < SIMULATOR_STACK_SIZE; i++)
+	{
+		simulator_thread->stack[i] = KERNEL_STACK_PAINT_PATTERN;
+	}
+	
+	thread->ID = index;
+	thread->stack_base = simulator_thread->stack;
+	thread->stack_size = SIMULATOR_STACK_SIZE * sizeof(uint32_t);
+	thread->stack_pointer = simulator_thread->stack + SIMULATOR_STACK_SIZE - 17;
+	thread->stack_watermark = thread->stack_pointer;
+	
+	thread->priority = priority;
+	thread->base_priority = priority;
+	thread->state = THREAD_STATE_RUNNING;
+	
+	thread->list_node.object = thread;
+	thread->thread_list.object = thread;
+	thread->wait_node.object = thread;
+	
+	if (load == SIMULATOR_LOAD_IDLE)
+	{
+		snprintf(thread->name, KERNEL_THREAD_MAX_NAME_LENGTH, "Idle");
+		
+		thread->next = thread;
+		scheduler.idle_thread = thread;
+		
+		return simulator_thread;
+	}
+	
+	snprintf(thread->name, KERNEL_THREAD_MAX_NAME_LENGTH, "Thread %u", index);
+	
+	if (load == SIMULATOR_LOAD_PERIODIC)
+	{
+		// Periods of 5 to 20 ms sharing about half the CPU
+		thread->real_time.period = simulator_random(5, 20) * 1000;
+		thread->real_time.deadline = thread->real_time.period;
+		thread->real_time.budget = thread->real_time.period / (2 * options.real_time_threads);
+		
+		if ((thread->real_time.budget == 0) || (scheduler_real_time_admit(&thread->real_time) == 0))
+		{
+			fprintf(stderr, "%s was not admitted\n", thread->name);
+			
+			thread->real_time.period = 0;
+			simulator_thread->load = SIMULATOR_LOAD_SLEEPING;
+		}
+		else
+		{
+			thread->real_time.absolute_deadline = thread->real_time.deadline;
+		}
+	}
+	
+	scheduler_running_queue_insert(thread);
+	list_insert_first(&(thread->thread_list), &scheduler.threads);
+	
+	return simulator_thread;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Runs the current thread until its burst ends, an interrupt is raised or the SysTick counter
+// reaches zero, and then takes the pending exceptions in priority order
+
+static void simulator_run(void)
+{
+	uint64_t end = (uint64_t)options.seconds * CPU_FREQUENCY;
+	
+	while (now < end)
+	{
+		struct simulator_thread* simulator_thread = &simulator_threads[scheduler.current_thread->ID];
+		
+		uint64_t stop = (interrupt_time < systick_expiry) ? interrupt_time : systick_expiry;
+		
+		// The counter may have reached zero while the last handler ran
+		if (stop < now)
+		{
+			stop = now;
+		}
+		
+		if (simulator_thread->load == SIMULATOR_LOAD_IDLE)
+		{
+			now = stop;
+		}
+		else
+		{
+			if (simulator_thread->remaining == 0)
+			{
+				if (simulator_thread->load == SIMULATOR_LOAD_PERIODIC)
+				{
+					// Most jobs fit in the budget, and one in twenty overruns it
+					uint32_t budget = scheduler.current_thread->real_time.budget;
+					
+					if (simulator_random(0, 19) == 0)
+					{
+						simulator_thread->remaining = (uint64_t)budget * 3 / 2 * CYCLES_PER_MICROSECOND;
+					}
+					else
+					{
+						simulator_thread->remaining = (uint64_t)simulator_random(budget / 2, budget * 4 / 5) * CYCLES_PER_MICROSECOND;
+					}
+				}
+				else if (simulator_thread->load == SIMULATOR_LOAD_MUTEX)
+				{
+					simulator_thread->remaining = simulator_mutex_burst(simulator_thread);
+				}
+				else
+				{
+					// The burst does not end on a microsecond, which the kernel tick must handle
+					simulator_thread->remaining = (uint64_t)simulator_random(1, options.burst_max) * CYCLES_PER_MICROSECOND + simulator_random(0, CYCLES_PER_MICROSECOND - 1);
+				}
+				
+				if (simulator_thread->remaining == 0)
+				{
+					simulator_thread->remaining = 1;
+				}
+			}
+			
+			uint64_t run = stop - now;
+			
+			if (simulator_thread->remaining <= run)
+			{
+				run = simulator_thread->remaining;
+			}
+			
+			now += run;
+			simulator_thread->remaining -= run;
+			
+			if ((simulator_thread->remaining == 0) && (now < stop))
+			{
+				simulator_thread_action(simulator_thread);
+			}
+		}
+		
+		if ((now >= interrupt_time) && (now < systick_expiry))
+		{
+			simulator_interrupt();
+		}
+		
+		if (now >= systick_expiry)
+		{
+			systick_expiry += systick_reload;
+			SCB->ICSR |= SCB_ICSR_PENDSTSET_Msk;
+		}
+		
+		if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk)
+		{
+			simulator_systick();
+		}
+		
+		if (SCB->ICSR & SCB_ICSR_PENDSVSET_Msk)
+		{
+			simulator_pendsv();
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void simulator_thread_action(struct simulator_thread* simulator_thread)
+{
+	simulator_thread->bursts++;
+	
+	DWT->CYCCNT = (uint32_t)now;
+	
+	if (simulator_thread->load == SIMULATOR_LOAD_SLEEPING)
+	{
+		thread_delay(simulator_random(1, options.sleep_max));
+		
+		simulator_thread->waking = 1;
+	}
+	else if (simulator_thread->load == SIMULATOR_LOAD_PERIODIC)
+	{
+		thread_wait_period();
+	}
+	else if (simulator_thread->load == SIMULATOR_LOAD_MUTEX)
+	{
+		simulator_mutex_action(simulator_thread);
+	}
+	else
+	{
+		// A CPU bound thread just starts a new burst
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Returns the next burst of a mutex thread. A waiting thread is only switched in again once the
+// mutex has been handed to it.
+
+static uint64_t simulator_mutex_burst(struct simulator_thread* simulator_thread)
+{
+	if (simulator_thread->mutex_state == SIMULATOR_MUTEX_WAITING)
+	{
+		check(simulator_mutex.owner == simulator_thread->thread);
+		
+		simulator_mutex_acquired(simulator_thread);
+	}
+	
+	if (simulator_thread->mutex_state == SIMULATOR_MUTEX_HOLDING)
+	{
+		return (uint64_t)simulator_random(1, options.hold_max) * CYCLES_PER_MICROSECOND;
+	}
+	
+	if (simulator_thread->mutex_state == SIMULATOR_MUTEX_SPINNING)
+	{
+		mutex_spin_cycles += SIMULATOR_SPIN_CYCLES;
+		
+		return SIMULATOR_SPIN_CYCLES;
+	}
+	
+	return (uint64_t)simulator_random(1, options.burst_max) * CYCLES_PER_MICROSECOND;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void simulator_mutex_action(struct simulator_thread* simulator_thread)
+{
+	switch (simulator_thread->mutex_state)
+	{
+		case SIMULATOR_MUTEX_OUTSIDE:
+			simulator_thread->lock_time = now;
+			
+			if (options.spin_yield)
+			{
+				if (mutex_try_lock(&simulator_mutex))
+				{
+					simulator_mutex_acquired(simulator_thread);
+				}
+				else
+				{
+					simulator_thread->mutex_state = SIMULATOR_MUTEX_SPINNING;
+				}
+			}
+			else
+			{
+				if (mutex_lock_timeout(&simulator_mutex, THREAD_WAIT_FOREVER))
+				{
+					simulator_mutex_acquired(simulator_thread);
+				}
+				else
+				{
+					simulator_thread->mutex_state = SIMULATOR_MUTEX_WAITING;
+				}
+			}
+			break;
+		
+		case SIMULATOR_MUTEX_SPINNING:
+			if (mutex_try_lock(&simulator_mutex))
+			{
+				simulator_mutex_acquired(simulator_thread);
+			}
+			else
+			{
+				reschedule();
+			}
+			break;
+		
+		case SIMULATOR_MUTEX_HOLDING:
+			simulator_thread->mutex_state = SIMULATOR_MUTEX_OUTSIDE;
+			
+			mutex_unlock(&simulator_mutex);
+			break;
+		
+		default:
+			break;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void simulator_mutex_acquired(struct simulator_thread* simulator_thread)
+{
+	uint64_t wait = (now - simulator_thread->lock_time) / CYCLES_PER_MICROSECOND;
+	
+	simulator_thread->mutex_state = SIMULATOR_MUTEX_HOLDING;
+	
+	mutex_acquisitions++;
+	mutex_wait_total += wait;
+	
+	if (wait > mutex_wait_max)
+	{
+		mutex_wait_max = wait;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// An interrupt in the middle of a SysTick period. It might have woken a thread, so it reschedules.
+// The interrupt runs at the SysTick level and is charged the same cycles as the SysTick handler.
+// If the counter reaches zero meanwhile, the SysTick exception stays pending until it returns.
+
+static void simulator_interrupt(void)
+{
+	interrupts++;
+	
+	now += options.handler_cycles;
+	
+	if (now >= systick_expiry)
+	{
+		systick_expiry += systick_reload;
+		SCB->ICSR |= SCB_ICSR_PENDSTSET_Msk;
+	}
+	
+	DWT->CYCCNT = (uint32_t)now;
+	
+	reschedule();
+	
+	interrupt_time = now + (uint64_t)simulator_random(1, options.interrupt_max) * CYCLES_PER_MICROSECOND + simulator_random(0, CYCLES_PER_MICROSECOND - 1);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void simulator_systick(void)
+{
+	struct timespec start;
+	struct timespec stop;
+	
+	SCB->ICSR &= ~SCB_ICSR_PENDSTSET_Msk;
+	DWT->CYCCNT = (uint32_t)now;
+	
+	// The kernel tick is the time the handler was entered, and the SysTick counter keeps counting
+	// while the handler runs
+	uint64_t entry = now;
+	
+	now += options.handler_cycles;
+	
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	
+	SysTick_Handler();
+	
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	
+	int64_t drift = (int64_t)(scheduler.tick * CYCLES_PER_MICROSECOND) - (int64_t)entry;
+	
+	if (drift < 0)
+	{
+		drift = -drift;
+	}
+	
+	if ((uint64_t)drift > tick_drift_max)
+	{
+		tick_drift_max = (uint64_t)drift;
+	}
+	
+	uint64_t cost = (uint64_t)(stop.tv_sec - start.tv_sec) * 1000000000 + (stop.tv_nsec - start.tv_nsec);
+	
+	decisions++;
+	cost_total += cost;
+	
+	if (cost > cost_max)
+	{
+		cost_max = cost;
+	}
+	
+	uint64_t bucket = cost / SIMULATOR_COST_BUCKET_NS;
+	
+	if (bucket >= SIMULATOR_COST_BUCKETS)
+	{
+		bucket = SIMULATOR_COST_BUCKETS - 1;
+	}
+	
+	cost_histogram[bucket]++;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// The PendSV handler saves the context, charges the cycles and switches to the next thread
+
+static void simulator_pendsv(void)
+{
+	SCB->ICSR &= ~SCB_ICSR_PENDSVSET_Msk;
+	
+	scheduler_context_switch_accounting();
+	
+	if (scheduler.next_thread != scheduler.current_thread)
+	{
+		context_switches++;
+		
+		struct thread_structure* thread = scheduler.next_thread;
+		
+		if (simulator_threads[thread->ID].waking)
+		{
+			simulator_threads[thread->ID].waking = 0;
+			
+			uint64_t time = now / CYCLES_PER_MICROSECOND;
+			uint64_t latency = (time > thread->tick_to_wake) ? (time - thread->tick_to_wake) : 0;
+			
+			latency_count[thread->base_priority]++;
+			latency_total[thread->base_priority] += latency;
+			
+			if (latency > latency_max[thread->base_priority])
+			{
+				latency_max[thread->base_priority] = latency;
+			}
+		}
+		
+		if (options.log != NULL)
+		{
+			fprintf(options.log, "%llu\t%s\t%s\n", (unsigned long long)(now / CYCLES_PER_MICROSECOND), scheduler.current_thread->name, scheduler.next_thread->name);
+		}
+	}
+	
+	scheduler.current_thread = scheduler.next_thread;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static uint64_t simulator_cost_percentile(uint32_t percent)
+{
+	uint64_t target = decisions * percent / 100;
+	uint64_t count = 0;
+	
+	for (uint32_t i = 0; i < SIMULATOR_COST_BUCKETS; i++)
+	{
+		count += cost_histogram[i];
+		
+		if (count > target)
+		{
+			return (uint64_t)(i + 1) * SIMULATOR_COST_BUCKET_NS;
+		}
+	}
+	
+	return cost_max;
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static void simulator_report(void)
+{
+	uint32_t count = 1 + options.real_time_threads + options.threads + options.mutex_threads;
+	
+	uint64_t level_cycles[THREAD_PRIORITY_LEVELS] = { 0 };
+	uint64_t level_switches[THREAD_PRIORITY_LEVELS] = { 0 };
+	uint32_t level_threads[THREAD_PRIORITY_LEVELS] = { 0 };
+	
+	uint64_t real_time_cycles = 0;
+	uint32_t deadline_misses = 0;
+	uint32_t overruns = 0;
+	
+	double total = (double)scheduler.total_cycles;
+	
+	for (uint32_t i = 1; i < count; i++)
+	{
+		struct thread_structure* thread = simulator_threads[i].thread;
+		
+		if (thread->real_time.period != 0)
+		{
+			real_time_cycles += thread->stats.cycles;
+			deadline_misses += thread->real_time.deadline_misses;
+			overruns += thread->real_time.overruns;
+		}
+		else
+		{
+			level_cycles[thread->base_priority] += thread->stats.cycles;
+			level_switches[thread->base_priority] += thread->context_switches;
+			level_threads[thread->base_priority]++;
+		}
+		
+		if (options.verbose)
+		{
+			printf("%-24s priority %u  cpu %6.2f %%  switches %8llu  bursts %8llu", thread->name, thread->base_priority, 100.0 * thread->stats.cycles / total,
+				(unsigned long long)thread->context_switches, (unsigned long long)simulator_threads[i].bursts);
+			
+			if (thread->real_time.period != 0)
+			{
+				printf("  misses %u  overruns %u", thread->real_time.deadline_misses, thread->real_time.overruns);
+			}
+			
+			printf("\n");
+		}
+	}
+	
+	printf("Simulated time           %.3f s\n", (double)now / CPU_FREQUENCY);
+	printf("Threads                  %u, %u periodic real time\n", count - 1, scheduler.real_time_count);
+	printf("Scheduling decisions     %llu\n", (unsigned long long)decisions);
+	printf("Context switches         %llu\n", (unsigned long long)context_switches);
+	printf("Interrupts               %llu\n", (unsigned long long)interrupts);
+	printf("Kernel tick drift        %llu cycles\n", (unsigned long long)tick_drift_max);
+	printf("Decision cost            mean %llu ns, median %llu ns, 99 %% %llu ns, max %llu ns\n",
+		(unsigned long long)(decisions ? cost_total / decisions : 0), (unsigned long long)simulator_cost_percentile(50),
+		(unsigned long long)simulator_cost_percentile(99), (unsigned long long)cost_max);
+	printf("Idle                     %.2f %%\n", 100.0 * scheduler.idle_thread->stats.cycles / total);
+	
+	if (scheduler.real_time_count != 0)
+	{
+		printf("Real time                %.2f %%, %u deadline misses, %u overruns\n", 100.0 * real_time_cycles / total, deadline_misses, overruns);
+	}
+	
+	if (options.mutex_threads != 0)
+	{
+		printf("Mutex                    %s, %u threads, %llu acquisitions, wait mean %llu us, max %llu us\n", options.spin_yield ? "spin and yield" : "blocking handoff",
+			options.mutex_threads, (unsigned long long)mutex_acquisitions, (unsigned long long)(mutex_acquisitions ? mutex_wait_total / mutex_acquisitions : 0),
+			(unsigned long long)mutex_wait_max);
+		printf("Mutex spinning           %.2f %%\n", 100.0 * mutex_spin_cycles / total);
+	}
+	
+	for (uint32_t i = 0; i < THREAD_PRIORITY_LEVELS; i++)
+	{
+		printf("Priority %u               %u threads, %.2f %%, %llu switches, wake latency mean %llu us, max %llu us\n", i, level_threads[i],
+			100.0 * level_cycles[i] / total, (unsigned long long)level_switches[i],
+			(unsigned long long)(latency_count[i] ? latency_total[i] / latency_count[i] : 0), (unsigned long long)latency_max[i]);
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+static uint32_t simulator_random(uint32_t min, uint32_t max)
+{
+	if (max <= min)
+	{
+		return min;
+	}
+	
+	return min + (uint32_t)(rand() % (max - min + 1));
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// SysTick driver. The counter value is the number of cycles left to the next interrupt. Writing
+// the counter clears it, and it is reloaded on the next cycle. The reload register has 24 bits, and
+// a zero reload value stops the counter.
+
+void systick_config(void)
+{
+	
+}
+
+
+void systick_set_reload_value(uint32_t value)
+{
+	systick_reload = value & SysTick_LOAD_RELOAD_Msk;
+}
+
+
+uint32_t systick_get_reload_value(void)
+{
+	return systick_reload;
+}
+
+
+void systick_set_counter_value(uint32_t value)
+{
+	if (systick_reload == 0)
+	{
+		printf("SysTick stopped by a zero reload value\n");
+		exit(1);
+	}
+	
+	systick_expiry = now + systick_reload;
+}
+
+
+uint32_t systick_get_counter_value(void)
+{
+	if (systick_expiry <= now)
+	{
+		return 0;
+	}
+	
+	return (uint32_t)(systick_expiry - now);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
+
+
+// Kernel dependencies that have no effect in the simulation
+
+void scheduler_start(void)
+{
+	
+}
+
+
+void interrupt_enable_peripheral_interrupt(IRQn_Type irq_type, uint32_t irq_priority)
+{
+	
+}
+
+
+void gpio_set_pin_value(Pio* hardware, uint8_t pin)
+{
+	
+}
+
+
+void gpio_clear_pin_value(Pio* hardware, uint8_t pin)
+{
+	
+}
+
+
+void core_enter_critical_section(uint32_t volatile *atomic)
+{
+	
+}
+
+
+void core_leave_critical_section(uint32_t volatile *atomic)
+{
+	
+}
+
+
+void software_timer_tick_handler(void)
+{
+	scheduler.tick_to_timer = 0xffffffffffffffff;
+}
+
+
+void thread_reaper_insert(struct thread_structure* thread)
+{
+	
+}
+
+
+// The simulator has no slab caches to print
+struct slab_cache_stats;
+
+
+struct slab_cache* slab_cache_get_list(void)
+{
+	return NULL;
+}
+
+
+void slab_cache_get_stats(struct slab_cache* cache, struct slab_cache_stats* stats)
+{
+	
+}
+
+
+uint32_t dynamic_memory_get_total_size(uint32_t memory_section)
+{
+	return 1;
+}
+
+
+uint32_t dynamic_memory_get_used_size(uint32_t memory_section)
+{
+	return 0;
+}
+
+
+void check_handler(uint8_t condition, const char* filename, uint32_t line_number)
+{
+	if (condition == 0)
+	{
+		fprintf(stderr, "Check failed in %s line %u\n", filename, line_number);
+		abort();
+	}
+}
+
+
+void board_serial_programming_print(char* data, ...)
+{
+	va_list arguments;
+	
+	va_start(arguments, data);
+	vprintf(data, arguments);
+	va_end(arguments);
+}
+
+
+void board_serial_programming_write_percent(char first, char second)
+{
+	printf("%d.%d %%", first, second);
+}
+
+
+void board_serial_print(char* data, ...)
+{
+	va_list arguments;
+	
+	va_start(arguments, data);
+	vprintf(data, arguments);
+	va_end(arguments);
+}
+
+
+//--------------------------------------------------------------------------------------------------//
\ No newline at end of file
@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+#
+# Converts a kernel trace dump to a Chrome trace file
+#
+# The kernel writes the trace ring with trace_dump() over the DMA serial interface when the trace
+# command is given on the command line. Capture the raw serial output to a file, and run
+#
+#     python3 trace_to_json.py capture.bin trace.json
+#
+# The output can be opened in chrome://tracing or in the Perfetto UI. Every thread gets its own
+# track showing when it was running. The kernel track shows the ticks, the scheduling decisions
+# and the time from each decision to the context switch.
+
+import json
+import struct
+import sys
+
+
+TRACE_DUMP_MAGIC = b"STRC"
+TRACE_DUMP_VERSION = 1
+
+THREAD_NAME_LENGTH = 32
+
+HEADER = struct.Struct("<IHHII")
+THREAD = struct.Struct("<I%ds" % THREAD_NAME_LENGTH)
+RECORD = struct.Struct("<IBBHII")
+
+EVENTS = ["tick", "schedule", "switch", "delay", "thread new"]
+REASONS = ["none", "slice end", "reschedule", "delay", "block", "exit"]
+
+KERNEL_TID = 0
+
+
+def parse_dumps(data):
+	"""Yields (frequency, threads, records) for every dump found in the capture"""
+	position = data.find(TRACE_DUMP_MAGIC)
+
+	while position >= 0:
+		magic, version, thread_count, record_count, frequency = HEADER.unpack_from(data, position)
+		offset = position + HEADER.size
+
+		end = offset + thread_count * THREAD.size + record_count * RECORD.size
+
+		if version != TRACE_DUMP_VERSION or end > len(data):
+			position = data.find(TRACE_DUMP_MAGIC, position + 1)
+			continue
+
+		threads = {}
+
+		for _ in range(thread_count):
+			address, name = THREAD.unpack_from(data, offset)
+			threads[address] = name.split(b"\0")[0].decode("latin-1")
+			offset += THREAD.size
+
+		records = [RECORD.unpack_from(data, offset + i * RECORD.size) for i in range(record_count)]
+
+		yield frequency, threads, records
+
+		position = data.find(TRACE_DUMP_MAGIC, end)
+
+
+def convert_dump(pid, frequency, threads, records):
+	events = []
+	tids = {}
+
+	def tid(address):
+		if address not in tids:
+			tids[address] = len(tids) + 1
+			name = threads.get(address, "0x%08x" % address)
+			events.append({"name": "thread_name", "ph": "M", "pid": pid, "tid": tids[address], "args": {"name": name}})
+		return tids[address]
+
+	events.append({"name": "thread_name", "ph": "M", "pid": pid, "tid": KERNEL_TID, "args": {"name": "Kernel"}})
+
+	# The cycle counter is 32 bits, so the time stamps are unwrapped while reading. A difference in
+	# the upper half of the range is taken as a step back in time rather than a wrap.
+	cycles = 0
+	last = None
+
+	running = None
+	running_start = 0
+	schedule_time = None
+
+	for record_cycles, event, reason, _, thread, argument in records:
+		if last is not None:
+			delta = (record_cycles - last) & 0xffffffff
+			if delta >= 0x80000000:
+				delta -= 0x100000000
+			cycles += delta
+		last = record_cycles
+
+		time = cycles * 1e6 / frequency
+		event_name = EVENTS[event] if event < len(EVENTS) else "event %d" % event
+		reason_name = REASONS[reason] if reason < len(REASONS) else "reason %d" % reason
+
+		if event == 0:
+			events.append({"name": "tick", "ph": "i", "s": "t", "pid": pid, "tid": KERNEL_TID, "ts": time,
+						   "args": {"reason": reason_name, "tick": argument}})
+
+		elif event == 1:
+			schedule_time = time
+			events.append({"name": "schedule", "ph": "i", "s": "t", "pid": pid, "tid": KERNEL_TID, "ts": time,
+						   "args": {"reason": reason_name,
+									"from": threads.get(thread, "0x%08x" % thread),
+									"to": threads.get(argument, "0x%08x" % argument)}})
+
+		elif event == 2:
+			if running is not None:
+				events.append({"name": "running", "ph": "X", "pid": pid, "tid": tid(running),
+							   "ts": running_start, "dur": time - running_start})
+
+			if schedule_time is not None:
+				events.append({"name": "switch", "ph": "X", "pid": pid, "tid": KERNEL_TID,
+							   "ts": schedule_time, "dur": time - schedule_time})
+				schedule_time = None
+
+			running = argument
+			running_start = time
+
+		else:
+			events.append({"name": event_name, "ph": "i", "s": "t", "pid": pid, "tid": tid(thread), "ts": time,
+						   "args": {"argument": argument}})
+
+	return events
+
+
+def main():
+	if len(sys.argv) != 3:
+		print("usage: trace_to_json.py <capture> <output.json>")
+		return 1
+
+	with open(sys.argv[1], "rb") as capture:
+		data = capture.read()
+
+	events = []
+
+	for pid, (frequency, threads, records) in enumerate(parse_dumps(data)):
+		events += convert_dump(pid, frequency, threads, records)
+
+	if not events:
+		print("No trace dump found")
+		return 1
+
+	with open(sys.argv[2], "w") as output:
+		json.dump({"traceEvents": events, "displayTimeUnit": "ns"}, output)
+
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())